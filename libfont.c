@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libfont.h"
+
+/* Atlases, generated from ui2c_font_*.bdf */
+#include "font-5x8.h"
+
+const font_glyph_t *font_glyph(const font_t *font, uint8_t c) {
+  if ((c < font->first) || (c > font->last)) {
+    c = font->fallback;
+  }
+  return &font->glyphs[c - font->first];
+}
+
+int font_text_width(const font_t *font, const char *s) {
+  int w = 0;
+
+  for (; ('\0' != *s) && ('\n' != *s); s ++) {
+    w += font_glyph(font, *s)->width;
+  }
+  return w;
+}
+
+/* Page-aligned: cells are copied as they are. */
+static void font_draw_aligned(const font_t *font, uint8_t fb[], int width, int height, int x, int p0, int c0, int c1, const font_glyph_t *g) {
+  const uint8_t *src = &font->atlas[g->offset];
+  int sp, dp;
+
+  for (sp = 0; sp < font->pages; sp ++) {
+    dp = p0 + sp;
+    if ((dp < 0) || (dp >= height / 8)) {
+      continue;
+    }
+    if ((sp == font->pages - 1) && (0 != font->height % 8)) {
+      /* Partial last page: keep what is below the cell */
+      uint8_t m = 0xff >> (8 - font->height % 8), *row = &fb[dp * width];
+      int c;
+
+      for (c = c0; c < c1; c ++) {
+        row[x + c] = (row[x + c] & ~m) | (src[sp * g->width + c] & m);
+      }
+    } else {
+      memcpy(&fb[dp * width + x + c0], &src[sp * g->width + c0], c1 - c0);
+    }
+  }
+}
+
+/* Anywhere else: every cell page straddles two framebuffer pages. */
+static void font_draw_shifted(const font_t *font, uint8_t fb[], int width, int height, int x, int p0, int shift, int c0, int c1, const font_glyph_t *g) {
+  const uint8_t *src = &font->atlas[g->offset];
+  int sp, dp, c;
+  uint8_t mask;
+
+  for (sp = 0; sp < font->pages; sp ++) {
+    mask = ((sp == font->pages - 1) && (0 != font->height % 8)) ? (0xff >> (8 - font->height % 8)) : 0xff;
+
+    dp = p0 + sp;
+    if ((dp >= 0) && (dp < height / 8)) {
+      uint8_t m = mask << shift, *row = &fb[dp * width];
+
+      for (c = c0; c < c1; c ++) {
+        row[x + c] = (row[x + c] & ~m) | ((uint8_t)(src[sp * g->width + c] << shift) & m);
+      }
+    }
+
+    dp ++;
+    if ((dp >= 0) && (dp < height / 8)) {
+      uint8_t m = mask >> (8 - shift), *row = &fb[dp * width];
+
+      for (c = c0; c < c1; c ++) {
+        row[x + c] = (row[x + c] & ~m) | ((src[sp * g->width + c] >> (8 - shift)) & m);
+      }
+    }
+  }
+}
+
+int font_draw(const font_t *font, uint8_t fb[], int width, int height, int x, int y, const char *s) {
+  const font_glyph_t *g;
+  int p0, shift, c0, c1;
+
+  if ((NULL == font) || (NULL == fb) || (NULL == s)) {
+    return x;
+  }
+
+  /* Floor division, y may be negative */
+  p0    = (y >= 0) ? (y / 8) : -((7 - y) / 8);
+  shift = y - p0 * 8;
+
+  for (; ('\0' != *s) && ('\n' != *s); s ++) {
+    g = font_glyph(font, *s);
+    if (x >= width) {
+      x += g->width;
+      continue;
+    }
+
+    c0 = (x < 0) ? -x : 0;
+    c1 = (x + g->width > width) ? width - x : g->width;
+    if (c0 < c1) {
+      if (0 == shift) {
+        font_draw_aligned(font, fb, width, height, x, p0, c0, c1, g);
+      } else {
+        font_draw_shifted(font, fb, width, height, x, p0, shift, c0, c1, g);
+      }
+    }
+    x += g->width;
+  }
+
+  return x;
+}
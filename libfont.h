@@ -0,0 +1,48 @@
+#ifndef __LIBFONT_H__
+#define __LIBFONT_H__
+
+#include <stdint.h>
+
+/******************************************************************************
+ * Bitmap fonts for page-addressed displays (SSD1306 and alike).
+ *
+ * Fonts are compiled from BDF sources at build time by ui2c-fontc into glyph
+ * atlases that are already in display layout: every glyph is a full cell of
+ * <width> columns by <height> rows, stored as (height + 7) / 8 pages of width
+ * bytes, one column per byte, LSB on top. Cells include the spacing, so they
+ * are opaque and text needs no clearing beforehand.
+ *
+ * Text whose top is on a page boundary is then one memcpy per glyph and page.
+ * Elsewhere each page is shifted across two display pages, as a blit would.
+ *****************************************************************************/
+
+typedef struct {
+  uint32_t offset;            /* Into the atlas */
+  uint8_t width;              /* Columns, spacing included */
+} font_glyph_t;
+
+typedef struct {
+  const char *name;
+  uint8_t height;             /* Rows */
+  uint8_t pages;
+  uint8_t first;              /* Encoded range, characters outside it are */
+  uint8_t last;               /* drawn as <fallback> */
+  uint8_t fallback;
+  const font_glyph_t *glyphs; /* last - first + 1 */
+  const uint8_t *atlas;
+} font_t;
+
+extern const font_t font_5x8;
+
+const font_glyph_t *font_glyph(const font_t *font, uint8_t c);
+
+/* Text is a line: both stop at '\0' or '\n'. */
+int font_text_width(const font_t *font, const char *s);
+
+/*
+ * Draws s at (x, y) into a framebuffer of width x height pixels in the layout
+ * above, clipped. Returns the x following the text.
+ */
+int font_draw(const font_t *font, uint8_t fb[], int width, int height, int x, int y, const char *s);
+
+#endif /* __LIBFONT_H__ */
@@ -0,0 +1,341 @@
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "libui2c.h"
+
+/******************************************************************************
+ * Asynchronous per-bus worker.
+ *
+ * Requests travel through two bounded lock-free rings (Vyukov's sequence
+ * numbered slots, safe for any number of producers and consumers):
+ *   submitters --sq--> worker --cq--> reaper
+ * The worker sleeps on an eventfd and is only woken when it announced that it
+ * is going to sleep, so a busy worker costs submitters no syscall. Completions
+ * either run the request's callback on the worker thread or are posted to cq
+ * and counted on a semaphore eventfd that callers can poll().
+ *****************************************************************************/
+
+typedef struct {
+  _Atomic size_t seq;
+  i2c_req_t *req;
+} i2c_slot_t;
+
+typedef struct {
+  size_t mask;
+  i2c_slot_t *slots;
+  _Atomic size_t head;        /* Next slot to pop */
+  _Atomic size_t tail;        /* Next slot to push */
+} i2c_ring_t;
+
+struct i2c_async_s {
+  i2c_bus_t *bus;
+  pthread_t thread;
+  i2c_ring_t sq;
+  i2c_ring_t cq;
+  size_t depth;
+  int wake_fd;                /* Submitters -> worker */
+  int done_fd;                /* Worker -> reaper, one count per completion */
+  atomic_size_t inflight;
+  atomic_bool sleeping;
+  atomic_bool stop;
+};
+
+
+/* Ring */
+
+static int ring_init(i2c_ring_t *r, size_t size) {
+  size_t i;
+
+  if (NULL == (r->slots = calloc(size, sizeof(r->slots[0])))) {
+    return -ENOMEM;
+  }
+  for (i = 0; i < size; i ++) {
+    atomic_init(&r->slots[i].seq, i);
+  }
+  r->mask = size - 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+
+  return 0;
+}
+
+static bool ring_push(i2c_ring_t *r, i2c_req_t *req) {
+  size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  i2c_slot_t *slot;
+
+  for (;;) {
+    slot = &r->slots[pos & r->mask];
+    intptr_t dif = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t)pos;
+
+    if (0 == dif) {
+      if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      /* Full */
+      return false;
+    } else {
+      pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    }
+  }
+
+  slot->req = req;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  return true;
+}
+
+static i2c_req_t *ring_pop(i2c_ring_t *r) {
+  size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+  i2c_slot_t *slot;
+  i2c_req_t *req;
+
+  for (;;) {
+    slot = &r->slots[pos & r->mask];
+    intptr_t dif = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t)(pos + 1);
+
+    if (0 == dif) {
+      if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      /* Empty */
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    }
+  }
+
+  req = slot->req;
+  atomic_store_explicit(&slot->seq, pos + r->mask + 1, memory_order_release);
+  return req;
+}
+
+
+/* Worker */
+
+static int async_exec(i2c_bus_t *bus, i2c_req_t *req) {
+  int res;
+
+  if ((res = i2c_select(bus, req->addr)) < 0) {
+    return res;
+  }
+
+  switch (req->op) {
+    case I2C_OP_READ: {
+      return i2c_read(bus, req->data, req->len);
+    }
+    case I2C_OP_WRITE: {
+      return i2c_write(bus, req->data, req->len);
+    }
+    case I2C_OP_WRITE_BULK: {
+      return i2c_write_bulk(bus, req->data, req->len);
+    }
+    case I2C_OP_READ_REG: {
+      return i2c_read_reg(bus, req->reg, req->data, req->len);
+    }
+    case I2C_OP_WRITE_REG: {
+      return i2c_write_reg(bus, req->reg, req->data, req->len);
+    }
+    default: {
+      return -EINVAL;
+    }
+  }
+}
+
+static void *async_worker(void *arg) {
+  i2c_async_t *async = arg;
+  const uint64_t one = 1;
+  uint64_t cnt;
+  i2c_req_t *req;
+
+  for (;;) {
+    while (NULL != (req = ring_pop(&async->sq))) {
+      req->res = async_exec(async->bus, req);
+
+      if (NULL != req->done) {
+        req->done(req);
+        atomic_fetch_sub(&async->inflight, 1);
+      } else {
+        /* Cannot overflow: inflight never exceeds the ring size. */
+        ring_push(&async->cq, req);
+        if (write(async->done_fd, &one, sizeof(one)) < 0) {
+          perror("write() completion eventfd failed");
+        }
+      }
+    }
+
+    if (atomic_load(&async->stop)) {
+      break;
+    }
+
+    /* Announce sleep, then look once more to not miss a racing submit. */
+    atomic_store(&async->sleeping, true);
+    if ((atomic_load(&async->sq.tail) == atomic_load(&async->sq.head)) && !atomic_load(&async->stop)) {
+      if ((read(async->wake_fd, &cnt, sizeof(cnt)) < 0) && (EINTR != errno)) {
+        perror("read() wake eventfd failed");
+      }
+    }
+    atomic_store(&async->sleeping, false);
+  }
+
+  return NULL;
+}
+
+static void async_wake(i2c_async_t *async) {
+  const uint64_t one = 1;
+
+  if (atomic_exchange(&async->sleeping, false)) {
+    if (write(async->wake_fd, &one, sizeof(one)) < 0) {
+      perror("write() wake eventfd failed");
+    }
+  }
+}
+
+
+/* API */
+
+int i2c_async_start(i2c_async_t **asyncp, i2c_bus_t *bus, size_t depth) {
+  i2c_async_t *async;
+  size_t size;
+  int res;
+
+  if ((NULL == asyncp) || (NULL == bus)) {
+    return -EFAULT;
+  }
+  if (!i2c_is_open(bus)) {
+    return -EBADF;
+  }
+  if (0 == depth) {
+    return -EINVAL;
+  }
+
+  for (size = 1; size < depth; size <<= 1);
+
+  if (NULL == (async = calloc(1, sizeof(*async)))) {
+    return -ENOMEM;
+  }
+  async->bus     = bus;
+  async->depth   = size;
+  async->wake_fd = -1;
+  async->done_fd = -1;
+  atomic_init(&async->inflight, 0);
+  atomic_init(&async->sleeping, false);
+  atomic_init(&async->stop, false);
+
+  if (((res = ring_init(&async->sq, size)) < 0) || ((res = ring_init(&async->cq, size)) < 0)) {
+    goto fail;
+  }
+  if ((async->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    res = -errno;
+    perror("eventfd() failed");
+    goto fail;
+  }
+  if ((async->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)) < 0) {
+    res = -errno;
+    perror("eventfd() failed");
+    goto fail;
+  }
+  if (0 != (res = pthread_create(&async->thread, NULL, async_worker, async))) {
+    res = -res;
+    goto fail;
+  }
+
+  *asyncp = async;
+  return 0;
+
+fail:
+  if (async->wake_fd >= 0) {
+    close(async->wake_fd);
+  }
+  if (async->done_fd >= 0) {
+    close(async->done_fd);
+  }
+  free(async->sq.slots);
+  free(async->cq.slots);
+  free(async);
+  return res;
+}
+
+void i2c_async_stop(i2c_async_t *async) {
+  const uint64_t one = 1;
+
+  if (NULL == async) {
+    return;
+  }
+
+  /* Worker drains what is queued, then exits. */
+  atomic_store(&async->stop, true);
+  if (write(async->wake_fd, &one, sizeof(one)) < 0) {
+    perror("write() wake eventfd failed");
+  }
+  pthread_join(async->thread, NULL);
+
+  close(async->wake_fd);
+  close(async->done_fd);
+  free(async->sq.slots);
+  free(async->cq.slots);
+  free(async);
+}
+
+int i2c_async_submit(i2c_async_t *async, i2c_req_t *req) {
+  if ((NULL == async) || (NULL == req)) {
+    return -EFAULT;
+  }
+
+  if (atomic_fetch_add(&async->inflight, 1) >= async->depth) {
+    atomic_fetch_sub(&async->inflight, 1);
+    return -EAGAIN;
+  }
+
+  req->res = -EINPROGRESS;
+  if (!ring_push(&async->sq, req)) {
+    atomic_fetch_sub(&async->inflight, 1);
+    return -EAGAIN;
+  }
+
+  /* Order the push before reading the worker's sleeping flag. */
+  atomic_thread_fence(memory_order_seq_cst);
+  async_wake(async);
+  return 0;
+}
+
+int i2c_async_fd(const i2c_async_t *async) {
+  return (NULL == async) ? -EFAULT : async->done_fd;
+}
+
+int i2c_async_reap(i2c_async_t *async, i2c_req_t **req) {
+  uint64_t cnt;
+
+  if ((NULL == async) || (NULL == req)) {
+    return -EFAULT;
+  }
+
+  if (read(async->done_fd, &cnt, sizeof(cnt)) < 0) {
+    return -errno;
+  }
+
+  /* Pushed before it was counted */
+  *req = ring_pop(&async->cq);
+  atomic_fetch_sub(&async->inflight, 1);
+  return 0;
+}
+
+int i2c_async_wait(i2c_async_t *async, i2c_req_t **req) {
+  struct pollfd pfd = {.fd = i2c_async_fd(async), .events = POLLIN};
+  int res;
+
+  while (-EAGAIN == (res = i2c_async_reap(async, req))) {
+    if ((poll(&pfd, 1, -1) < 0) && (EINTR != errno)) {
+      return -errno;
+    }
+  }
+
+  return res;
+}
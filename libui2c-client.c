@@ -0,0 +1,164 @@
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "libui2c.h"
+#include "ui2cd.h"
+
+/******************************************************************************
+ * Client backend: forwards register-level operations to ui2cd instead of
+ * driving /dev/i2c-N directly. The daemon picks the real transport.
+ *****************************************************************************/
+
+static int client_call(i2c_bus_t *bus, ui2cd_req_t *req, const uint8_t out[], size_t out_len,
+                       uint8_t in[], size_t in_len, int32_t *arg) {
+  uint8_t buf[sizeof(ui2cd_rsp_t) + UI2CD_DATA_MAX];
+  struct iovec iov[2] = {
+    {.iov_base = req,           .iov_len = sizeof(*req)},
+    {.iov_base = (uint8_t *)out, .iov_len = out_len},
+  };
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (out_len > 0) ? 2 : 1};
+  ui2cd_rsp_t rsp;
+  ssize_t n;
+  int res;
+
+  if ((out_len > UI2CD_DATA_MAX) || (in_len > UI2CD_DATA_MAX)) {
+    return -EMSGSIZE;
+  }
+
+  req->addr = bus->addr;
+  req->len  = (out_len > 0) ? out_len : in_len;
+
+  bus->stats.syscalls += 2;
+  if (sendmsg(bus->file, &msg, MSG_NOSIGNAL) < 0) {
+    res = -errno;
+    perror("sendmsg() to ui2cd failed");
+    return res;
+  }
+  if ((n = recv(bus->file, buf, sizeof(buf), 0)) < 0) {
+    res = -errno;
+    perror("recv() from ui2cd failed");
+    return res;
+  }
+
+  if (n < (ssize_t)sizeof(rsp)) {
+    return -EPROTO;
+  }
+  memcpy(&rsp, buf, sizeof(rsp));
+  if (rsp.res < 0) {
+    return rsp.res;
+  }
+  if ((rsp.len != in_len) || (n != (ssize_t)(sizeof(rsp) + in_len))) {
+    return -EPROTO;
+  }
+
+  memcpy(in, &buf[sizeof(rsp)], in_len);
+  if (NULL != arg) {
+    *arg = rsp.arg;
+  }
+  return 0;
+}
+
+static int client_read(i2c_bus_t *bus, uint8_t data[], size_t len) {
+  ui2cd_req_t req = {.op = UI2CD_OP_READ};
+
+  return client_call(bus, &req, NULL, 0, data, len, NULL);
+}
+
+static int client_write(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  ui2cd_req_t req = {.op = UI2CD_OP_WRITE};
+
+  return client_call(bus, &req, data, len, NULL, 0, NULL);
+}
+
+static int client_write_bulk(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  uint8_t chunk[UI2CD_DATA_MAX];
+  size_t off, n;
+  int res;
+
+  /* Usually fits in one packet, otherwise repeat the prefix like the SMBus transports do. */
+  chunk[0] = data[0];
+  for (off = 1; off < len; off += n) {
+    ui2cd_req_t req = {.op = UI2CD_OP_WRITE_BULK};
+
+    n = len - off;
+    if (n > UI2CD_DATA_MAX - 1) {
+      n = UI2CD_DATA_MAX - 1;
+    }
+    memcpy(&chunk[1], &data[off], n);
+    if ((res = client_call(bus, &req, chunk, n + 1, NULL, 0, NULL)) < 0) {
+      return res;
+    }
+  }
+
+  return 0;
+}
+
+static int client_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len) {
+  ui2cd_req_t req = {.op = UI2CD_OP_READ_REG, .reg = reg_addr};
+
+  return client_call(bus, &req, NULL, 0, data, len, NULL);
+}
+
+static int client_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len) {
+  ui2cd_req_t req = {.op = UI2CD_OP_WRITE_REG, .reg = reg_addr};
+
+  return client_call(bus, &req, data, len, NULL, 0, NULL);
+}
+
+const i2c_ops_t i2c_ops_ui2cd = {
+  .name       = "ui2cd",
+  .read       = client_read,
+  .write      = client_write,
+  .write_bulk = client_write_bulk,
+  .read_reg   = client_read_reg,
+  .write_reg  = client_write_reg,
+};
+
+int i2c_client_open(i2c_bus_t *bus, int nr, const char *path) {
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+  ui2cd_req_t req = {.op = UI2CD_OP_OPEN, .arg = nr};
+  int32_t funcs;
+  int res, fd;
+
+  if ((NULL == path) || ('\0' == path[0])) {
+    path = UI2CD_SOCK_DEF;
+  }
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    return -ENAMETOOLONG;
+  }
+  strcpy(sa.sun_path, path);
+
+  if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+    res = -errno;
+    perror("socket() failed");
+    return res;
+  }
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    res = -errno;
+    fprintf(stderr, "connect() to ui2cd at %s failed: %s\n", path, strerror(errno));
+    close(fd);
+    return res;
+  }
+
+  bus->file   = fd;
+  bus->addr   = 0;
+  bus->remote = true;
+  bus->ops    = &i2c_ops_ui2cd;
+  if ((res = client_call(bus, &req, NULL, 0, NULL, 0, &funcs)) < 0) {
+    fprintf(stderr, "ERROR: ui2cd does not serve i2c-%d.\n", nr);
+    close(fd);
+    bus->file   = -1;
+    bus->remote = false;
+    bus->ops    = NULL;
+    return res;
+  }
+
+  bus->addr  = -1;
+  bus->funcs = (uint32_t)funcs;
+  return 0;
+}
@@ -0,0 +1,885 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "libui2c.h"
+
+/******************************************************************************
+ * Simulated I2C bus.
+ *
+ * Carries register-level models of every device supported by ui2c, at their
+ * default addresses:
+ *   0x3c, 0x3d  SSD1306  (command parser + GDDRAM)
+ *   0x40..0x47  TMP007
+ *   0x5a        MLX90614 (with SMBus PEC)
+ *   0x60        TEA5767
+ *   0x68        DS1307   (ticking clock + NV SRAM)
+ *
+ * Timing model: every transaction costs START + STOP + 9 SCL periods per byte
+ * (address bytes included) + 1 SCL period per repeated START, plus an optional
+ * fixed per-transaction cost standing in for adapter and driver latency. The
+ * bus is a serial resource: a transfer sleeps until the modelled bus time has
+ * passed, so wall clock measurements behave like on real hardware.
+ *
+ * Spec (UI2C_SIM): <kHz>[,<us per transaction>[,<fault %>]], e.g. "100",
+ * "400,50", "100,0,5". Faults are injected into that share of transactions:
+ * mostly data NACKs (-EREMOTEIO), every fourth one a stuck bus (-ETIMEDOUT).
+ * If UI2C_SIM_DUMP is set, device states are printed when the bus is closed.
+ *****************************************************************************/
+
+#define SIM_DEVS_MAX (16)
+
+typedef struct sim_dev_s sim_dev_t;
+
+struct sim_dev_s {
+  const char *name;
+  uint8_t addr;
+  void (*start)(sim_dev_t *dev);                                   /* Addressed after (RE)START */
+  void (*write)(sim_dev_t *dev, const uint8_t data[], size_t len); /* One write message */
+  void (*read)(sim_dev_t *dev, uint8_t data[], size_t len);        /* One read message */
+  void (*dump)(sim_dev_t *dev, FILE *fp);
+};
+
+struct i2c_sim_s {
+  int nr;
+  long bit_ns;                /* One SCL period */
+  long txn_ns;                /* Fixed extra cost per transaction */
+  struct timespec free_at;    /* When the bus becomes idle */
+  unsigned long txns;
+  unsigned long nacks;
+  unsigned long faults;
+  unsigned fault_pct;
+  unsigned seed;
+  unsigned long bytes;
+  unsigned long long busy_ns;
+  size_t ndevs;
+  sim_dev_t *devs[SIM_DEVS_MAX];
+};
+
+
+/* Helpers */
+
+static uint8_t sim_bcd2i(uint8_t bcd) {
+  return (bcd >> 4) * 10 + (bcd & 0x0f);
+}
+
+static uint8_t sim_i2bcd(uint8_t i) {
+  return ((i / 10) << 4) | (i % 10);
+}
+
+static void sim_timespec_add_ns(struct timespec *ts, unsigned long long ns) {
+  ns += ts->tv_nsec;
+  ts->tv_sec  += ns / 1000000000ull;
+  ts->tv_nsec  = ns % 1000000000ull;
+}
+
+static bool sim_timespec_before(const struct timespec *a, const struct timespec *b) {
+  return (a->tv_sec < b->tv_sec) || ((a->tv_sec == b->tv_sec) && (a->tv_nsec < b->tv_nsec));
+}
+
+
+/*
+ * SSD1306: command parser and 128x64 GDDRAM
+ *
+ * Continuous horizontal scroll rotates the scrolled pages of GDDRAM by one
+ * column every <interval> display frames. The model catches up lazily,
+ * whenever GDDRAM is touched. One frame lasts K * MUX / Fosc with reset
+ * clock and precharge settings: K = 2 + 2 + 50 DCLKs, Fosc = 370 kHz.
+ */
+
+#define SIM_SSD1306_FOSC_HZ (370000)
+#define SIM_SSD1306_K       (54)
+
+typedef struct {
+  sim_dev_t dev;
+  uint8_t gddram[8][128];
+  uint8_t cmd[8];             /* Command being assembled */
+  size_t ncmd;
+  size_t need;                /* Parameters expected for cmd[0] */
+  uint8_t mode;
+  uint8_t col, col_start, col_end;
+  uint8_t page, page_start, page_end;
+  uint8_t contrast;
+  uint8_t mux;
+  bool on;
+  uint8_t scroll[7];          /* Last 26h/27h setup, scroll[0] == 0 if none */
+  bool scrolling;
+  struct timespec scroll_at;  /* Next scroll step */
+  unsigned long scroll_steps;
+  unsigned long data_bytes;
+} sim_ssd1306_t;
+
+static long sim_ssd1306_step_ns(sim_ssd1306_t *d) {
+  static const int frames[8] = {5, 64, 128, 256, 3, 4, 25, 2};
+
+  return (long)((long long)frames[d->scroll[3] & 0x07] * SIM_SSD1306_K * d->mux * 1000000000 / SIM_SSD1306_FOSC_HZ);
+}
+
+static void sim_ssd1306_scroll_catchup(sim_ssd1306_t *d) {
+  uint8_t tmp;
+  struct timespec now;
+  int p;
+
+  if (!d->scrolling) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  while (!sim_timespec_before(&now, &d->scroll_at)) {
+    for (p = d->scroll[2] & 0x07; p <= (d->scroll[4] & 0x07); p ++) {
+      if (0x27 == d->scroll[0]) {
+        tmp = d->gddram[p][0];
+        memmove(&d->gddram[p][0], &d->gddram[p][1], 127);
+        d->gddram[p][127] = tmp;
+      } else {
+        tmp = d->gddram[p][127];
+        memmove(&d->gddram[p][1], &d->gddram[p][0], 127);
+        d->gddram[p][0] = tmp;
+      }
+    }
+    d->scroll_steps ++;
+    sim_timespec_add_ns(&d->scroll_at, sim_ssd1306_step_ns(d));
+  }
+}
+
+static size_t sim_ssd1306_nparams(uint8_t op) {
+  switch (op) {
+    case 0x26:
+    case 0x27: {
+      return 6;
+    }
+    case 0x29:
+    case 0x2a: {
+      return 5;
+    }
+    case 0x21:
+    case 0x22:
+    case 0xa3: {
+      return 2;
+    }
+    case 0x20:
+    case 0x23:
+    case 0x81:
+    case 0x8d:
+    case 0xa8:
+    case 0xd3:
+    case 0xd5:
+    case 0xd6:
+    case 0xd9:
+    case 0xda:
+    case 0xdb: {
+      return 1;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+static void sim_ssd1306_exec(sim_ssd1306_t *d) {
+  uint8_t op = d->cmd[0];
+
+  sim_ssd1306_scroll_catchup(d);
+  if (op <= 0x0f) {
+    d->col = (d->col & 0x70) | (op & 0x0f);
+  } else if (op <= 0x1f) {
+    d->col = ((op & 0x07) << 4) | (d->col & 0x0f);
+  } else if ((op >= 0xb0) && (op <= 0xb7)) {
+    d->page = op & 0x07;
+  } else {
+    switch (op) {
+      case 0x20: {
+        d->mode = d->cmd[1] & 0x03;
+        break;
+      }
+      case 0x21: {
+        d->col_start = d->cmd[1] & 0x7f;
+        d->col_end   = d->cmd[2] & 0x7f;
+        d->col       = d->col_start;
+        break;
+      }
+      case 0x22: {
+        d->page_start = d->cmd[1] & 0x07;
+        d->page_end   = d->cmd[2] & 0x07;
+        d->page       = d->page_start;
+        break;
+      }
+      case 0x81: {
+        d->contrast = d->cmd[1];
+        break;
+      }
+      case 0xa8: {
+        d->mux = (d->cmd[1] & 0x3f) + 1;
+        break;
+      }
+      case 0x26:
+      case 0x27: {
+        /* Only allowed while not scrolling, ignored otherwise. */
+        if (!d->scrolling) {
+          memcpy(d->scroll, d->cmd, sizeof(d->scroll));
+        }
+        break;
+      }
+      case 0x2e: {
+        d->scrolling = false;
+        break;
+      }
+      case 0x2f: {
+        if ((0 != d->scroll[0]) && (!d->scrolling)) {
+          d->scrolling = true;
+          clock_gettime(CLOCK_MONOTONIC, &d->scroll_at);
+          sim_timespec_add_ns(&d->scroll_at, sim_ssd1306_step_ns(d));
+        }
+        break;
+      }
+      case 0xae:
+      case 0xaf: {
+        d->on = (0xaf == op);
+        break;
+      }
+      default: {
+        /* Accepted, but has no effect on the model. */
+        break;
+      }
+    }
+  }
+
+  d->ncmd = 0;
+}
+
+static void sim_ssd1306_cmd(sim_ssd1306_t *d, uint8_t b) {
+  if (0 == d->ncmd) {
+    d->need = sim_ssd1306_nparams(b);
+  }
+  d->cmd[d->ncmd ++] = b;
+  if (d->ncmd == d->need + 1) {
+    sim_ssd1306_exec(d);
+  }
+}
+
+static void sim_ssd1306_data(sim_ssd1306_t *d, uint8_t b) {
+  d->gddram[d->page][d->col] = b;
+  d->data_bytes ++;
+
+  switch (d->mode) {
+    case 0x00: {
+      /* Horizontal */
+      if (d->col >= d->col_end) {
+        d->col = d->col_start;
+        d->page = (d->page >= d->page_end) ? d->page_start : d->page + 1;
+      } else {
+        d->col ++;
+      }
+      break;
+    }
+    case 0x01: {
+      /* Vertical */
+      if (d->page >= d->page_end) {
+        d->page = d->page_start;
+        d->col = (d->col >= d->col_end) ? d->col_start : d->col + 1;
+      } else {
+        d->page ++;
+      }
+      break;
+    }
+    default: {
+      /* Page: column wraps within the page */
+      d->col = (d->col + 1) & 0x7f;
+      break;
+    }
+  }
+}
+
+static void sim_ssd1306_write(sim_dev_t *dev, const uint8_t data[], size_t len) {
+  sim_ssd1306_t *d = (sim_ssd1306_t *)dev;
+  size_t i = 0;
+
+  sim_ssd1306_scroll_catchup(d);
+
+  while (i < len) {
+    uint8_t ctrl = data[i ++];
+    bool dc = ctrl & 0x40;
+
+    if (ctrl & 0x80) {
+      /* CONT: exactly one byte follows, then another control byte */
+      if (i < len) {
+        if (dc) {
+          sim_ssd1306_data(d, data[i]);
+        } else {
+          sim_ssd1306_cmd(d, data[i]);
+        }
+        i ++;
+      }
+      continue;
+    }
+
+    for (; i < len; i ++) {
+      if (dc) {
+        sim_ssd1306_data(d, data[i]);
+      } else {
+        sim_ssd1306_cmd(d, data[i]);
+      }
+    }
+  }
+}
+
+static void sim_ssd1306_read(sim_dev_t *dev, uint8_t data[], size_t len) {
+  sim_ssd1306_t *d = (sim_ssd1306_t *)dev;
+
+  memset(data, d->on ? 0x00 : 0x40, len);
+}
+
+static void sim_ssd1306_dump(sim_dev_t *dev, FILE *fp) {
+  sim_ssd1306_t *d = (sim_ssd1306_t *)dev;
+  int x, y;
+
+  sim_ssd1306_scroll_catchup(d);
+  fprintf(fp, "  display %s, contrast 0x%02x, %lu data bytes written, %lu scroll steps%s\n", d->on ? "on" : "off", d->contrast,
+          d->data_bytes, d->scroll_steps, d->scrolling ? " (scrolling)" : "");
+  for (y = 0; y < 64; y ++) {
+    fputs("  |", fp);
+    for (x = 0; x < 128; x ++) {
+      fputc((d->gddram[y / 8][x] & (1 << (y % 8))) ? '@' : ' ', fp);
+    }
+    fputs("|\n", fp);
+  }
+}
+
+static sim_dev_t *sim_new_ssd1306(uint8_t addr) {
+  sim_ssd1306_t *d = calloc(1, sizeof(*d));
+
+  if (NULL == d) {
+    return NULL;
+  }
+
+  d->dev.name  = "SSD1306";
+  d->dev.addr  = addr;
+  d->dev.write = sim_ssd1306_write;
+  d->dev.read  = sim_ssd1306_read;
+  d->dev.dump  = sim_ssd1306_dump;
+  /* POR defaults */
+  d->mode      = 0x02;
+  d->mux       = 64;
+  d->col_end   = 127;
+  d->page_end  = 7;
+  d->contrast  = 0x7f;
+
+  return &d->dev;
+}
+
+
+/* DS1307: BCD clock ticking in real time, 56 bytes NV SRAM */
+
+typedef struct {
+  sim_dev_t dev;
+  uint8_t ptr;
+  uint8_t ram[64];
+  struct timespec last;       /* When the seconds register last advanced */
+} sim_ds1307_t;
+
+static void sim_ds1307_advance(sim_ds1307_t *d, time_t secs) {
+  struct tm tm;
+  time_t t0, t1;
+  uint8_t hrs = d->ram[0x02];
+  bool h12 = hrs & 0x40;
+
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_sec  = sim_bcd2i(d->ram[0x00] & 0x7f);
+  tm.tm_min  = sim_bcd2i(d->ram[0x01]);
+  if (h12) {
+    tm.tm_hour = sim_bcd2i(hrs & 0x1f) % 12 + ((hrs & 0x20) ? 12 : 0);
+  } else {
+    tm.tm_hour = sim_bcd2i(hrs & 0x3f);
+  }
+  tm.tm_mday = sim_bcd2i(d->ram[0x04]);
+  tm.tm_mon  = sim_bcd2i(d->ram[0x05]) - 1;
+  tm.tm_year = sim_bcd2i(d->ram[0x06]) + 100;
+
+  t0 = timegm(&tm);
+  t1 = t0 + secs;
+  gmtime_r(&t1, &tm);
+
+  d->ram[0x00] = sim_i2bcd(tm.tm_sec);
+  d->ram[0x01] = sim_i2bcd(tm.tm_min);
+  if (h12) {
+    int h = tm.tm_hour % 12;
+    d->ram[0x02] = 0x40 | ((tm.tm_hour >= 12) ? 0x20 : 0x00) | sim_i2bcd((0 == h) ? 12 : h);
+  } else {
+    d->ram[0x02] = sim_i2bcd(tm.tm_hour);
+  }
+  d->ram[0x03] = (d->ram[0x03] - 1 + (t1 / 86400 - t0 / 86400)) % 7 + 1;
+  d->ram[0x04] = sim_i2bcd(tm.tm_mday);
+  d->ram[0x05] = sim_i2bcd(tm.tm_mon + 1);
+  d->ram[0x06] = sim_i2bcd(tm.tm_year % 100);
+}
+
+static void sim_ds1307_start(sim_dev_t *dev) {
+  /* The chip copies the running time into its user buffer on START. */
+  sim_ds1307_t *d = (sim_ds1307_t *)dev;
+  struct timespec now;
+  time_t secs;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (d->ram[0x00] & 0x80) {
+    /* Halted */
+    d->last = now;
+    return;
+  }
+
+  secs = now.tv_sec - d->last.tv_sec - ((now.tv_nsec < d->last.tv_nsec) ? 1 : 0);
+  if (secs > 0) {
+    sim_ds1307_advance(d, secs);
+    d->last.tv_sec += secs;
+  }
+}
+
+static void sim_ds1307_write(sim_dev_t *dev, const uint8_t data[], size_t len) {
+  sim_ds1307_t *d = (sim_ds1307_t *)dev;
+  size_t i;
+
+  if (0 == len) {
+    return;
+  }
+
+  d->ptr = data[0] & 0x3f;
+  for (i = 1; i < len; i ++) {
+    d->ram[d->ptr] = data[i];
+    if (0x00 == d->ptr) {
+      /* Writing seconds resets the countdown chain. */
+      clock_gettime(CLOCK_MONOTONIC, &d->last);
+    }
+    d->ptr = (d->ptr + 1) & 0x3f;
+  }
+}
+
+static void sim_ds1307_read(sim_dev_t *dev, uint8_t data[], size_t len) {
+  sim_ds1307_t *d = (sim_ds1307_t *)dev;
+  size_t i;
+
+  for (i = 0; i < len; i ++) {
+    data[i] = d->ram[d->ptr];
+    d->ptr = (d->ptr + 1) & 0x3f;
+  }
+}
+
+static void sim_ds1307_dump(sim_dev_t *dev, FILE *fp) {
+  sim_ds1307_t *d = (sim_ds1307_t *)dev;
+  int i;
+
+  for (i = 0; i < 64; i ++) {
+    fprintf(fp, "%s%02x", (0 == i % 16) ? "  " : " ", d->ram[i]);
+    if (15 == i % 16) {
+      fputc('\n', fp);
+    }
+  }
+}
+
+static sim_dev_t *sim_new_ds1307(uint8_t addr) {
+  sim_ds1307_t *d = calloc(1, sizeof(*d));
+  /* POR: 2000-01-01 Saturday 00:00:00, oscillator halted */
+  const uint8_t por[8] = {0x80, 0x00, 0x00, 0x01, 0x01, 0x01, 0x00, 0x03};
+
+  if (NULL == d) {
+    return NULL;
+  }
+
+  d->dev.name  = "DS1307";
+  d->dev.addr  = addr;
+  d->dev.start = sim_ds1307_start;
+  d->dev.write = sim_ds1307_write;
+  d->dev.read  = sim_ds1307_read;
+  d->dev.dump  = sim_ds1307_dump;
+  memcpy(d->ram, por, sizeof(por));
+  clock_gettime(CLOCK_MONOTONIC, &d->last);
+
+  return &d->dev;
+}
+
+
+/* TMP007: 16-bit big-endian registers behind a pointer register */
+
+typedef struct {
+  sim_dev_t dev;
+  uint8_t ptr;
+  uint8_t idx;                /* Byte within the current register */
+  uint16_t reg[0x30];
+} sim_tmp007_t;
+
+static uint16_t sim_tmp007_temp(double c) {
+  return ((int16_t)(c / 0.03125)) << 2;
+}
+
+static void sim_tmp007_start(sim_dev_t *dev) {
+  sim_tmp007_t *d = (sim_tmp007_t *)dev;
+  struct timespec now;
+
+  /* Slowly wandering object temperature, so pollers see changing data. */
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  d->reg[0x01] = sim_tmp007_temp(25.0 + (d->dev.addr & 0x07) * 0.25);
+  d->reg[0x03] = sim_tmp007_temp(36.5 + ((now.tv_sec % 20) - 10) * 0.0625);
+  d->idx = 0;
+}
+
+static void sim_tmp007_write(sim_dev_t *dev, const uint8_t data[], size_t len) {
+  sim_tmp007_t *d = (sim_tmp007_t *)dev;
+
+  if (0 == len) {
+    return;
+  }
+
+  d->ptr = data[0];
+  if ((len >= 3) && (d->ptr < 0x30)) {
+    d->reg[d->ptr] = (data[1] << 8) | data[2];
+  }
+}
+
+static void sim_tmp007_read(sim_dev_t *dev, uint8_t data[], size_t len) {
+  sim_tmp007_t *d = (sim_tmp007_t *)dev;
+  uint16_t reg = (d->ptr < 0x30) ? d->reg[d->ptr] : 0x0000;
+  size_t i;
+
+  for (i = 0; i < len; i ++) {
+    data[i] = d->idx ? (reg & 0xff) : (reg >> 8);
+    d->idx ^= 1;
+  }
+}
+
+static sim_dev_t *sim_new_tmp007(uint8_t addr) {
+  sim_tmp007_t *d = calloc(1, sizeof(*d));
+
+  if (NULL == d) {
+    return NULL;
+  }
+
+  d->dev.name  = "TMP007";
+  d->dev.addr  = addr;
+  d->dev.start = sim_tmp007_start;
+  d->dev.write = sim_tmp007_write;
+  d->dev.read  = sim_tmp007_read;
+  d->reg[0x00] = 0xff38;  /* Sensor voltage */
+  d->reg[0x02] = 0x1440;  /* Config */
+  d->reg[0x04] = 0x4000;  /* Status: conversion ready */
+  d->reg[0x06] = 0x7fc0;  /* Limits */
+  d->reg[0x07] = 0x8000;
+  d->reg[0x08] = 0x7fc0;
+  d->reg[0x09] = 0x8000;
+  d->reg[0x1f] = 0x0078;  /* Device ID */
+  sim_tmp007_start(&d->dev);
+
+  return &d->dev;
+}
+
+
+/* MLX90614: SMBus words (LSB, MSB, PEC) from RAM and EEPROM */
+
+typedef struct {
+  sim_dev_t dev;
+  uint8_t cmd;
+  uint8_t idx;
+  uint16_t ram[0x20];
+  uint16_t eeprom[0x20];
+} sim_mlx90614_t;
+
+static uint8_t sim_crc8(uint8_t crc, uint8_t b) {
+  int i;
+
+  crc ^= b;
+  for (i = 0; i < 8; i ++) {
+    crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+  }
+
+  return crc;
+}
+
+static void sim_mlx90614_start(sim_dev_t *dev) {
+  ((sim_mlx90614_t *)dev)->idx = 0;
+}
+
+static void sim_mlx90614_write(sim_dev_t *dev, const uint8_t data[], size_t len) {
+  sim_mlx90614_t *d = (sim_mlx90614_t *)dev;
+
+  if (0 == len) {
+    return;
+  }
+
+  d->cmd = data[0];
+  if ((len >= 3) && ((d->cmd & 0xe0) == 0x20)) {
+    d->eeprom[d->cmd & 0x1f] = data[1] | (data[2] << 8);
+  }
+}
+
+static void sim_mlx90614_read(sim_dev_t *dev, uint8_t data[], size_t len) {
+  sim_mlx90614_t *d = (sim_mlx90614_t *)dev;
+  uint16_t word = 0xffff;
+  uint8_t frame[3];
+  size_t i;
+
+  if ((d->cmd & 0xe0) == 0x00) {
+    word = d->ram[d->cmd & 0x1f];
+  } else if ((d->cmd & 0xe0) == 0x20) {
+    word = d->eeprom[d->cmd & 0x1f];
+  }
+
+  frame[0] = word & 0xff;
+  frame[1] = word >> 8;
+  frame[2] = sim_crc8(sim_crc8(sim_crc8(sim_crc8(sim_crc8(0, d->dev.addr << 1), d->cmd), (d->dev.addr << 1) | 1), frame[0]), frame[1]);
+
+  for (i = 0; i < len; i ++) {
+    data[i] = (d->idx < 3) ? frame[d->idx] : 0xff;
+    d->idx ++;
+  }
+}
+
+static sim_dev_t *sim_new_mlx90614(uint8_t addr) {
+  sim_mlx90614_t *d = calloc(1, sizeof(*d));
+
+  if (NULL == d) {
+    return NULL;
+  }
+
+  d->dev.name  = "MLX90614";
+  d->dev.addr  = addr;
+  d->dev.start = sim_mlx90614_start;
+  d->dev.write = sim_mlx90614_write;
+  d->dev.read  = sim_mlx90614_read;
+  /* Kelvin * 50 */
+  d->ram[0x06] = (25.00 + 273.15) * 50;
+  d->ram[0x07] = (36.50 + 273.15) * 50;
+  d->ram[0x08] = (36.40 + 273.15) * 50;
+  d->eeprom[0x00] = 0x9993;
+  d->eeprom[0x01] = 0x62e3;
+  d->eeprom[0x02] = 0x0201;
+  d->eeprom[0x03] = 0xf71c;
+  d->eeprom[0x04] = 0xffff;
+  d->eeprom[0x05] = 0x9fb4;
+  d->eeprom[0x0e] = 0xbe00 | addr;
+  d->eeprom[0x1c] = 0x5349;
+  d->eeprom[0x1d] = 0x4d55;
+  d->eeprom[0x1e] = 0x4c41;
+  d->eeprom[0x1f] = 0x5445;
+
+  return &d->dev;
+}
+
+
+/* TEA5767: 5 write bytes in, 5 status bytes out, no register pointer */
+
+typedef struct {
+  sim_dev_t dev;
+  uint8_t cfg[5];
+} sim_tea5767_t;
+
+static void sim_tea5767_write(sim_dev_t *dev, const uint8_t data[], size_t len) {
+  sim_tea5767_t *d = (sim_tea5767_t *)dev;
+
+  memcpy(d->cfg, data, (len > 5) ? 5 : len);
+}
+
+static void sim_tea5767_read(sim_dev_t *dev, uint8_t data[], size_t len) {
+  sim_tea5767_t *d = (sim_tea5767_t *)dev;
+  /* Ready, tuned to the written PLL, stereo, IF count 0x37, level 10 */
+  const uint8_t status[5] = {0x80 | (d->cfg[0] & 0x3f), d->cfg[1], 0x80 | 0x37, 0xa0, 0x00};
+  size_t i;
+
+  for (i = 0; i < len; i ++) {
+    data[i] = (i < 5) ? status[i] : 0x00;
+  }
+}
+
+static void sim_tea5767_dump(sim_dev_t *dev, FILE *fp) {
+  sim_tea5767_t *d = (sim_tea5767_t *)dev;
+  unsigned pll = ((d->cfg[0] & 0x3f) << 8) | d->cfg[1];
+
+  fprintf(fp, "  PLL 0x%04x (%.1f MHz)\n", pll, (pll * 8192.0 - 225000) / 1e6);
+}
+
+static sim_dev_t *sim_new_tea5767(uint8_t addr) {
+  sim_tea5767_t *d = calloc(1, sizeof(*d));
+
+  if (NULL == d) {
+    return NULL;
+  }
+
+  d->dev.name  = "TEA5767";
+  d->dev.addr  = addr;
+  d->dev.write = sim_tea5767_write;
+  d->dev.read  = sim_tea5767_read;
+  d->dev.dump  = sim_tea5767_dump;
+
+  return &d->dev;
+}
+
+
+/* Bus */
+
+static sim_dev_t *sim_find(i2c_sim_t *sim, uint16_t addr) {
+  size_t i;
+
+  for (i = 0; i < sim->ndevs; i ++) {
+    if (sim->devs[i]->addr == addr) {
+      return sim->devs[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void sim_charge(i2c_sim_t *sim, unsigned long bits) {
+  struct timespec now;
+  unsigned long long ns = (unsigned long long)bits * sim->bit_ns + sim->txn_ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (sim_timespec_before(&sim->free_at, &now)) {
+    sim->free_at = now;
+  }
+  sim_timespec_add_ns(&sim->free_at, ns);
+  sim->busy_ns += ns;
+
+  while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sim->free_at, NULL));
+}
+
+int i2c_sim_transfer(i2c_sim_t *sim, struct i2c_msg *msgs, int nmsgs) {
+  int i, res = 0;
+  unsigned long bits = 2; /* START and STOP */
+  uint8_t *merged = NULL;
+
+  if ((NULL == sim) || (NULL == msgs) || (nmsgs <= 0) || (nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)) {
+    return -EINVAL;
+  }
+
+  sim->txns ++;
+  if ((sim->fault_pct > 0) && ((unsigned)rand_r(&sim->seed) % 100 < sim->fault_pct)) {
+    /* Glitch after the address byte, nothing reaches the device. */
+    sim->faults ++;
+    sim_charge(sim, bits + 9);
+    return (0 == sim->faults % 4) ? -ETIMEDOUT : -EREMOTEIO;
+  }
+
+  for (i = 0; i < nmsgs; i ++) {
+    struct i2c_msg *msg = &msgs[i];
+    sim_dev_t *dev = sim_find(sim, msg->addr);
+    size_t len = msg->len;
+    uint8_t *buf = msg->buf;
+
+    if (i > 0) {
+      bits += 1; /* Repeated START */
+    }
+    bits += 9;   /* Address byte */
+
+    if (NULL == dev) {
+      /* Address NACK ends the transaction. */
+      sim->nacks ++;
+      res = -ENXIO;
+      break;
+    }
+
+    /* Writes continued with I2C_M_NOSTART reach the device as one message. */
+    if (!(msg->flags & I2C_M_RD) && (i + 1 < nmsgs) && (msgs[i + 1].flags & I2C_M_NOSTART)) {
+      int j;
+
+      for (j = i + 1; (j < nmsgs) && (msgs[j].flags & I2C_M_NOSTART); j ++) {
+        len += msgs[j].len;
+      }
+      if (NULL == (merged = realloc(merged, len))) {
+        res = -ENOMEM;
+        break;
+      }
+      memcpy(merged, msg->buf, msg->len);
+      len = msg->len;
+      for (i ++; i < j; i ++) {
+        memcpy(&merged[len], msgs[i].buf, msgs[i].len);
+        len += msgs[i].len;
+      }
+      i --;
+      buf = merged;
+    }
+
+    if (NULL != dev->start) {
+      dev->start(dev);
+    }
+    if (msg->flags & I2C_M_RD) {
+      dev->read(dev, buf, len);
+    } else {
+      dev->write(dev, buf, len);
+    }
+
+    bits += 9 * len;
+    sim->bytes += len;
+  }
+
+  free(merged);
+  sim_charge(sim, bits);
+  return res;
+}
+
+int i2c_sim_open(i2c_sim_t **simp, int nr, const char *spec) {
+  i2c_sim_t *sim;
+  unsigned khz = 0, txn_us = 0, fault_pct = 0;
+  size_t i;
+  int addr;
+
+  if ((NULL == simp) || (NULL == spec)) {
+    return -EFAULT;
+  }
+  if ((sscanf(spec, "%u,%u,%u", &khz, &txn_us, &fault_pct) < 1) || (0 == khz) || (khz > 5000) || (fault_pct > 100)) {
+    fprintf(stderr, "ERROR: invalid UI2C_SIM `%s', expect <kHz>[,<us per transaction>[,<fault %%>]].\n", spec);
+    return -EINVAL;
+  }
+
+  if (NULL == (sim = calloc(1, sizeof(*sim)))) {
+    return -ENOMEM;
+  }
+  sim->nr     = nr;
+  sim->bit_ns = 1000000 / khz;
+  sim->txn_ns = txn_us * 1000l;
+  sim->fault_pct = fault_pct;
+  sim->seed   = nr + 1;
+
+  sim->devs[sim->ndevs ++] = sim_new_ssd1306(0x3c);
+  sim->devs[sim->ndevs ++] = sim_new_ssd1306(0x3d);
+  for (addr = 0x40; addr <= 0x47; addr ++) {
+    sim->devs[sim->ndevs ++] = sim_new_tmp007(addr);
+  }
+  sim->devs[sim->ndevs ++] = sim_new_mlx90614(0x5a);
+  sim->devs[sim->ndevs ++] = sim_new_tea5767(0x60);
+  sim->devs[sim->ndevs ++] = sim_new_ds1307(0x68);
+
+  for (i = 0; i < sim->ndevs; i ++) {
+    if (NULL == sim->devs[i]) {
+      i2c_sim_close(sim);
+      return -ENOMEM;
+    }
+  }
+
+  *simp = sim;
+  return 0;
+}
+
+void i2c_sim_close(i2c_sim_t *sim) {
+  size_t i;
+
+  if (NULL == sim) {
+    return;
+  }
+
+  fprintf(stderr, "sim: i2c-%d: %lu transactions (%lu NACKed, %lu faults injected), %lu bytes, %.3f ms bus time\n",
+          sim->nr, sim->txns, sim->nacks, sim->faults, sim->bytes, sim->busy_ns / 1e6);
+
+  for (i = 0; i < sim->ndevs; i ++) {
+    if (NULL == sim->devs[i]) {
+      continue;
+    }
+    if ((NULL != getenv("UI2C_SIM_DUMP")) && (NULL != sim->devs[i]->dump)) {
+      fprintf(stderr, "sim: %s @ 0x%02x\n", sim->devs[i]->name, sim->devs[i]->addr);
+      sim->devs[i]->dump(sim->devs[i], stderr);
+    }
+    free(sim->devs[i]);
+  }
+
+  free(sim);
+}
@@ -0,0 +1,1101 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "libui2c.h"
+
+/* Longest payload that will be concatenated with the register address. */
+#define I2C_WRITE_REG_MAX (64)
+
+
+/* Raw kernel interfaces */
+
+/* Binds the selected slave to the fd, for transfers without per-message addresses. */
+static int i2c_bind_slave(i2c_bus_t *bus) {
+  int res;
+
+  if (bus->slave == bus->addr) {
+    return 0;
+  }
+
+  bus->stats.syscalls ++;
+  if (ioctl(bus->file, I2C_SLAVE, bus->addr) < 0) {
+    res = -errno;
+    perror("ioctl() I2C_SLAVE failed");
+    return res;
+  }
+
+  bus->slave = bus->addr;
+  return 0;
+}
+
+static int i2c_rdwr(i2c_bus_t *bus, struct i2c_msg msgs[], int nmsgs) {
+  int res;
+  struct i2c_rdwr_ioctl_data rdwr = {.msgs = msgs, .nmsgs = nmsgs};
+
+  bus->stats.syscalls ++;
+  if (NULL != bus->sim) {
+    return i2c_sim_transfer(bus->sim, msgs, nmsgs);
+  }
+
+  if (ioctl(bus->file, I2C_RDWR, &rdwr) < 0) {
+    res = -errno;
+    perror("ioctl() I2C_RDWR failed");
+    return res;
+  }
+
+  return 0;
+}
+
+/* SMBus on top of plain messages, the way i2c-core emulates it. */
+static int i2c_smbus_emul(i2c_bus_t *bus, char rw, uint8_t cmd, int size, union i2c_smbus_data *data) {
+  int res;
+  uint8_t buf[I2C_SMBUS_BLOCK_MAX + 1];
+  struct i2c_msg msgs[2] = {
+    {.addr = bus->addr, .flags = 0,        .len = 1, .buf = buf},
+    {.addr = bus->addr, .flags = I2C_M_RD, .len = 0, .buf = &buf[1]},
+  };
+
+  buf[0] = cmd;
+  switch (size) {
+    case I2C_SMBUS_BYTE: {
+      if (I2C_SMBUS_READ == rw) {
+        msgs[1].len = 1;
+        if ((res = i2c_rdwr(bus, &msgs[1], 1)) < 0) {
+          return res;
+        }
+        data->byte = buf[1];
+        return 0;
+      }
+      return i2c_rdwr(bus, msgs, 1);
+    }
+    case I2C_SMBUS_BYTE_DATA:
+    case I2C_SMBUS_WORD_DATA:
+    case I2C_SMBUS_I2C_BLOCK_DATA: {
+      size_t len = (I2C_SMBUS_BYTE_DATA == size) ? 1 : ((I2C_SMBUS_WORD_DATA == size) ? 2 : data->block[0]);
+
+      if (len > I2C_SMBUS_BLOCK_MAX) {
+        return -EINVAL;
+      }
+
+      if (I2C_SMBUS_READ == rw) {
+        msgs[1].len = len;
+        if ((res = i2c_rdwr(bus, msgs, 2)) < 0) {
+          return res;
+        }
+      } else {
+        if (I2C_SMBUS_BYTE_DATA == size) {
+          buf[1] = data->byte;
+        } else if (I2C_SMBUS_WORD_DATA == size) {
+          buf[1] = data->word & 0xff;
+          buf[2] = data->word >> 8;
+        } else {
+          memcpy(&buf[1], &data->block[1], len);
+        }
+        msgs[0].len = len + 1;
+        return i2c_rdwr(bus, msgs, 1);
+      }
+
+      if (I2C_SMBUS_BYTE_DATA == size) {
+        data->byte = buf[1];
+      } else if (I2C_SMBUS_WORD_DATA == size) {
+        data->word = buf[1] | (buf[2] << 8);
+      } else {
+        memcpy(&data->block[1], &buf[1], len);
+      }
+      return 0;
+    }
+    default: {
+      return -EOPNOTSUPP;
+    }
+  }
+}
+
+static int i2c_smbus(i2c_bus_t *bus, char rw, uint8_t cmd, int size, union i2c_smbus_data *data) {
+  int res;
+  struct i2c_smbus_ioctl_data args = {.read_write = rw, .command = cmd, .size = size, .data = data};
+
+  if (NULL != bus->sim) {
+    return i2c_smbus_emul(bus, rw, cmd, size, data);
+  }
+
+  if ((res = i2c_bind_slave(bus)) < 0) {
+    return res;
+  }
+
+  bus->stats.syscalls ++;
+  if (ioctl(bus->file, I2C_SMBUS, &args) < 0) {
+    res = -errno;
+    perror("ioctl() I2C_SMBUS failed");
+    return res;
+  }
+
+  return 0;
+}
+
+static int i2c_smbus_write_byte_data(i2c_bus_t *bus, uint8_t cmd, uint8_t value) {
+  union i2c_smbus_data data = {.byte = value};
+
+  return i2c_smbus(bus, I2C_SMBUS_WRITE, cmd, I2C_SMBUS_BYTE_DATA, &data);
+}
+
+static int i2c_smbus_write_word_data(i2c_bus_t *bus, uint8_t cmd, const uint8_t value[2]) {
+  /* SMBus words go LSB first on the wire, keep the wire order of value[]. */
+  union i2c_smbus_data data = {.word = value[0] | (value[1] << 8)};
+
+  return i2c_smbus(bus, I2C_SMBUS_WRITE, cmd, I2C_SMBUS_WORD_DATA, &data);
+}
+
+/* SMBus has no plain transfers, only what fits into one SMBus command. */
+static int i2c_smbus_read(i2c_bus_t *bus, uint8_t data[], size_t len) {
+  int res;
+  union i2c_smbus_data tmp;
+
+  if (1 != len) {
+    return -EOPNOTSUPP;
+  }
+
+  if ((res = i2c_smbus(bus, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &tmp)) < 0) {
+    return res;
+  }
+
+  data[0] = tmp.byte;
+  return 0;
+}
+
+
+/* Transport: plain read() / write() */
+
+static int plain_read(i2c_bus_t *bus, uint8_t data[], size_t len) {
+  int res;
+
+  if (NULL != bus->sim) {
+    struct i2c_msg msg = {.addr = bus->addr, .flags = I2C_M_RD, .len = len, .buf = data};
+
+    return i2c_rdwr(bus, &msg, 1);
+  }
+
+  if ((res = i2c_bind_slave(bus)) < 0) {
+    return res;
+  }
+
+  bus->stats.syscalls ++;
+  if (read(bus->file, data, len) < 0) {
+    res = -errno;
+    perror("read() data failed");
+    return res;
+  }
+
+  return 0;
+}
+
+static int plain_write(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  int res;
+
+  if (NULL != bus->sim) {
+    struct i2c_msg msg = {.addr = bus->addr, .flags = 0, .len = len, .buf = (uint8_t *)data};
+
+    return i2c_rdwr(bus, &msg, 1);
+  }
+
+  if ((res = i2c_bind_slave(bus)) < 0) {
+    return res;
+  }
+
+  bus->stats.syscalls ++;
+  if (write(bus->file, data, len) < 0) {
+    res = -errno;
+    perror("write() data failed");
+    return res;
+  }
+
+  return 0;
+}
+
+static int plain_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len) {
+  int res;
+
+  if ((res = plain_write(bus, &reg_addr, 1)) < 0) {
+    return res;
+  }
+
+  return plain_read(bus, data, len);
+}
+
+static int plain_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len) {
+  /* must concatenate address and data,                         *
+   * otherwise transfer will be terminated before data is sent. */
+  uint8_t buf[I2C_WRITE_REG_MAX + 1];
+
+  if (len > I2C_WRITE_REG_MAX) {
+    return -EINVAL;
+  }
+
+  buf[0] = reg_addr;
+  memcpy(&buf[1], data, len);
+
+  return plain_write(bus, buf, len + 1);
+}
+
+const i2c_ops_t i2c_ops_plain = {
+  .name       = "plain",
+  .read       = plain_read,
+  .write      = plain_write,
+  .write_bulk = plain_write,
+  .read_reg   = plain_read_reg,
+  .write_reg  = plain_write_reg,
+};
+
+
+/* Transport: I2C_RDWR */
+
+static int rdwr_read(i2c_bus_t *bus, uint8_t data[], size_t len) {
+  struct i2c_msg msg = {.addr = bus->addr, .flags = I2C_M_RD, .len = len, .buf = data};
+
+  return i2c_rdwr(bus, &msg, 1);
+}
+
+static int rdwr_write(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  struct i2c_msg msg = {.addr = bus->addr, .flags = 0, .len = len, .buf = (uint8_t *)data};
+
+  return i2c_rdwr(bus, &msg, 1);
+}
+
+static int rdwr_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len) {
+  /* Address write and data read joined by a repeated start, one syscall. */
+  struct i2c_msg msgs[2] = {
+    {.addr = bus->addr, .flags = 0,        .len = 1,   .buf = &reg_addr},
+    {.addr = bus->addr, .flags = I2C_M_RD, .len = len, .buf = data},
+  };
+
+  return i2c_rdwr(bus, msgs, 2);
+}
+
+static int rdwr_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len) {
+  if (bus->funcs & I2C_FUNC_NOSTART) {
+    /* Data continues the address write without a START, no copying needed. */
+    struct i2c_msg msgs[2] = {
+      {.addr = bus->addr, .flags = 0,             .len = 1,   .buf = &reg_addr},
+      {.addr = bus->addr, .flags = I2C_M_NOSTART, .len = len, .buf = (uint8_t *)data},
+    };
+
+    return i2c_rdwr(bus, msgs, 2);
+  }
+
+  uint8_t buf[I2C_WRITE_REG_MAX + 1];
+
+  if (len > I2C_WRITE_REG_MAX) {
+    return -EINVAL;
+  }
+
+  buf[0] = reg_addr;
+  memcpy(&buf[1], data, len);
+
+  return rdwr_write(bus, buf, len + 1);
+}
+
+const i2c_ops_t i2c_ops_rdwr = {
+  .name       = "rdwr",
+  .read       = rdwr_read,
+  .write      = rdwr_write,
+  .write_bulk = rdwr_write,
+  .read_reg   = rdwr_read_reg,
+  .write_reg  = rdwr_write_reg,
+};
+
+
+/* Transport: SMBus I2C-block (up to I2C_SMBUS_BLOCK_MAX bytes per transfer) */
+
+static int smbus_block_xfer(i2c_bus_t *bus, char rw, uint8_t cmd, uint8_t data[], size_t len) {
+  int res;
+  union i2c_smbus_data tmp;
+
+  tmp.block[0] = len;
+  if (I2C_SMBUS_WRITE == rw) {
+    memcpy(&tmp.block[1], data, len);
+  }
+
+  if ((res = i2c_smbus(bus, rw, cmd, I2C_SMBUS_I2C_BLOCK_DATA, &tmp)) < 0) {
+    return res;
+  }
+
+  if (I2C_SMBUS_READ == rw) {
+    if (tmp.block[0] < len) {
+      return -EIO;
+    }
+    memcpy(data, &tmp.block[1], len);
+  }
+
+  return 0;
+}
+
+static int smbus_block_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len) {
+  int res;
+  size_t n;
+
+  while (len > 0) {
+    n = (len > I2C_SMBUS_BLOCK_MAX) ? I2C_SMBUS_BLOCK_MAX : len;
+    if ((res = smbus_block_xfer(bus, I2C_SMBUS_READ, reg_addr, data, n)) < 0) {
+      return res;
+    }
+    reg_addr += n;
+    data     += n;
+    len      -= n;
+  }
+
+  return 0;
+}
+
+static int smbus_block_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len) {
+  int res;
+  size_t n;
+
+  while (len > 0) {
+    n = (len > I2C_SMBUS_BLOCK_MAX) ? I2C_SMBUS_BLOCK_MAX : len;
+    if ((res = smbus_block_xfer(bus, I2C_SMBUS_WRITE, reg_addr, (uint8_t *)data, n)) < 0) {
+      return res;
+    }
+    reg_addr += n;
+    data     += n;
+    len      -= n;
+  }
+
+  return 0;
+}
+
+static int smbus_block_write(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  if (1 == len) {
+    return i2c_smbus(bus, I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE, NULL);
+  }
+  if (len > I2C_SMBUS_BLOCK_MAX + 1) {
+    return -EOPNOTSUPP;
+  }
+
+  return smbus_block_xfer(bus, I2C_SMBUS_WRITE, data[0], (uint8_t *)&data[1], len - 1);
+}
+
+static int smbus_block_write_bulk(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  int res;
+  size_t n;
+  uint8_t prefix = data[0];
+
+  data ++;
+  len --;
+  while (len > 0) {
+    n = (len > I2C_SMBUS_BLOCK_MAX) ? I2C_SMBUS_BLOCK_MAX : len;
+    if ((res = smbus_block_xfer(bus, I2C_SMBUS_WRITE, prefix, (uint8_t *)data, n)) < 0) {
+      return res;
+    }
+    data += n;
+    len  -= n;
+  }
+
+  return 0;
+}
+
+const i2c_ops_t i2c_ops_smbus_block = {
+  .name       = "smbus-block",
+  .read       = i2c_smbus_read,
+  .write      = smbus_block_write,
+  .write_bulk = smbus_block_write_bulk,
+  .read_reg   = smbus_block_read_reg,
+  .write_reg  = smbus_block_write_reg,
+};
+
+
+/* Transport: SMBus byte / word data */
+
+static int smbus_word_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len) {
+  int res;
+  union i2c_smbus_data tmp;
+
+  while (len > 0) {
+    if (len >= 2) {
+      if ((res = i2c_smbus(bus, I2C_SMBUS_READ, reg_addr, I2C_SMBUS_WORD_DATA, &tmp)) < 0) {
+        return res;
+      }
+      data[0] = tmp.word & 0xff;
+      data[1] = tmp.word >> 8;
+      reg_addr += 2;
+      data     += 2;
+      len      -= 2;
+    } else {
+      if ((res = i2c_smbus(bus, I2C_SMBUS_READ, reg_addr, I2C_SMBUS_BYTE_DATA, &tmp)) < 0) {
+        return res;
+      }
+      data[0] = tmp.byte;
+      reg_addr ++;
+      data     ++;
+      len      --;
+    }
+  }
+
+  return 0;
+}
+
+static int smbus_word_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len) {
+  int res;
+
+  while (len > 0) {
+    if (len >= 2) {
+      if ((res = i2c_smbus_write_word_data(bus, reg_addr, data)) < 0) {
+        return res;
+      }
+      reg_addr += 2;
+      data     += 2;
+      len      -= 2;
+    } else {
+      if ((res = i2c_smbus_write_byte_data(bus, reg_addr, data[0])) < 0) {
+        return res;
+      }
+      reg_addr ++;
+      data     ++;
+      len      --;
+    }
+  }
+
+  return 0;
+}
+
+static int smbus_word_write(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  switch (len) {
+    case 1: {
+      return i2c_smbus(bus, I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE, NULL);
+    }
+    case 2: {
+      return i2c_smbus_write_byte_data(bus, data[0], data[1]);
+    }
+    case 3: {
+      return i2c_smbus_write_word_data(bus, data[0], &data[1]);
+    }
+    default: {
+      return -EOPNOTSUPP;
+    }
+  }
+}
+
+static int smbus_word_write_bulk(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  int res;
+  uint8_t prefix = data[0];
+
+  data ++;
+  len --;
+  while (len > 0) {
+    if (len >= 2) {
+      if ((res = i2c_smbus_write_word_data(bus, prefix, data)) < 0) {
+        return res;
+      }
+      data += 2;
+      len  -= 2;
+    } else {
+      if ((res = i2c_smbus_write_byte_data(bus, prefix, data[0])) < 0) {
+        return res;
+      }
+      data ++;
+      len  --;
+    }
+  }
+
+  return 0;
+}
+
+const i2c_ops_t i2c_ops_smbus_word = {
+  .name       = "smbus-word",
+  .read       = i2c_smbus_read,
+  .write      = smbus_word_write,
+  .write_bulk = smbus_word_write_bulk,
+  .read_reg   = smbus_word_read_reg,
+  .write_reg  = smbus_word_write_reg,
+};
+
+const i2c_ops_t *i2c_pick_ops(unsigned long funcs) {
+  if (funcs & I2C_FUNC_I2C) {
+    return &i2c_ops_rdwr;
+  }
+  if ((funcs & I2C_FUNC_SMBUS_I2C_BLOCK) == I2C_FUNC_SMBUS_I2C_BLOCK) {
+    return &i2c_ops_smbus_block;
+  }
+  if ((funcs & (I2C_FUNC_SMBUS_BYTE_DATA | I2C_FUNC_SMBUS_WORD_DATA)) == (I2C_FUNC_SMBUS_BYTE_DATA | I2C_FUNC_SMBUS_WORD_DATA)) {
+    return &i2c_ops_smbus_word;
+  }
+
+  return &i2c_ops_plain;
+}
+
+
+static const i2c_ops_t *i2c_find_ops(const char *name) {
+  const i2c_ops_t *all[] = {&i2c_ops_rdwr, &i2c_ops_smbus_block, &i2c_ops_smbus_word, &i2c_ops_plain};
+  size_t i;
+
+  for (i = 0; i < sizeof(all) / sizeof(all[0]); i ++) {
+    if (0 == strcmp(name, all[i]->name)) {
+      return all[i];
+    }
+  }
+
+  return NULL;
+}
+
+static int i2c_bind_ops(i2c_bus_t *bus) {
+  const char *name = getenv("UI2C_TRANSPORT");
+
+  if (NULL == name) {
+    bus->ops = i2c_pick_ops(bus->funcs);
+    return 0;
+  }
+
+  if (NULL == (bus->ops = i2c_find_ops(name))) {
+    fprintf(stderr, "ERROR: unknown transport `%s' in UI2C_TRANSPORT.\n", name);
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+
+/* Statistics */
+
+static FILE *i2c_stats_fp = NULL;
+
+static const char *i2c_op_names[I2C_OP_MAX] = {
+  [I2C_OP_READ]       = "read",
+  [I2C_OP_WRITE]      = "write",
+  [I2C_OP_WRITE_BULK] = "write_bulk",
+  [I2C_OP_READ_REG]   = "read_reg",
+  [I2C_OP_WRITE_REG]  = "write_reg",
+};
+
+static unsigned long long i2c_ns_since(const struct timespec *t0, clockid_t clk) {
+  struct timespec now;
+
+  clock_gettime(clk, &now);
+  return (now.tv_sec - t0->tv_sec) * 1000000000ull + now.tv_nsec - t0->tv_nsec;
+}
+
+static void i2c_stats_reset(i2c_bus_t *bus) {
+  memset(&bus->stats, 0, sizeof(bus->stats));
+  clock_gettime(CLOCK_MONOTONIC, &bus->stats.since);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &bus->stats.cpu_since);
+}
+
+static void i2c_stats_errno(i2c_bus_t *bus, int err) {
+  size_t i;
+
+  for (i = 0; i < I2C_STATS_ERRNOS; i ++) {
+    if ((bus->stats.errnos[i].err == err) || (0 == bus->stats.errnos[i].count)) {
+      bus->stats.errnos[i].err = err;
+      bus->stats.errnos[i].count ++;
+      return;
+    }
+  }
+}
+
+/* Accounts one dispatched operation started at t0, passes res through. */
+static int i2c_stats_account(i2c_bus_t *bus, i2c_op_t op, size_t len, const struct timespec *t0, int res) {
+  i2c_op_stats_t *s = &bus->stats.op[op];
+  unsigned long long ns = i2c_ns_since(t0, CLOCK_MONOTONIC);
+  unsigned long long us = ns / 1000;
+  int b;
+
+  for (b = 0; (us > 0) && (b < I2C_STATS_BUCKETS - 1); b ++) {
+    us >>= 1;
+  }
+
+  s->count ++;
+  s->hist[b] ++;
+  s->total_ns += ns;
+  if (ns > s->max_ns) {
+    s->max_ns = ns;
+  }
+
+  if (res < 0) {
+    s->errors ++;
+    if ((-ENXIO == res) || (-EREMOTEIO == res)) {
+      s->nacks ++;
+    }
+    i2c_stats_errno(bus, -res);
+  } else {
+    s->bytes += len;
+  }
+
+  return res;
+}
+
+void i2c_stats_enable(FILE *fp) {
+  i2c_stats_fp = fp;
+}
+
+void i2c_stats_retry(i2c_bus_t *bus, i2c_op_t op) {
+  if ((NULL != bus) && (op < I2C_OP_MAX)) {
+    bus->stats.op[op].retries ++;
+  }
+}
+
+void i2c_stats_print(const i2c_bus_t *bus, FILE *fp) {
+  const i2c_stats_t *st;
+  unsigned long long wall_ns, cpu_ns, xfer_ns = 0;
+  int op, b;
+  size_t i;
+
+  if ((NULL == bus) || (NULL == fp)) {
+    return;
+  }
+
+  st = &bus->stats;
+  wall_ns = i2c_ns_since(&st->since, CLOCK_MONOTONIC);
+  cpu_ns  = i2c_ns_since(&st->cpu_since, CLOCK_PROCESS_CPUTIME_ID);
+  for (op = 0; op < I2C_OP_MAX; op ++) {
+    xfer_ns += st->op[op].total_ns;
+  }
+
+  fprintf(fp, "Stats: i2c-%d%s, transport: %s\n", bus->nr, (NULL != bus->sim) ? " (simulated)" : "", (NULL != bus->ops) ? bus->ops->name : "none");
+  fprintf(fp, "  wall %.3f ms, in transfers %.3f ms (%.1f%%), CPU %.3f ms, %lu syscalls, %lu recoveries\n",
+          wall_ns / 1e6, xfer_ns / 1e6, wall_ns ? 100.0 * xfer_ns / wall_ns : 0.0, cpu_ns / 1e6, st->syscalls, st->recoveries);
+  fprintf(fp, "  %-10s %8s %6s %6s %6s %10s %9s %9s\n", "op", "count", "err", "nack", "retry", "bytes", "avg us", "max us");
+
+  for (op = 0; op < I2C_OP_MAX; op ++) {
+    const i2c_op_stats_t *s = &st->op[op];
+
+    if (0 == s->count) {
+      continue;
+    }
+
+    fprintf(fp, "  %-10s %8lu %6lu %6lu %6lu %10llu %9.1f %9.1f\n", i2c_op_names[op], s->count, s->errors, s->nacks, s->retries,
+            s->bytes, s->total_ns / 1e3 / s->count, s->max_ns / 1e3);
+    fputs("    latency:", fp);
+    for (b = 0; b < I2C_STATS_BUCKETS; b ++) {
+      if (0 == s->hist[b]) {
+        continue;
+      }
+      if (0 == b) {
+        fprintf(fp, " <1us:%lu", s->hist[b]);
+      } else if (I2C_STATS_BUCKETS - 1 == b) {
+        fprintf(fp, " >=%luus:%lu", 1ul << (b - 1), s->hist[b]);
+      } else {
+        fprintf(fp, " %lu-%luus:%lu", 1ul << (b - 1), 1ul << b, s->hist[b]);
+      }
+    }
+    fputc('\n', fp);
+  }
+
+  for (i = 0; (i < I2C_STATS_ERRNOS) && (st->errnos[i].count > 0); i ++) {
+    fprintf(fp, "  errno %d (%s): %lu\n", st->errnos[i].err, strerror(st->errnos[i].err), st->errnos[i].count);
+  }
+}
+
+
+/* Bus management */
+
+static int i2c_policy_from_env(i2c_bus_t *bus) {
+  const char *spec = getenv("UI2C_RETRY");
+  unsigned retries, backoff_us = bus->policy.backoff_us, budget_ms = bus->policy.budget_us / 1000;
+
+  if (NULL == spec) {
+    return 0;
+  }
+
+  if (sscanf(spec, "%u,%u,%u", &retries, &backoff_us, &budget_ms) < 1) {
+    fprintf(stderr, "ERROR: invalid UI2C_RETRY `%s', expect <retries>[,<backoff us>[,<budget ms>]].\n", spec);
+    return -EINVAL;
+  }
+
+  bus->policy.retries    = retries;
+  bus->policy.backoff_us = backoff_us;
+  bus->policy.budget_us  = budget_ms * 1000;
+  if (bus->policy.backoff_max_us < backoff_us) {
+    bus->policy.backoff_max_us = backoff_us;
+  }
+  return 0;
+}
+
+int i2c_open(i2c_bus_t *bus, int nr) {
+  const int fn_len = 20;
+  char fn[fn_len];
+  int res, file;
+
+  if (NULL == bus) {
+    return -EFAULT;
+  }
+  if (nr < 0) {
+    return -EINVAL;
+  }
+
+  bus->nr    = nr;
+  bus->slave = -1;
+  i2c_stats_reset(bus);
+  if ((res = i2c_policy_from_env(bus)) < 0) {
+    return res;
+  }
+
+  if (NULL != getenv("UI2C_DAEMON")) {
+    bus->sim = NULL;
+    if ((res = i2c_client_open(bus, nr, getenv("UI2C_DAEMON"))) < 0) {
+      return res;
+    }
+
+    fprintf(stdout, "Device: i2c-%d via ui2cd, transport: %s\n", nr, bus->ops->name);
+    fflush(stdout);
+    return 0;
+  }
+
+  if (NULL != getenv("UI2C_SIM")) {
+    bus->file  = -1;
+    bus->addr  = -1;
+    bus->funcs = I2C_FUNC_I2C | I2C_FUNC_NOSTART | I2C_FUNC_SMBUS_EMUL;
+    if ((res = i2c_sim_open(&bus->sim, nr, getenv("UI2C_SIM"))) < 0) {
+      return res;
+    }
+    if ((res = i2c_bind_ops(bus)) < 0) {
+      i2c_close(bus);
+      return res;
+    }
+
+    fprintf(stdout, "Device: simulated i2c-%d (%s), transport: %s\n", nr, getenv("UI2C_SIM"), bus->ops->name);
+    fflush(stdout);
+    return 0;
+  }
+
+  /* Open i2c-dev file */
+  snprintf(fn, fn_len, "/dev/i2c-%d", nr);
+  if ((file = open(fn, O_RDWR)) < 0) {
+    res = -errno;
+    perror("open() failed (make sure i2c_dev is loaded and you have the permission)");
+    return res;
+  }
+
+  /* Query functions */
+  unsigned long funcs;
+  if (ioctl(file, I2C_FUNCS, &funcs) < 0) {
+    res = -errno;
+    perror("ioctl() I2C_FUNCS failed");
+    close(file);
+    return res;
+  }
+
+  bus->file  = file;
+  bus->addr  = -1;
+  bus->funcs = funcs;
+  bus->sim   = NULL;
+  if ((res = i2c_bind_ops(bus)) < 0) {
+    i2c_close(bus);
+    return res;
+  }
+
+  fprintf(stdout, "Device: %s (", fn);
+  if (funcs & I2C_FUNC_I2C) {
+    fputs("I2C_FUNC_I2C ", stdout);
+  }
+  if (funcs & I2C_FUNC_SMBUS_BYTE) {
+    fputs("I2C_FUNC_SMBUS_BYTE ", stdout);
+  }
+  fprintf(stdout, "\b), transport: %s\n", bus->ops->name);
+  fflush(stdout);
+
+  return 0;
+}
+
+void i2c_close(i2c_bus_t *bus) {
+  if (!i2c_is_open(bus)) {
+    return;
+  }
+
+  if (NULL != i2c_stats_fp) {
+    i2c_stats_print(bus, i2c_stats_fp);
+  }
+
+  if (NULL != bus->sim) {
+    i2c_sim_close(bus->sim);
+    bus->sim = NULL;
+  } else {
+    close(bus->file);
+  }
+  bus->file   = -1;
+  bus->addr   = -1;
+  bus->slave  = -1;
+  bus->ops    = NULL;
+  bus->remote = false;
+}
+
+int i2c_select(i2c_bus_t *bus, int addr) {
+  if (!i2c_is_open(bus)) {
+    return -EBADF;
+  }
+  if ((addr < 0x00) || (addr > 0x7f)) {
+    return -EINVAL;
+  }
+
+  bus->addr = addr;
+  return 0;
+}
+
+
+/* Dispatch */
+
+/* One operation, so the retry loop does not depend on the op's signature. */
+typedef struct {
+  i2c_op_t op;
+  uint8_t reg;
+  const uint8_t *wdata;
+  uint8_t *rdata;
+  size_t len;
+} i2c_xfer_t;
+
+i2c_err_class_t i2c_classify(int res) {
+  switch (-res) {
+    case ENXIO:
+    case EREMOTEIO:
+    case EIO: {
+      return I2C_ERR_NACK;
+    }
+    case EAGAIN:
+    case EBUSY: {
+      return I2C_ERR_BUSY;
+    }
+    case ETIMEDOUT: {
+      return I2C_ERR_TIMEOUT;
+    }
+    default: {
+      return I2C_ERR_FATAL;
+    }
+  }
+}
+
+void i2c_set_policy(i2c_bus_t *bus, const i2c_policy_t *policy) {
+  if ((NULL != bus) && (NULL != policy)) {
+    bus->policy = *policy;
+  }
+}
+
+/*
+ * Userspace cannot clock SCL by hand. Reopening the adapter drops whatever
+ * state the fd carries (bound slave, pending PEC / 10-bit flags) and lets the
+ * adapter driver run its own recovery on the next transfer.
+ */
+static int i2c_recover(i2c_bus_t *bus) {
+  const int fn_len = 20;
+  char fn[fn_len];
+  int res, file;
+
+  bus->stats.recoveries ++;
+  if ((NULL != bus->sim) || bus->remote) {
+    return 0;
+  }
+
+  snprintf(fn, fn_len, "/dev/i2c-%d", bus->nr);
+  if ((file = open(fn, O_RDWR)) < 0) {
+    res = -errno;
+    perror("open() failed while recovering bus");
+    return res;
+  }
+  if (dup2(file, bus->file) < 0) {
+    res = -errno;
+    perror("dup2() failed while recovering bus");
+    close(file);
+    return res;
+  }
+  close(file);
+
+  bus->slave = -1;
+  return 0;
+}
+
+static int i2c_xfer_once(i2c_bus_t *bus, const i2c_xfer_t *x) {
+  switch (x->op) {
+    case I2C_OP_READ: {
+      return bus->ops->read(bus, x->rdata, x->len);
+    }
+    case I2C_OP_WRITE: {
+      return bus->ops->write(bus, x->wdata, x->len);
+    }
+    case I2C_OP_WRITE_BULK: {
+      return bus->ops->write_bulk(bus, x->wdata, x->len);
+    }
+    case I2C_OP_READ_REG: {
+      return bus->ops->read_reg(bus, x->reg, x->rdata, x->len);
+    }
+    case I2C_OP_WRITE_REG: {
+      return bus->ops->write_reg(bus, x->reg, x->wdata, x->len);
+    }
+    default: {
+      return -EINVAL;
+    }
+  }
+}
+
+static int i2c_xfer(i2c_bus_t *bus, const i2c_xfer_t *x) {
+  const i2c_policy_t *p = &bus->policy;
+  struct timespec t0, delay;
+  unsigned attempt, delay_us;
+  i2c_err_class_t cls;
+  int res;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  res = i2c_xfer_once(bus, x);
+
+  /* ui2cd applies its own policy. */
+  for (attempt = 0; (res < 0) && !bus->remote && (attempt < p->retries); attempt ++) {
+    if (I2C_ERR_FATAL == (cls = i2c_classify(res))) {
+      break;
+    }
+
+    delay_us = p->backoff_us << attempt;
+    if ((delay_us > p->backoff_max_us) || (delay_us < p->backoff_us)) {
+      delay_us = p->backoff_max_us;
+    }
+    if ((p->budget_us > 0) && (i2c_ns_since(&t0, CLOCK_MONOTONIC) / 1000 + delay_us > p->budget_us)) {
+      break;
+    }
+
+    if (p->recover && ((I2C_ERR_TIMEOUT == cls) || (attempt + 1 == p->retries))) {
+      if (i2c_recover(bus) < 0) {
+        break;
+      }
+    }
+
+    delay.tv_sec  = delay_us / 1000000;
+    delay.tv_nsec = (delay_us % 1000000) * 1000;
+    while ((EINTR == clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, &delay)));
+
+    bus->stats.op[x->op].retries ++;
+    res = i2c_xfer_once(bus, x);
+  }
+
+  return i2c_stats_account(bus, x->op, x->len, &t0, res);
+}
+
+static int i2c_check(const i2c_bus_t *bus, const void *data) {
+  if (NULL == data) {
+    return -EFAULT;
+  }
+  if (!i2c_is_open(bus)) {
+    return -EBADF;
+  }
+  if (bus->addr < 0) {
+    return -EDESTADDRREQ;
+  }
+
+  return 0;
+}
+
+int i2c_write(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  i2c_xfer_t x = {.op = I2C_OP_WRITE, .wdata = data, .len = len};
+  int res;
+
+  if ((res = i2c_check(bus, data)) < 0) {
+    return res;
+  }
+  if ((0 == len) || (len > UINT16_MAX)) {
+    return -EINVAL;
+  }
+
+  return i2c_xfer(bus, &x);
+}
+
+int i2c_read(i2c_bus_t *bus, uint8_t data[], size_t len) {
+  i2c_xfer_t x = {.op = I2C_OP_READ, .rdata = data, .len = len};
+  int res;
+
+  if ((res = i2c_check(bus, data)) < 0) {
+    return res;
+  }
+  if ((0 == len) || (len > UINT16_MAX)) {
+    return -EINVAL;
+  }
+
+  return i2c_xfer(bus, &x);
+}
+
+int i2c_write_bulk(i2c_bus_t *bus, const uint8_t data[], size_t len) {
+  i2c_xfer_t x = {.op = I2C_OP_WRITE_BULK, .wdata = data, .len = len};
+  int res;
+
+  if ((res = i2c_check(bus, data)) < 0) {
+    return res;
+  }
+  if ((len < 2) || (len > UINT16_MAX)) {
+    return -EINVAL;
+  }
+
+  return i2c_xfer(bus, &x);
+}
+
+int i2c_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len) {
+  i2c_xfer_t x = {.op = I2C_OP_READ_REG, .reg = reg_addr, .rdata = data, .len = len};
+  int res;
+
+  if ((res = i2c_check(bus, data)) < 0) {
+    return res;
+  }
+  if ((0 == len) || (len > UINT16_MAX)) {
+    return -EINVAL;
+  }
+
+  return i2c_xfer(bus, &x);
+}
+
+int i2c_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len) {
+  i2c_xfer_t x = {.op = I2C_OP_WRITE_REG, .reg = reg_addr, .wdata = data, .len = len};
+  int res;
+
+  if ((res = i2c_check(bus, data)) < 0) {
+    return res;
+  }
+  if ((0 == len) || (len > UINT16_MAX)) {
+    return -EINVAL;
+  }
+
+  return i2c_xfer(bus, &x);
+}
+
+int i2c_read_byte(i2c_bus_t *bus, uint8_t reg_addr, uint8_t *data) {
+  return i2c_read_reg(bus, reg_addr, data, 1);
+}
+
+int i2c_write_byte(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data) {
+  return i2c_write_reg(bus, reg_addr, &data, 1);
+}
+
+int i2c_read_word_be(i2c_bus_t *bus, uint8_t reg_addr, uint16_t *data) {
+  int res;
+  uint8_t tmp[2];
+
+  if (NULL == data) {
+    return -EFAULT;
+  }
+
+  if ((res = i2c_read_reg(bus, reg_addr, tmp, 2)) < 0) {
+    return res;
+  }
+
+  *data = (tmp[0] << 8) | tmp[1];
+  return 0;
+}
+
+int i2c_read_word_le(i2c_bus_t *bus, uint8_t reg_addr, uint16_t *data) {
+  int res;
+  uint8_t tmp[2];
+
+  if (NULL == data) {
+    return -EFAULT;
+  }
+
+  if ((res = i2c_read_reg(bus, reg_addr, tmp, 2)) < 0) {
+    return res;
+  }
+
+  *data = (tmp[1] << 8) | tmp[0];
+  return 0;
+}
+
+int i2c_write_word_be(i2c_bus_t *bus, uint8_t reg_addr, uint16_t data) {
+  uint8_t buf[2] = {(data >> 8), (data & 0xff)};
+
+  return i2c_write_reg(bus, reg_addr, buf, 2);
+}
@@ -0,0 +1,225 @@
+#ifndef __LIBUI2C_H__
+#define __LIBUI2C_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/******************************************************************************
+ * Shared transport for all ui2c utilities.
+ *
+ * Register reads are issued as a single combined transaction (I2C_RDWR):
+ * START addr+W reg RESTART addr+R data... STOP
+ * instead of a write() followed by a read(), which costs two syscalls and two
+ * bus transactions with a STOP in between.
+ *
+ * Adapters differ a lot in what they can do (e.g. i915 gmbus vs. SMBus-only
+ * controllers), so i2c_open() checks I2C_FUNCS and binds the bus to the
+ * fastest transport the adapter supports. All transfers below are dispatched
+ * through that transport.
+ *
+ * Setting UI2C_SIM=<kHz>[,<us per transaction>] in the environment replaces
+ * the kernel adapter with a simulated bus carrying models of all supported
+ * devices (see libui2c-sim.c), so the tools can be exercised and timed
+ * without hardware. UI2C_TRANSPORT=<name> forces a transport by name.
+ *
+ * Setting UI2C_DAEMON=[<socket>] routes all operations through ui2cd, which
+ * owns the adapters and arbitrates between processes (see ui2cd.c).
+ *
+ * Every transfer is timed with CLOCK_MONOTONIC into per-operation log2
+ * histograms, together with byte, error and retry counts. Comparing the time
+ * spent in transfers with wall and CPU time tells whether a tool is bus-,
+ * syscall- or CPU-bound; see i2c_stats_enable().
+ *
+ * Failed transfers are retried according to the bus' i2c_policy_t: transient
+ * errors (NACK, lost arbitration, timeout) get bounded exponential backoff
+ * within a per-operation time budget, and the adapter is reopened before the
+ * last attempt. UI2C_RETRY=<retries>[,<backoff us>[,<budget ms>]] overrides
+ * the default policy.
+ *
+ * All functions return 0 on success and a negative errno on failure.
+ *****************************************************************************/
+
+struct i2c_msg;
+
+typedef struct i2c_bus_s i2c_bus_t;
+typedef struct i2c_sim_s i2c_sim_t;
+
+typedef struct {
+  const char *name;
+  int (*read)(i2c_bus_t *bus, uint8_t data[], size_t len);
+  int (*write)(i2c_bus_t *bus, const uint8_t data[], size_t len);
+  int (*write_bulk)(i2c_bus_t *bus, const uint8_t data[], size_t len);
+  int (*read_reg)(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len);
+  int (*write_reg)(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len);
+} i2c_ops_t;
+
+/* Operations accounted separately in the statistics */
+typedef enum {
+  I2C_OP_READ = 0,
+  I2C_OP_WRITE,
+  I2C_OP_WRITE_BULK,
+  I2C_OP_READ_REG,
+  I2C_OP_WRITE_REG,
+  I2C_OP_MAX,
+} i2c_op_t;
+
+/* Latency bucket i holds [2^(i-1), 2^i) us, bucket 0 is < 1 us. */
+#define I2C_STATS_BUCKETS (20)
+#define I2C_STATS_ERRNOS  (8)
+
+typedef struct {
+  unsigned long count;
+  unsigned long errors;
+  unsigned long nacks;      /* -ENXIO / -EREMOTEIO: slave did not ACK */
+  unsigned long retries;
+  unsigned long long bytes;
+  unsigned long long total_ns;
+  unsigned long long max_ns;
+  unsigned long hist[I2C_STATS_BUCKETS];
+} i2c_op_stats_t;
+
+typedef struct {
+  struct timespec since;    /* CLOCK_MONOTONIC at open */
+  struct timespec cpu_since;
+  unsigned long syscalls;   /* ioctl() / read() / write() issued */
+  unsigned long recoveries;
+  i2c_op_stats_t op[I2C_OP_MAX];
+  struct {
+    int err;
+    unsigned long count;
+  } errnos[I2C_STATS_ERRNOS];
+} i2c_stats_t;
+
+/* Error classes, see Documentation/i2c/fault-codes in the kernel */
+typedef enum {
+  I2C_ERR_FATAL = 0,        /* Bad arguments, unsupported, device gone: do not retry */
+  I2C_ERR_NACK,             /* -ENXIO, -EREMOTEIO, -EIO: slave busy or glitch */
+  I2C_ERR_BUSY,             /* -EAGAIN, -EBUSY: lost arbitration */
+  I2C_ERR_TIMEOUT,          /* -ETIMEDOUT: bus stuck, recover before retrying */
+} i2c_err_class_t;
+
+typedef struct {
+  unsigned retries;         /* Extra attempts after the first one */
+  unsigned backoff_us;      /* Delay before the first retry, doubled each time */
+  unsigned backoff_max_us;
+  unsigned budget_us;       /* Stop retrying once an operation took this long, 0 for no limit */
+  bool recover;             /* Reopen the adapter on timeouts and before the last attempt */
+} i2c_policy_t;
+
+#define I2C_POLICY_DEFAULT {.retries = 3, .backoff_us = 500, .backoff_max_us = 20000, .budget_us = 100000, .recover = true}
+
+struct i2c_bus_s {
+  int nr;                   /* Adapter number, as in /dev/i2c-N */
+  int file;
+  int addr;                 /* Currently selected slave, in [0x00, 0x7f], or -1 */
+  int slave;                /* Slave bound to file with I2C_SLAVE, or -1 */
+  unsigned long funcs;      /* I2C_FUNCS of the adapter */
+  const i2c_ops_t *ops;     /* Transport bound at open time */
+  i2c_sim_t *sim;           /* Simulated bus backend, or NULL for i2c-dev */
+  bool remote;              /* file is a socket to ui2cd */
+  i2c_policy_t policy;
+  i2c_stats_t stats;
+};
+
+#define I2C_BUS_INIT {.nr = -1, .file = -1, .addr = -1, .slave = -1, .funcs = 0, .ops = NULL, .sim = NULL, .remote = false, .policy = I2C_POLICY_DEFAULT}
+
+static inline bool i2c_is_open(const i2c_bus_t *bus) {
+  return (NULL != bus) && ((bus->file >= 0) || (NULL != bus->sim));
+}
+
+/* Transports, fastest first. */
+extern const i2c_ops_t i2c_ops_rdwr;        /* I2C_RDWR multi-message      */
+extern const i2c_ops_t i2c_ops_smbus_block; /* SMBus I2C-block, 32 B/xfer  */
+extern const i2c_ops_t i2c_ops_smbus_word;  /* SMBus byte / word data      */
+extern const i2c_ops_t i2c_ops_plain;       /* read() / write()            */
+extern const i2c_ops_t i2c_ops_ui2cd;       /* Forwarded to ui2cd          */
+
+const i2c_ops_t *i2c_pick_ops(unsigned long funcs);
+
+/* Bus management */
+int  i2c_open(i2c_bus_t *bus, int nr);
+void i2c_close(i2c_bus_t *bus);
+
+i2c_err_class_t i2c_classify(int res);
+void i2c_set_policy(i2c_bus_t *bus, const i2c_policy_t *policy);
+
+/*
+ * Selecting a slave is free: I2C_RDWR carries the address in every message,
+ * and the other transports issue I2C_SLAVE only when the address actually
+ * changes. Alternating between devices on one bus costs no extra syscalls.
+ */
+int  i2c_select(i2c_bus_t *bus, int addr);
+
+/* Plain transfers (one START ... STOP each) */
+int i2c_write(i2c_bus_t *bus, const uint8_t data[], size_t len);
+int i2c_read(i2c_bus_t *bus, uint8_t data[], size_t len);
+
+/*
+ * Bulk write for devices that take a prefix byte (e.g. SSD1306 control byte)
+ * at the start of every transaction. data[0] is the prefix. Transports that
+ * cannot send long writes split the payload and repeat the prefix.
+ */
+int i2c_write_bulk(i2c_bus_t *bus, const uint8_t data[], size_t len);
+
+/* Register access (register address is 1 byte, auto-incremented) */
+int i2c_read_reg(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data[], size_t len);
+int i2c_write_reg(i2c_bus_t *bus, uint8_t reg_addr, const uint8_t data[], size_t len);
+
+int i2c_read_byte(i2c_bus_t *bus, uint8_t reg_addr, uint8_t *data);
+int i2c_write_byte(i2c_bus_t *bus, uint8_t reg_addr, uint8_t data);
+
+/* Words: "be" sends MSB first (TMP007), "le" sends LSB first (SMBus). */
+int i2c_read_word_be(i2c_bus_t *bus, uint8_t reg_addr, uint16_t *data);
+int i2c_read_word_le(i2c_bus_t *bus, uint8_t reg_addr, uint16_t *data);
+int i2c_write_word_be(i2c_bus_t *bus, uint8_t reg_addr, uint16_t data);
+
+/*
+ * Statistics. Always collected; once enabled, i2c_close() prints them to fp,
+ * so tools that switch buses get one report per bus.
+ */
+void i2c_stats_enable(FILE *fp);
+void i2c_stats_print(const i2c_bus_t *bus, FILE *fp);
+void i2c_stats_retry(i2c_bus_t *bus, i2c_op_t op);
+
+/* Simulated bus backend (libui2c-sim.c) */
+int  i2c_sim_open(i2c_sim_t **sim, int nr, const char *spec);
+void i2c_sim_close(i2c_sim_t *sim);
+int  i2c_sim_transfer(i2c_sim_t *sim, struct i2c_msg *msgs, int nmsgs);
+
+/*
+ * Asynchronous worker (libui2c-async.c): one thread per bus executes queued
+ * requests, so long transfers (e.g. 1 KiB SSD1306 frames) do not block the
+ * caller. While a worker runs, it owns the bus; do not use the bus directly.
+ *
+ * data stays owned by the caller until completion. On completion, done() is
+ * called on the worker thread if set, otherwise the request is queued for
+ * i2c_async_reap() and i2c_async_fd() becomes readable.
+ */
+typedef struct i2c_req_s i2c_req_t;
+typedef struct i2c_async_s i2c_async_t;
+
+struct i2c_req_s {
+  i2c_op_t op;
+  int addr;
+  uint8_t reg;              /* I2C_OP_*_REG only */
+  uint8_t *data;
+  size_t len;
+  int res;                  /* -EINPROGRESS until completed */
+  void (*done)(i2c_req_t *req);
+  void *priv;
+};
+
+int  i2c_async_start(i2c_async_t **async, i2c_bus_t *bus, size_t depth);
+void i2c_async_stop(i2c_async_t *async);  /* Completes everything queued first */
+int  i2c_async_submit(i2c_async_t *async, i2c_req_t *req);  /* -EAGAIN when depth requests are in flight */
+int  i2c_async_fd(const i2c_async_t *async);
+int  i2c_async_reap(i2c_async_t *async, i2c_req_t **req);   /* -EAGAIN when nothing completed */
+int  i2c_async_wait(i2c_async_t *async, i2c_req_t **req);
+
+/* ui2cd client backend (libui2c-client.c), NULL path for the default socket */
+int  i2c_client_open(i2c_bus_t *bus, int nr, const char *path);
+
+#endif /* __LIBUI2C_H__ */
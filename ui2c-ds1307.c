@@ -1,5 +1,5 @@
-#include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
@@ -8,7 +8,7 @@
 #include <stdint.h>
 #include <time.h>
 
-#include <linux/i2c-dev.h>
+#include "libui2c.h"
 
 
 /* DS1307 Definations */
@@ -77,85 +77,6 @@
 
 /* Helper functions */
 
-int i2c_open(int bus) {
-  const int fn_len = 20;
-  char fn[fn_len];
-  int res, file;
-
-  if (bus < 0) {
-    return -EINVAL;
-  }
-
-  /* Open i2c-dev file */
-  snprintf(fn, fn_len, "/dev/i2c-%d", bus);
-  if ((file = open(fn, O_RDWR)) < 0) {
-    perror("open() failed (make sure i2c_dev is loaded and you have the permission)");
-    return file;
-  }
-
-  /* Query functions */
-  unsigned long funcs;
-  if ((res = ioctl(file, I2C_FUNCS, &funcs)) < 0) {
-    perror("ioctl() I2C_FUNCS failed");
-    return res;
-  }
-  fprintf(stdout, "Device: %s (", fn);
-  if (funcs & I2C_FUNC_I2C) {
-    fputs("I2C_FUNC_I2C ", stdout);
-  }
-  if (funcs & I2C_FUNC_SMBUS_BYTE) {
-    fputs("I2C_FUNC_SMBUS_BYTE ", stdout);
-  }
-  fputs("\b)\n", stdout);
-  fflush(stdout);
-
-  return file;
-}
-
-int i2c_select(int file, int addr) {
-  /* addr in [0x00, 0x7f] */
-  int res;
-
-  if ((res = ioctl(file, I2C_SLAVE, addr)) < 0) {
-    perror("ioctl() I2C_SLAVE failed");
-  }
-
-  return res;
-}
-
-int i2c_read_byte(int file, uint8_t reg_addr, uint8_t *data) {
-  if (NULL == data) {
-    return -EFAULT;
-  }
-
-  int res;
-  if ((res = write(file, &reg_addr, 1)) < 0) {
-    perror("write() register address failed");
-    return res;
-  }
-
-  if ((res = read(file, data, 1)) < 0) {
-    perror("read() data failed");
-    return res;
-  }
-
-  return 0;
-}
-
-int i2c_write_byte(int file, uint8_t reg_addr, uint8_t data) {
-  /* must concatenate address and data,                         *
-   * otherwise transfer will be terminated before data is sent. */
-  int res;
-  uint8_t buf[2] = {reg_addr, data};
-
-  if ((res = write(file, buf, 2)) < 0) {
-    perror("write() register address / data failed");
-    return res;
-  }
-
-  return 0;
-}
-
 int weekday2c(uint8_t wkd, const char **c) {
   if (NULL == c) {
     return -EFAULT;
@@ -218,29 +139,42 @@ uint8_t i2bcd(uint8_t i) {
   return ((i / 10) << 4) | (i % 10);
 }
 
-int ds1307_print_time(int file) {
+/******************************************************************************
+ * Time keeping registers (SEC to CTL) are read in one burst using the
+ * auto-incrementing register pointer. The chip latches the time into its
+ * secondary buffer on START, so the snapshot is consistent across a
+ * rollover, unlike reading the registers one by one.
+ *****************************************************************************/
+typedef struct {
+  uint8_t reg[DS1307_REGAD_CTL + 1]; /* Indexed by DS1307_REGAD_* */
+} ds1307_snapshot_t;
+
+int ds1307_read_snapshot(i2c_bus_t *bus, ds1307_snapshot_t *snap) {
+  if (NULL == snap) {
+    return -EFAULT;
+  }
+
+  return i2c_read_reg(bus, DS1307_REGAD_SEC, snap->reg, sizeof(snap->reg));
+}
+
+int ds1307_print_time(i2c_bus_t *bus) {
   int res;
+  ds1307_snapshot_t snap;
 
-  uint8_t sec;
-  bool hlt;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_SEC, &sec)) < 0) {
+  if ((res = ds1307_read_snapshot(bus, &snap)) < 0) {
     return res;
   }
+
+  uint8_t sec = snap.reg[DS1307_REGAD_SEC];
+  bool hlt;
   hlt = (sec & DS1307_HALT) ? true : false;
   sec = bcd2i(sec & (~DS1307_HALT));
 
-  uint8_t min;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_MIN, &min)) < 0) {
-    return res;
-  }
-  min = bcd2i(min);
+  uint8_t min = bcd2i(snap.reg[DS1307_REGAD_MIN]);
 
-  uint8_t hrs;
+  uint8_t hrs = snap.reg[DS1307_REGAD_HRS];
   bool h12;
   bool hpm;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_HRS, &hrs)) < 0) {
-    return res;
-  }
   h12 = (hrs & DS1307_12H_MODE) ? true : false;
   hpm = (hrs & DS1307_12H_PM  ) ? true : false;
   if (h12) {
@@ -249,37 +183,15 @@ int ds1307_print_time(int file) {
     hrs = bcd2i(hrs & (~DS1307_12H_MODE));
   }
 
-  uint8_t dow;
   const char *dows;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_DOW, &dow)) < 0) {
-    return res;
-  }
-  if ((res = weekday2c(dow, &dows)) < 0) {
+  if ((res = weekday2c(snap.reg[DS1307_REGAD_DOW], &dows)) < 0) {
     return res;
   }
 
-  uint8_t day;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_DAY, &day)) < 0) {
-    return res;
-  }
-  day = bcd2i(day);
-
-  uint8_t mon;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_MON, &mon)) < 0) {
-    return res;
-  }
-  mon = bcd2i(mon);
-
-  uint8_t yrs;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_YRS, &yrs)) < 0) {
-    return res;
-  }
-  yrs = bcd2i(yrs);
+  uint8_t day = bcd2i(snap.reg[DS1307_REGAD_DAY]);
+  uint8_t mon = bcd2i(snap.reg[DS1307_REGAD_MON]);
+  uint8_t yrs = bcd2i(snap.reg[DS1307_REGAD_YRS]);
 
-  uint8_t ctl;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_CTL, &ctl)) < 0) {
-    return res;
-  }
   if (h12) {
     fprintf(stdout, "20%02d-%02d-%02d %s %s %02d:%02d:%02d %s 12H\n", yrs, mon, day, dows, hpm ? "PM" : "AM", hrs, min, sec, hlt ? "HALTED" : "RUNNING");
   } else {
@@ -289,13 +201,13 @@ int ds1307_print_time(int file) {
   return 0;
 }
 
-int ds1307_halt(int file, bool halt) {
+int ds1307_halt(i2c_bus_t *bus, bool halt) {
   /* Timing is not critical here, halting is envolved anyway... */
 
   int res;
   uint8_t sec;
 
-  if ((res = i2c_read_byte(file, DS1307_REGAD_SEC, &sec)) < 0) {
+  if ((res = i2c_read_byte(bus, DS1307_REGAD_SEC, &sec)) < 0) {
     return res;
   }
 
@@ -309,7 +221,7 @@ int ds1307_halt(int file, bool halt) {
     sec &= (~DS1307_HALT);
   }
 
-  if ((res = i2c_write_byte(file, DS1307_REGAD_SEC, sec)) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_SEC, sec)) < 0) {
     return res;
   }
 
@@ -318,18 +230,21 @@ int ds1307_halt(int file, bool halt) {
   return 0;
 }
 
-int ds1307_sanity_check(int file, bool *ok) {
+int ds1307_sanity_check(i2c_bus_t *bus, bool *ok) {
   int res;
   uint8_t reg;
+  ds1307_snapshot_t snap;
 
   if (NULL == ok) {
     return -EFAULT;
   }
 
-  /* Second */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_SEC, &reg)) < 0) {
+  if ((res = ds1307_read_snapshot(bus, &snap)) < 0) {
     return res;
   }
+
+  /* Second */
+  reg = snap.reg[DS1307_REGAD_SEC];
   reg &= (~DS1307_HALT);
   if ((!isbcd(reg)) || (bcd2i(reg) > 59)) {
     *ok = false;
@@ -337,18 +252,14 @@ int ds1307_sanity_check(int file, bool *ok) {
   }
 
   /* Minute */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_MIN, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_MIN];
   if ((!isbcd(reg)) || (bcd2i(reg) > 59)) {
     *ok = false;
     return 0;
   }
 
   /* Hour */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_HRS, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_HRS];
   bool h12 = (reg & DS1307_12H_MODE) ? true : false;
   reg &= (~DS1307_12H_MODE);
   if (h12) {
@@ -365,36 +276,28 @@ int ds1307_sanity_check(int file, bool *ok) {
   }
 
   /* Day of Week */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_DOW, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_DOW];
   if ((!isbcd(reg)) || (bcd2i(reg) > 7) || (0 == bcd2i(reg))) {
     *ok = false;
     return 0;
   }
 
   /* Day */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_DAY, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_DAY];
   if ((!isbcd(reg)) || (bcd2i(reg) > 31) || (0 == bcd2i(reg))) {
     *ok = false;
     return 0;
   }
 
   /* Month */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_MON, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_MON];
   if ((!isbcd(reg)) || (bcd2i(reg) > 12) || (0 == bcd2i(reg))) {
     *ok = false;
     return 0;
   }
 
   /* Year */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_YRS, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_YRS];
   if (!isbcd(reg)) {
     *ok = false;
     return 0;
@@ -402,9 +305,7 @@ int ds1307_sanity_check(int file, bool *ok) {
   /* TODO: YMD cross validation with leap-year awareness */
 
   /* Control */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_YRS, &reg)) < 0) {
-    return res;
-  }
+  reg = snap.reg[DS1307_REGAD_CTL];
   reg &= (~(DS1307_SQW_OUT | DS1307_SQW_EN | DS1307_SQW_RS1 | DS1307_SQW_RS0));
   if (0 != reg) {
     *ok = false;
@@ -416,7 +317,7 @@ int ds1307_sanity_check(int file, bool *ok) {
   return 0;
 }
 
-int ds1307_set_hfmt(int file, bool h12) {
+int ds1307_set_hfmt(i2c_bus_t *bus, bool h12) {
   /* Set 12H/24H */
   /* TODO: wait if time is 59:59 and is not halted, so we do not cause glitch. */
 
@@ -424,7 +325,7 @@ int ds1307_set_hfmt(int file, bool h12) {
   uint8_t hrs;
   bool oldh12;
 
-  if ((res = i2c_read_byte(file, DS1307_REGAD_HRS, &hrs)) < 0) {
+  if ((res = i2c_read_byte(bus, DS1307_REGAD_HRS, &hrs)) < 0) {
     return res;
   }
   oldh12 = (hrs & DS1307_12H_MODE) ? true : false;
@@ -478,7 +379,7 @@ int ds1307_set_hfmt(int file, bool h12) {
     }
   }
 
-  if ((res = i2c_write_byte(file, DS1307_REGAD_HRS, hrs)) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_HRS, hrs)) < 0) {
     return res;
   }
 
@@ -487,7 +388,7 @@ int ds1307_set_hfmt(int file, bool h12) {
   return 0;
 }
 
-int ds1307_dump(int file, uint8_t start, uint8_t count) {
+int ds1307_dump(i2c_bus_t *bus, uint8_t start, uint8_t count) {
   /* Intended for internal use only. */
 
   int i, res;
@@ -499,7 +400,7 @@ int ds1307_dump(int file, uint8_t start, uint8_t count) {
   }
 
   for (i = 0; i < count; i ++) {
-    if ((res = i2c_read_byte(file, start + i, &reg)) < 0) {
+    if ((res = i2c_read_byte(bus, start + i, &reg)) < 0) {
       return res;
     }
     fprintf(stdout, "Register @ 0x%02x: 0x%02x\n", start + i, reg);
@@ -508,7 +409,7 @@ int ds1307_dump(int file, uint8_t start, uint8_t count) {
   return 0;
 }
 
-int ds1307_test_ram_byte(int file, uint8_t byte) {
+int ds1307_test_ram_byte(i2c_bus_t *bus, uint8_t byte) {
   /* Intended for internal use only. */
 
   int ad;
@@ -516,7 +417,7 @@ int ds1307_test_ram_byte(int file, uint8_t byte) {
 
   /* Write */
   for (ad = DS1307_REGAD_RAM; ad < DS1307_REGAD_END; ad ++) {
-    if ((res = i2c_write_byte(file, ad, byte)) < 0) {
+    if ((res = i2c_write_byte(bus, ad, byte)) < 0) {
       return res;
     }
   }
@@ -524,7 +425,7 @@ int ds1307_test_ram_byte(int file, uint8_t byte) {
   /* Read and compare */
   uint8_t reg;
   for (ad = DS1307_REGAD_RAM; ad < DS1307_REGAD_END; ad ++) {
-    if ((res = i2c_read_byte(file, ad, &reg)) < 0) {
+    if ((res = i2c_read_byte(bus, ad, &reg)) < 0) {
       return res;
     }
     if (reg != byte) {
@@ -536,32 +437,32 @@ int ds1307_test_ram_byte(int file, uint8_t byte) {
   return 0;
 }
 
-int ds1307_test_ram(int file) {
+int ds1307_test_ram(i2c_bus_t *bus) {
   int res;
   int bit;
 
   /* Walk 1 */
   for (bit = 0; bit < 8; bit ++) {
-    if ((res = ds1307_test_ram_byte(file, 1 << bit)) < 0) {
+    if ((res = ds1307_test_ram_byte(bus, 1 << bit)) < 0) {
       return res;
     }
     fprintf(stdout, "Done checking 0x%02x\n", 1 << bit);
   }
 
   /* 0x55, 0xaa, 0x00 and 0xff */
-  if ((res = ds1307_test_ram_byte(file, 0x55)) < 0) {
+  if ((res = ds1307_test_ram_byte(bus, 0x55)) < 0) {
     return res;
   }
   fprintf(stdout, "Done checking 0x%02x\n", 0x55);
-  if ((res = ds1307_test_ram_byte(file, 0xaa)) < 0) {
+  if ((res = ds1307_test_ram_byte(bus, 0xaa)) < 0) {
     return res;
   }
   fprintf(stdout, "Done checking 0x%02x\n", 0xaa);
-  if ((res = ds1307_test_ram_byte(file, 0xff)) < 0) {
+  if ((res = ds1307_test_ram_byte(bus, 0xff)) < 0) {
     return res;
   }
   fprintf(stdout, "Done checking 0x%02x\n", 0xff);
-  if ((res = ds1307_test_ram_byte(file, 0x00)) < 0) {
+  if ((res = ds1307_test_ram_byte(bus, 0x00)) < 0) {
     return res;
   }
   fprintf(stdout, "Done checking 0x%02x\n", 0x00);
@@ -569,12 +470,12 @@ int ds1307_test_ram(int file) {
   return 0;
 }
 
-int ds1307_get_sqw(int file) {
+int ds1307_get_sqw(i2c_bus_t *bus) {
   int res;
   uint8_t reg;
   const char *freq[] = {"1", "4096", "8192", "32768"};
 
-  if ((res = i2c_read_byte(file, DS1307_REGAD_CTL, &reg)) < 0) {
+  if ((res = i2c_read_byte(bus, DS1307_REGAD_CTL, &reg)) < 0) {
     return res;
   }
 
@@ -588,7 +489,7 @@ int ds1307_get_sqw(int file) {
   return 0;
 }
 
-int ds1307_set_sqw(int file, int hz) {
+int ds1307_set_sqw(i2c_bus_t *bus, int hz) {
   /* HZ: 0 = LOW 1 = HIGH 2 = 1Hz 3 = 4kHz 4 = 8kHz 5 = 32kHz */
 
   int res;
@@ -599,16 +500,16 @@ int ds1307_set_sqw(int file, int hz) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_byte(file, DS1307_REGAD_CTL, reg_table[hz])) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_CTL, reg_table[hz])) < 0) {
     return res;
   }
 
   /* User feedback */
-  ds1307_get_sqw(file);
+  ds1307_get_sqw(bus);
   return 0;
 }
 
-int ds1307_sync_time(int file) {
+int ds1307_sync_time(i2c_bus_t *bus) {
   /* Set time to the system time (losely). */
   int res;
   uint8_t reg;
@@ -617,49 +518,49 @@ int ds1307_sync_time(int file) {
   struct tm tm = *localtime(&t);
 
   /* Read previous settings */
-  if ((res = i2c_read_byte(file, DS1307_REGAD_SEC, &reg)) < 0) {
+  if ((res = i2c_read_byte(bus, DS1307_REGAD_SEC, &reg)) < 0) {
     return res;
   }
   halt = (reg & DS1307_HALT) ? true : false;
-  if ((res = i2c_read_byte(file, DS1307_REGAD_HRS, &reg)) < 0) {
+  if ((res = i2c_read_byte(bus, DS1307_REGAD_HRS, &reg)) < 0) {
     return res;
   }
   h12 = (reg & DS1307_12H_MODE) ? true : false;
 
   /* Set date */
-  if ((res = i2c_write_byte(file, DS1307_REGAD_YRS, i2bcd(tm.tm_year + 1900 - 2000))) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_YRS, i2bcd(tm.tm_year + 1900 - 2000))) < 0) {
     return res;
   }
-  if ((res = i2c_write_byte(file, DS1307_REGAD_MON, i2bcd(tm.tm_mon + 1))) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_MON, i2bcd(tm.tm_mon + 1))) < 0) {
     return res;
   }
-  if ((res = i2c_write_byte(file, DS1307_REGAD_DAY, i2bcd(tm.tm_mday))) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_DAY, i2bcd(tm.tm_mday))) < 0) {
     return res;
   }
   /* Day of week starts from 0 = Sunday... */
   const uint8_t dow_table[] = {2, 3, 4, 5, 6, 7, 1};
-  if ((res = i2c_write_byte(file, DS1307_REGAD_DAY, dow_table[tm.tm_mday])) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_DAY, dow_table[tm.tm_mday])) < 0) {
     return res;
   }
 
   /* Set time */
   /* Halt while setting second. TODO: handle leap second (tm.tm_sec can be 60 and 61)! */
-  if ((res = i2c_write_byte(file, DS1307_REGAD_SEC, DS1307_HALT | i2bcd(tm.tm_sec))) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_SEC, DS1307_HALT | i2bcd(tm.tm_sec))) < 0) {
     return res;
   }
-  if ((res = i2c_write_byte(file, DS1307_REGAD_MIN, i2bcd(tm.tm_min))) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_MIN, i2bcd(tm.tm_min))) < 0) {
     return res;
   }
   /* Always set 24H time first, then set mode to 12H if necessary */
-  if ((res = i2c_write_byte(file, DS1307_REGAD_HRS, i2bcd(tm.tm_hour))) < 0) {
+  if ((res = i2c_write_byte(bus, DS1307_REGAD_HRS, i2bcd(tm.tm_hour))) < 0) {
     return res;
   }
 
   if (h12) {
-    ds1307_set_hfmt(file, h12);
+    ds1307_set_hfmt(bus, h12);
   }
   if (!halt) {
-    ds1307_halt(file, halt);
+    ds1307_halt(bus, halt);
   }
 
   return 0;
@@ -681,6 +582,7 @@ int ds1307_sync_time(int file) {
  * s <int> - set SQW settings
  * S       - set date
  * t       - test ram
+ * --stats - print I2C transfer statistics
  *****************************************************************************/
 
 void print_help(const char *self) {
@@ -725,6 +627,7 @@ void print_help(const char *self) {
               NOTE: The chip may go offline during the process, you will need\n\
                     to reset the chip manually. Suggest halting the clock\n\
                     before checking to avoid possible hardware bugs.\n\
+    --stats : print I2C transfer statistics to stderr when a bus is closed.\n\
   \n\
   Example:\n\
     Print date and time in the DS1307 on i2c-1:\n\
@@ -772,8 +675,15 @@ int read_int(const char *s) {
   return i;
 }
 
+#define OPT_STATS (0x100)
+
+static const struct option long_opts[] = {
+  {"stats", no_argument, NULL, OPT_STATS},
+  {NULL,    0,           NULL, 0},
+};
+
 int main(int argc, char *argv[]) {
-  int file = -1;
+  i2c_bus_t bus = I2C_BUS_INIT;
   int res;
 
   if (argc < 2) {
@@ -784,25 +694,25 @@ int main(int argc, char *argv[]) {
   int c;
   int ad = DS1307_DEVAD;
   opterr = 0;
-  while ((c = getopt(argc, argv, "12a:b:cdDghHps:St")) != -1) {
+  while ((c = getopt_long(argc, argv, "12a:b:cdDghHps:St", long_opts, NULL)) != -1) {
     switch (c) {
       case '1':
       case '2': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = ds1307_set_hfmt(file, '1' == c)) < 0) {
-          close(file);
+        if ((res = ds1307_set_hfmt(&bus, '1' == c)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 'a': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to address selection.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -819,8 +729,8 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -829,11 +739,8 @@ int main(int argc, char *argv[]) {
       }
 
       case 'b': {
-        if (file >= 0) {
-          /* We are switching to a new file, close the old one first */
-          close(file);
-          file = -1; /* So we do not double-close */
-        }
+        /* We are switching to a new bus, close the old one first */
+        i2c_close(&bus);
 
         int bn;
         if ((bn = read_int(optarg)) < 0) {
@@ -842,12 +749,12 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((file = i2c_open(bn)) < 0) {
-          return file;
+        if ((res = i2c_open(&bus, bn)) < 0) {
+          return res;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -856,15 +763,15 @@ int main(int argc, char *argv[]) {
       }
 
       case 'c': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
         bool ok;
-        if ((res = ds1307_sanity_check(file, &ok)) < 0) {
-          close(file);
+        if ((res = ds1307_sanity_check(&bus, &ok)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -874,7 +781,7 @@ int main(int argc, char *argv[]) {
 
       case 'd':
       case 'D': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -882,22 +789,22 @@ int main(int argc, char *argv[]) {
 
         uint8_t start = ('d' == c) ? DS1307_REGAD_RAM : 0;
         uint8_t count = ('d' == c) ? (DS1307_REGAD_END - DS1307_REGAD_RAM) : DS1307_REGAD_END;
-        if ((res = ds1307_dump(file, start, count)) < 0) {
-          close(file);
+        if ((res = ds1307_dump(&bus, start, count)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 'g': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = ds1307_get_sqw(file)) < 0) {
-          close(file);
+        if ((res = ds1307_get_sqw(&bus)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
@@ -905,35 +812,35 @@ int main(int argc, char *argv[]) {
 
       case 'h':
       case 'H': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = ds1307_halt(file, 'H' == c)) < 0) {
-          close(file);
+        if ((res = ds1307_halt(&bus, 'H' == c)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 'p': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = ds1307_print_time(file)) < 0) {
-          close(file);
+        if ((res = ds1307_print_time(&bus)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 's': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -946,41 +853,46 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((res = ds1307_set_sqw(file, s)) < 0) {
-          close(file);
+        if ((res = ds1307_set_sqw(&bus, s)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 'S': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = ds1307_sync_time(file)) < 0) {
-          close(file);
+        if ((res = ds1307_sync_time(&bus)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 't': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = ds1307_test_ram(file)) < 0) {
-          close(file);
+        if ((res = ds1307_test_ram(&bus)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
+      case OPT_STATS: {
+        i2c_stats_enable(stderr);
+        break;
+      }
+
       case '?': {
         handle_bad_opts();
         print_help(argv[0]);
@@ -994,8 +906,6 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (file >= 0) {
-    close(file);
-  }
+  i2c_close(&bus);
   return 0;
 }
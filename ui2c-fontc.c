@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * Font compiler, run at build time.
+ * Reads a BDF font and writes a C header holding its glyph atlas in the page
+ * layout libfont.h describes. Glyphs are rendered into cells of their advance
+ * width by FONT_ASCENT + FONT_DESCENT rows, so spacing is part of the cell.
+ * Only encodings 0-255 are kept.
+ *****************************************************************************/
+
+#define FONTC_LINE_MAX   (256)
+#define FONTC_WIDTH_MAX  (64)
+#define FONTC_HEIGHT_MAX (64)
+
+typedef struct {
+  bool present;
+  int width;
+  uint32_t offset;
+} fontc_glyph_t;
+
+typedef struct {
+  int ascent;
+  int descent;
+  int fallback;
+  int height;
+  int pages;
+  fontc_glyph_t glyph[256];
+  uint8_t *atlas;
+  size_t size;
+} fontc_t;
+
+/* Renders one glyph bitmap into its cell and appends the cell to the atlas. */
+static int fontc_put(fontc_t *font, int enc, int dwidth, int bw, int bh, int bx, int by, uint8_t bits[][FONTC_WIDTH_MAX / 8]) {
+  int x, y, cx, cy;
+  uint8_t *cell;
+
+  if ((dwidth <= 0) || (dwidth > FONTC_WIDTH_MAX)) {
+    return -EINVAL;
+  }
+  if (NULL == (cell = realloc(font->atlas, font->size + font->pages * dwidth))) {
+    return -ENOMEM;
+  }
+  font->atlas = cell;
+  cell = &font->atlas[font->size];
+  memset(cell, 0, font->pages * dwidth);
+
+  for (y = 0; y < bh; y ++) {
+    /* Bitmap rows go top down from by + bh - 1 above the baseline. */
+    cy = font->ascent - (by + bh) + y;
+    for (x = 0; x < bw; x ++) {
+      cx = bx + x;
+      if ((0 == (bits[y][x / 8] & (0x80 >> (x % 8)))) || (cx < 0) || (cx >= dwidth) || (cy < 0) || (cy >= font->height)) {
+        continue;
+      }
+      cell[(cy / 8) * dwidth + cx] |= 1 << (cy % 8);
+    }
+  }
+
+  font->glyph[enc].present = true;
+  font->glyph[enc].width   = dwidth;
+  font->glyph[enc].offset  = font->size;
+  font->size += font->pages * dwidth;
+  return 0;
+}
+
+static int fontc_read(fontc_t *font, FILE *fp) {
+  static uint8_t bits[FONTC_HEIGHT_MAX][FONTC_WIDTH_MAX / 8];
+  int enc = -1, dwidth = 0, bw = 0, bh = 0, bx = 0, by = 0, row = -1, res, i;
+  char line[FONTC_LINE_MAX];
+  unsigned int v;
+
+  while (NULL != fgets(line, sizeof(line), fp)) {
+    if (row >= 0) {
+      /* In BITMAP: one hex row per line */
+      if (0 == strncmp(line, "ENDCHAR", 7)) {
+        if ((enc >= 0) && (enc < 256) && ((res = fontc_put(font, enc, dwidth, bw, bh, bx, by, bits)) < 0)) {
+          fprintf(stderr, "ERROR: bad glyph %d.\n", enc);
+          return res;
+        }
+        row = -1;
+        continue;
+      }
+      if (row >= bh) {
+        return -EINVAL;
+      }
+      for (i = 0; i < (bw + 7) / 8; i ++) {
+        if (1 != sscanf(&line[i * 2], "%2x", &v)) {
+          return -EINVAL;
+        }
+        bits[row][i] = v;
+      }
+      row ++;
+    } else if (1 == sscanf(line, "FONT_ASCENT %d", &font->ascent)) {
+    } else if (1 == sscanf(line, "FONT_DESCENT %d", &font->descent)) {
+    } else if (1 == sscanf(line, "DEFAULT_CHAR %d", &font->fallback)) {
+    } else if (0 == strncmp(line, "STARTCHAR", 9)) {
+      if (0 == font->height) {
+        /* Properties come first */
+        font->height = font->ascent + font->descent;
+        if ((font->height <= 0) || (font->height > FONTC_HEIGHT_MAX)) {
+          fputs("ERROR: FONT_ASCENT and FONT_DESCENT missing or out of range.\n", stderr);
+          return -EINVAL;
+        }
+        font->pages = (font->height + 7) / 8;
+      }
+      enc = -1;
+    } else if (1 == sscanf(line, "ENCODING %d", &enc)) {
+    } else if (1 == sscanf(line, "DWIDTH %d", &dwidth)) {
+    } else if (4 == sscanf(line, "BBX %d %d %d %d", &bw, &bh, &bx, &by)) {
+      if ((bw < 0) || (bw > FONTC_WIDTH_MAX) || (bh < 0) || (bh > FONTC_HEIGHT_MAX)) {
+        return -EINVAL;
+      }
+    } else if (0 == strncmp(line, "BITMAP", 6)) {
+      row = 0;
+    }
+  }
+
+  return ferror(fp) ? -EIO : 0;
+}
+
+static int fontc_write(const fontc_t *font, FILE *fp, const char *src, const char *sym) {
+  int first, last, fallback, c;
+  size_t i;
+
+  for (first = 0; (first < 256) && !font->glyph[first].present; first ++);
+  for (last = 255; (last >= 0) && !font->glyph[last].present; last --);
+  if (first > last) {
+    fputs("ERROR: no glyphs.\n", stderr);
+    return -EINVAL;
+  }
+  fallback = ((font->fallback >= 0) && (font->fallback < 256) && font->glyph[font->fallback].present) ? font->fallback
+           : font->glyph['?'].present ? '?' : first;
+
+  fprintf(fp, "/* Generated by ui2c-fontc from %s, do not edit. */\n\n", src);
+  fprintf(fp, "static const uint8_t %s_atlas[] = {", sym);
+  for (i = 0; i < font->size; i ++) {
+    fprintf(fp, "%s0x%02x,", (0 == i % 12) ? "\n  " : " ", font->atlas[i]);
+  }
+  fprintf(fp, "\n};\n\n");
+
+  /* Holes in the range borrow the fallback glyph */
+  fprintf(fp, "static const font_glyph_t %s_glyphs[] = {\n", sym);
+  for (c = first; c <= last; c ++) {
+    const fontc_glyph_t *g = &font->glyph[font->glyph[c].present ? c : fallback];
+
+    fprintf(fp, "  {%5u, %2d},  /* 0x%02x */\n", g->offset, g->width, c);
+  }
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "const font_t %s = {\n", sym);
+  fprintf(fp, "  .name     = \"%s\",\n", sym);
+  fprintf(fp, "  .height   = %d,\n", font->height);
+  fprintf(fp, "  .pages    = %d,\n", font->pages);
+  fprintf(fp, "  .first    = %d,\n", first);
+  fprintf(fp, "  .last     = %d,\n", last);
+  fprintf(fp, "  .fallback = %d,\n", fallback);
+  fprintf(fp, "  .glyphs   = %s_glyphs,\n", sym);
+  fprintf(fp, "  .atlas    = %s_atlas,\n", sym);
+  fprintf(fp, "};\n");
+
+  return ferror(fp) ? -EIO : 0;
+}
+
+int main(int argc, char **argv) {
+  fontc_t font = {.fallback = -1};
+  char tmp[PATH_MAX];
+  FILE *in, *out;
+  int res;
+
+  if (4 != argc) {
+    fprintf(stderr, "Usage: %s <font.bdf> <symbol> <header.h>\n", argv[0]);
+    return 1;
+  }
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", argv[3]) >= (int)sizeof(tmp)) {
+    return 1;
+  }
+
+  if (NULL == (in = fopen(argv[1], "r"))) {
+    perror("fopen");
+    return 1;
+  }
+  res = fontc_read(&font, in);
+  fclose(in);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: cannot compile %s: %s\n", argv[1], strerror(-res));
+    free(font.atlas);
+    return 1;
+  }
+
+  if (NULL == (out = fopen(tmp, "w"))) {
+    perror("fopen");
+    free(font.atlas);
+    return 1;
+  }
+  res = fontc_write(&font, out, argv[1], argv[2]);
+  free(font.atlas);
+  if ((0 != fclose(out)) && (res >= 0)) {
+    res = -EIO;
+  }
+  /* make must not see a half-written header */
+  if ((res < 0) || (rename(tmp, argv[3]) < 0)) {
+    perror("write");
+    unlink(tmp);
+    return 1;
+  }
+
+  return 0;
+}
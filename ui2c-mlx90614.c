@@ -1,5 +1,5 @@
-#include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
@@ -8,7 +8,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 
-#include <linux/i2c-dev.h>
+#include "libui2c.h"
 
 
 /* MLX90614 Definations */
@@ -50,106 +50,39 @@
 #define MLX90614_PWM_RELAY  (1 << 3)
 
 
-/* Helper functions */
-
-int i2c_open(int bus) {
-  const int fn_len = 20;
-  char fn[fn_len];
-  int res, file;
-
-  if (bus < 0) {
-    return -EINVAL;
-  }
-
-  /* Open i2c-dev file */
-  snprintf(fn, fn_len, "/dev/i2c-%d", bus);
-  if ((file = open(fn, O_RDWR)) < 0) {
-    perror("open() failed (make sure i2c_dev is loaded and you have the permission)");
-    return file;
-  }
-
-  /* Query functions */
-  unsigned long funcs;
-  if ((res = ioctl(file, I2C_FUNCS, &funcs)) < 0) {
-    perror("ioctl() I2C_FUNCS failed");
-    return res;
-  }
-  fprintf(stdout, "Device: %s (", fn);
-  if (funcs & I2C_FUNC_I2C) {
-    fputs("I2C_FUNC_I2C ", stdout);
-  }
-  if (funcs & I2C_FUNC_SMBUS_BYTE) {
-    fputs("I2C_FUNC_SMBUS_BYTE ", stdout);
-  }
-  fputs("\b)\n", stdout);
-  fflush(stdout);
-
-  return file;
-}
-
-int i2c_select(int file, int addr) {
-  /* addr in [0x00, 0x7f] */
-  int res;
-
-  if ((res = ioctl(file, I2C_SLAVE, addr)) < 0) {
-    perror("ioctl() I2C_SLAVE failed");
-  }
-
-  return res;
-}
-
-int i2c_read_word(int file, uint8_t reg_addr, uint16_t *data) {
-  int res;
-
-  if (NULL == data) {
-    return -EFAULT;
-  }
-
-  if ((res = i2c_smbus_read_word_data(file, reg_addr)) < 0) {
-    /* Try again */
-    if ((res = i2c_smbus_read_word_data(file, reg_addr)) < 0) {
-      perror("i2c_smbus_read_word_data");
-      return res;
-    }
-  }
-
-  *data = res;
-  return 0;
-}
-
 /* MLX90614-specific functions */
 double mlx90614_reg_to_temp(uint16_t reg) {
   /* NOTE: register range is 0x27ad 0x7fff, temp range is -70.01 C to +382.19 C */
   return reg * 0.02f - 273.15f;
 }
 
-int mlx90614_print_all(int file) {
+int mlx90614_print_all(i2c_bus_t *bus) {
   int res;
   uint16_t id[4] = {0x0000, 0x0000, 0x0000, 0x0000};
   uint16_t ta;
   uint16_t tobj1;
   uint16_t tobj2;
 
-  if ((res = i2c_read_word(file, MLX90614_ID1, &id[0])) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_ID1, &id[0])) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, MLX90614_ID2, &id[1])) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_ID2, &id[1])) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, MLX90614_ID3, &id[2])) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_ID3, &id[2])) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, MLX90614_ID4, &id[3])) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_ID4, &id[3])) < 0) {
     return res;
   }
 
-  if ((res = i2c_read_word(file, MLX90614_TA, &ta)) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_TA, &ta)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, MLX90614_TOBJ1, &tobj1)) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_TOBJ1, &tobj1)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, MLX90614_TOBJ2, &tobj2)) < 0) {
+  if ((res = i2c_read_word_le(bus, MLX90614_TOBJ2, &tobj2)) < 0) {
     return res;
   }
 
@@ -171,6 +104,7 @@ int mlx90614_print_all(int file) {
  * l       - local temperature
  * o       - object temperature
  * TODO: F/C switch
+ * --stats - print I2C transfer statistics
  *****************************************************************************/
 
 void print_help(const char *self) {
@@ -195,6 +129,7 @@ void print_help(const char *self) {
                     system.\n\
     -l      : print local (die) temperature.\n\
     -o      : print remote (object) temperature.\n\
+    --stats : print I2C transfer statistics to stderr when a bus is closed.\n\
   \n\
   Example:\n\
     Print object temperature measured by MLX90614 on i2c-1:\n\
@@ -242,8 +177,15 @@ int read_int(const char *s) {
   return i;
 }
 
+#define OPT_STATS (0x100)
+
+static const struct option long_opts[] = {
+  {"stats", no_argument, NULL, OPT_STATS},
+  {NULL,    0,           NULL, 0},
+};
+
 int main(int argc, char *argv[]) {
-  int file = -1;
+  i2c_bus_t bus = I2C_BUS_INIT;
   int res;
 
   if (argc < 2) {
@@ -254,10 +196,10 @@ int main(int argc, char *argv[]) {
   int c;
   int ad = MLX90614_DEVAD;
   opterr = 0;
-  while ((c = getopt(argc, argv, "a:Ab:lo")) != -1) {
+  while ((c = getopt_long(argc, argv, "a:Ab:lo", long_opts, NULL)) != -1) {
     switch (c) {
       case 'a': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to address selection.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -274,8 +216,8 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -284,25 +226,22 @@ int main(int argc, char *argv[]) {
       }
 
       case 'A': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = mlx90614_print_all(file)) < 0) {
-          close(file);
+        if ((res = mlx90614_print_all(&bus)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 'b': {
-        if (file >= 0) {
-          /* We are switching to a new file, close the old one first */
-          close(file);
-          file = -1; /* So we do not double-close */
-        }
+        /* We are switching to a new bus, close the old one first */
+        i2c_close(&bus);
 
         int bn;
         if ((bn = read_int(optarg)) < 0) {
@@ -311,12 +250,12 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((file = i2c_open(bn)) < 0) {
-          return file;
+        if ((res = i2c_open(&bus, bn)) < 0) {
+          return res;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -325,15 +264,15 @@ int main(int argc, char *argv[]) {
       }
 
       case 'l': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
         uint16_t ta;
-        if ((res = i2c_read_word(file, MLX90614_TA, &ta)) < 0) {
-          close(file);
+        if ((res = i2c_read_word_le(&bus, MLX90614_TA, &ta)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         fprintf(stdout, "Local Temperature: %.2lf C\n", mlx90614_reg_to_temp(ta));
@@ -341,25 +280,30 @@ int main(int argc, char *argv[]) {
       }
 
       case 'o': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
         uint16_t tobj1, tobj2;
-        if ((res = i2c_read_word(file, MLX90614_TOBJ1, &tobj1)) < 0) {
-          close(file);
+        if ((res = i2c_read_word_le(&bus, MLX90614_TOBJ1, &tobj1)) < 0) {
+          i2c_close(&bus);
           return res;
         }
-        if ((res = i2c_read_word(file, MLX90614_TOBJ2, &tobj2)) < 0) {
-          close(file);
+        if ((res = i2c_read_word_le(&bus, MLX90614_TOBJ2, &tobj2)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         fprintf(stdout, "Remote Temperature 1: %.2lf C\nRemote Temperature 2: %.2lf C\n", mlx90614_reg_to_temp(tobj1), mlx90614_reg_to_temp(tobj2));
         break;
       }
 
+      case OPT_STATS: {
+        i2c_stats_enable(stderr);
+        break;
+      }
+
       case '?': {
         handle_bad_opts();
         print_help(argv[0]);
@@ -373,8 +317,6 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (file >= 0) {
-    close(file);
-  }
+  i2c_close(&bus);
   return 0;
 }
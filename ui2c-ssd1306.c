@@ -4,25 +4,26 @@
 #include <stdint.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 
-#include <fcntl.h>
-#include <linux/i2c-dev.h>
+#include <limits.h>
+
+#include "libui2c.h"
+#include "libfont.h"
 
 #include <malloc.h>
+#include <string.h>
 #include <strings.h>
 #include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <png.h>
 
 /*
- * TODO: define and use a ssd1306_t context as follows:
- * typedef struct {
- *   int file;
- *   size_t width;
- *   size_t heigh;
- *   uint8_t buffer[0];
- * } ssd1306_t;
- *
  * TODO: since malloc is involved, use valgrind to check memory leaks.
  * TODO: very high sys cpu usage. find a way to optimize.
  * TODO: fold consecutive calls into loops with array
@@ -54,101 +55,87 @@ static void sigint_handler(int sig) {
 #define SSD1306_CTRL_CMD  (0<<6)
 #define SSD1306_CTRL_CONT (1<<7)
 
-/* This is how your image displays on the screen, with parameters in this program. */
-int dump_bmp(uint8_t data[], size_t len) {
-  size_t x, y;
+/******************************************************************************
+ * Device is mostly write-only.
+ * Frame format: address control data
+ * Control: CONT D/C 0 0 0 0 0 0
+ * Data   : Encapsulated 8-bit command, parameter or data
+ * Repeat with CONT set until all command and data are sent.
+ *
+ * With CONT cleared, every byte after the control byte is of the same kind
+ * until STOP. Commands are therefore queued into a command stream and sent
+ * as a single write: SSD1306_CTRL_CMD cmd param cmd ... instead of one 2-byte
+ * write per command or parameter byte.
+ * The command parser keeps its state across transactions, so a full stream
+ * can be flushed anywhere, even in the middle of a command.
+ *****************************************************************************/
 
-  if ((NULL == data) || ((len % 8) != 1)) {
-    fprintf(stdout, "Invalid argument while calling dump_bmp().\n");
-    return -EINVAL;
-  }
+#define SSD1306_CMDS_MAX (128)
 
-  fprintf(stdout, "HDR = 0x%02x\n", data[0]);
-  for (y = 0; y < 64; y ++) {
-    for (x = 0; x < 128; x ++) {
-      fputc((data[(y / 8 * 128) + x + 1] & (1 << (y % 8))) ? '@' : ' ', stdout);
-    }
-    if (x % 128 == 0) {
-      fputc('\n', stdout);
-    }
-  }
+typedef struct {
+  i2c_bus_t *bus;
+  size_t len;                        /* Number of queued command bytes */
+  uint8_t buf[SSD1306_CMDS_MAX + 1]; /* buf[0] is the control byte */
+} ssd1306_cmds_t;
 
-  fputc('\n', stdout);
-  fflush(stdout);
-  return 0;
+void ssd1306_cmds_init(ssd1306_cmds_t *cmds, i2c_bus_t *bus) {
+  cmds->bus    = bus;
+  cmds->len    = 0;
+  cmds->buf[0] = SSD1306_CTRL_CMD;
 }
 
-int i2c_open(int bus) {
-  const int fn_len = 20;
-  char fn[fn_len];
-  int res, file;
+int ssd1306_cmds_flush(ssd1306_cmds_t *cmds) {
+  int res;
 
-  if (bus < 0) {
-    return -EINVAL;
+  if (NULL == cmds) {
+    return -EFAULT;
   }
-
-  /* Open i2c-dev file */
-  snprintf(fn, fn_len, "/dev/i2c-%d", bus);
-  if ((file = open(fn, O_RDWR)) < 0) {
-    perror("open() failed (make sure i2c_dev is loaded and you have the permission)");
-    return file;
+  if (0 == cmds->len) {
+    return 0;
   }
 
-  /* Query functions */
-  unsigned long funcs;
-  if ((res = ioctl(file, I2C_FUNCS, &funcs)) < 0) {
-    perror("ioctl() I2C_FUNCS failed");
-    return res;
-  }
-  fprintf(stdout, "Device: %s (", fn);
-  if (funcs & I2C_FUNC_I2C) {
-    fputs("I2C_FUNC_I2C ", stdout);
-  }
-  if (funcs & I2C_FUNC_SMBUS_BYTE) {
-    fputs("I2C_FUNC_SMBUS_BYTE ", stdout);
-  }
-  fputs("\b)\n", stdout);
-  fflush(stdout);
+  res = i2c_write_bulk(cmds->bus, cmds->buf, cmds->len + 1);
+  /* Drop the stream even on failure, re-sending half of it is worse. */
+  cmds->len = 0;
 
-  return file;
+  return res;
 }
 
-int i2c_select(int file, int addr) {
-  /* addr in [0x00, 0x7f] */
+int ssd1306_cmds_add(ssd1306_cmds_t *cmds, const uint8_t seq[], size_t len) {
   int res;
+  size_t n;
 
-  if ((res = ioctl(file, I2C_SLAVE, addr)) < 0) {
-    perror("ioctl() I2C_SLAVE failed");
+  if ((NULL == cmds) || (NULL == seq)) {
+    return -EFAULT;
   }
 
-  return res;
-}
-
-/******************************************************************************
- * Device is mostly write-only.
- * Frame format: address control data
- * Control: CONT D/C 0 0 0 0 0 0
- * Data   : Encapsulated 8-bit command, parameter or data
- * Repeat with CONT set until all command and data are sent.
- *****************************************************************************/
-
-int i2c_write_cmd_1b(int file, uint8_t cmd) {
-  int res;
-  uint8_t buf[2] = {SSD1306_CTRL_CMD, cmd};
+  while (len > 0) {
+    if (SSD1306_CMDS_MAX == cmds->len) {
+      if ((res = ssd1306_cmds_flush(cmds)) < 0) {
+        return res;
+      }
+    }
 
-  if ((res = write(file, buf, 2)) < 0) {
-    perror("write() command failed");
-    return res;
+    n = SSD1306_CMDS_MAX - cmds->len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(&cmds->buf[cmds->len + 1], seq, n);
+    cmds->len += n;
+    seq       += n;
+    len       -= n;
   }
 
   return 0;
 }
 
+int ssd1306_cmds_put(ssd1306_cmds_t *cmds, uint8_t cmd) {
+  return ssd1306_cmds_add(cmds, &cmd, 1);
+}
+
 #define SSD1306_CONT_DATA_HDR (0x40)
 /* To avoid copying, caller should prepare the header. */
-int i2c_write_data(int file, uint8_t data[], size_t len) {
-  int res;
-
+int i2c_write_data(i2c_bus_t *bus, const uint8_t data[], size_t len) {
   if (NULL == data) {
     return -EINVAL;
   }
@@ -156,71 +143,44 @@ int i2c_write_data(int file, uint8_t data[], size_t len) {
     return -EINVAL;
   }
 
-  if ((res = write(file, data, len)) < 0) {
-    perror("write() data failed");
-    return res;
-  }
-
-  return 0;
-}
-
-int i2c_read_byte(int file, uint8_t *data) {
-  if (NULL == data) {
-    return -EFAULT;
-  }
-
-  int res;
-
-  if ((res = read(file, data, 1)) < 0) {
-    perror("read() data failed");
-    return res;
-  }
-
-  return 0;
+  return i2c_write_bulk(bus, data, len);
 }
 
 /* Device functions */
 /* Due to the complicated and variable command structure, use functions instead of macros. */
 
-int ssd1306_set_contrast(int file, uint8_t contrast) {
-  int res;
-
-  if ((res = i2c_write_cmd_1b(file, 0x80)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, contrast)) < 0) {
-    return res;
-  }
+int ssd1306_set_contrast(ssd1306_cmds_t *cmds, uint8_t contrast) {
+  uint8_t seq[] = {0x81, contrast};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_contrast(int file) {
-  return ssd1306_set_contrast(file, 0x7f);
+int ssd1306_reset_contrast(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_contrast(cmds, 0x7f);
 }
 
-int ssd1306_set_display_test(int file, bool enable) {
-  return i2c_write_cmd_1b(file, enable ? 0xa5 : 0xa4);
+int ssd1306_set_display_test(ssd1306_cmds_t *cmds, bool enable) {
+  return ssd1306_cmds_put(cmds, enable ? 0xa5 : 0xa4);
 }
 
-int ssd1306_reset_display_test(int file) {
-  return ssd1306_set_display_test(file, false);
+int ssd1306_reset_display_test(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_display_test(cmds, false);
 }
 
-int ssd1306_set_inverse(int file, bool enable) {
-  return i2c_write_cmd_1b(file, enable ? 0xa7 : 0xa6);
+int ssd1306_set_inverse(ssd1306_cmds_t *cmds, bool enable) {
+  return ssd1306_cmds_put(cmds, enable ? 0xa7 : 0xa6);
 }
 
-int ssd1306_reset_inverse(int file) {
-  return ssd1306_set_inverse(file, false);
+int ssd1306_reset_inverse(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_inverse(cmds, false);
 }
 
-int ssd1306_set_power(int file, bool enable) {
-  return i2c_write_cmd_1b(file, enable ? 0xaf : 0xae);
+int ssd1306_set_power(ssd1306_cmds_t *cmds, bool enable) {
+  return ssd1306_cmds_put(cmds, enable ? 0xaf : 0xae);
 }
 
-int ssd1306_reset_power(int file) {
-  return ssd1306_set_power(file, false);
+int ssd1306_reset_power(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_power(cmds, false);
 }
 
 int ssd1306_interval_to_param(int interval, uint8_t *param) {
@@ -268,7 +228,7 @@ int ssd1306_interval_to_param(int interval, uint8_t *param) {
   }
 }
 
-int ssd1306_setup_horiz_scroll(int file, bool left, uint8_t start_page, uint8_t end_page, int interval) {
+int ssd1306_setup_horiz_scroll(ssd1306_cmds_t *cmds, bool left, uint8_t start_page, uint8_t end_page, int interval) {
   int res;
 
   if ((start_page > 0x07) || (end_page > 0x07) || (start_page > end_page)) {
@@ -280,32 +240,12 @@ int ssd1306_setup_horiz_scroll(int file, bool left, uint8_t start_page, uint8_t
     return res;
   }
 
-  if ((res = i2c_write_cmd_1b(file, left ? 0x27 : 0x26)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0x00)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, start_page)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, interval_param)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, end_page)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0x00)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0xff)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {left ? 0x27 : 0x26, 0x00, start_page, interval_param, end_page, 0x00, 0xff};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_setup_scroll(int file, bool left, uint8_t start_page, uint8_t end_page, int interval, uint8_t vertical_offset) {
+int ssd1306_setup_scroll(ssd1306_cmds_t *cmds, bool left, uint8_t start_page, uint8_t end_page, int interval, uint8_t vertical_offset) {
   int res;
 
   /*
@@ -326,41 +266,22 @@ int ssd1306_setup_scroll(int file, bool left, uint8_t start_page, uint8_t end_pa
     return res;
   }
 
-  if ((res = i2c_write_cmd_1b(file, left ? 0x2a : 0x29)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0x00)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, start_page)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, interval_param)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, end_page)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, vertical_offset)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {left ? 0x2a : 0x29, 0x00, start_page, interval_param, end_page, vertical_offset};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_set_scroll(int file, bool enable) {
+int ssd1306_set_scroll(ssd1306_cmds_t *cmds, bool enable) {
   /*
    * NOTE: after disabling the scrolling, "the ram data needs to be
    * rewritten."
    * The lastest scrolling setting will take effect once scrolling is enabled.
    */
 
-  return i2c_write_cmd_1b(file, enable ? 0x2f : 0x2e);
+  return ssd1306_cmds_put(cmds, enable ? 0x2f : 0x2e);
 }
 
-int ssd1306_set_vertical_scroll_area(int file, uint8_t row_title, uint8_t roll_scroll) {
-  int res;
-
+int ssd1306_set_vertical_scroll_area(ssd1306_cmds_t *cmds, uint8_t row_title, uint8_t roll_scroll) {
   /*
    * NOTE: additional constraints apply, hardware may reject without notice.
    * row_title + roll_scroll < MUX_RATIO
@@ -376,26 +297,16 @@ int ssd1306_set_vertical_scroll_area(int file, uint8_t row_title, uint8_t roll_s
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0xa3)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, row_title)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, roll_scroll)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xa3, row_title, roll_scroll};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_vertical_scroll_area(int file) {
-  return ssd1306_set_vertical_scroll_area(file, 0, 64);
+int ssd1306_reset_vertical_scroll_area(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_vertical_scroll_area(cmds, 0, 64);
 }
 
-int ssd1306_set_col_start(int file, uint8_t col) {
-  int res;
-
+int ssd1306_set_col_start(ssd1306_cmds_t *cmds, uint8_t col) {
   /*
    * NOTE: this is a 2-step process requiring splitting the parameter into high
    * and low half-byte and embedding the parameter in 2 commands and sending
@@ -403,73 +314,49 @@ int ssd1306_set_col_start(int file, uint8_t col) {
    * For page addressing mode only.
    */
 
-  if ((res = i2c_write_cmd_1b(file, 0x00 | (col & 0x0f))) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0x01 | (col > 4))) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0x00 | (col & 0x0f), 0x10 | (col >> 4)};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_col_start(int file) {
-  return ssd1306_set_col_start(file, 0);
+int ssd1306_reset_col_start(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_col_start(cmds, 0);
 }
 
 #define SSD1306_MEMMODE_H    (0x00) /* Horizontally placed 1x8 blocks, not pixels! */
 #define SSD1306_MEMMODE_V    (0x01)
 #define SSD1306_MEMMODE_PAGE (0x02)
 
-int ssd1306_set_mem_addr_mode(int file, uint8_t mode) {
-  int res;
-
+int ssd1306_set_mem_addr_mode(ssd1306_cmds_t *cmds, uint8_t mode) {
   if (mode > 0x02) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0x20)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, mode)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0x20, mode};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_mem_addr_mode(int file) {
-  return ssd1306_set_mem_addr_mode(file, SSD1306_MEMMODE_PAGE);
+int ssd1306_reset_mem_addr_mode(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_mem_addr_mode(cmds, SSD1306_MEMMODE_PAGE);
 }
 
-int ssd1306_set_col_addr(int file, uint8_t start, uint8_t end) {
-  int res;
-
+int ssd1306_set_col_addr(ssd1306_cmds_t *cmds, uint8_t start, uint8_t end) {
   /* NOTE: for horizontal or vertical addressing mode only. */
   if ((start > 0x7f) || (end > 0x7f) || (start > end)) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0x21)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, start)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, end)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0x21, start, end};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_col_addr(int file) {
-  return ssd1306_set_col_addr(file, 0, 127);
+int ssd1306_reset_col_addr(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_col_addr(cmds, 0, 127);
 }
 
-int ssd1306_set_page_addr(int file, uint8_t start, uint8_t end) {
-  int res;
-
+int ssd1306_set_page_addr(ssd1306_cmds_t *cmds, uint8_t start, uint8_t end) {
   /*
    * NOTE: "for horizontal or vertical addressing mode", or should be for page
    * mode?
@@ -478,180 +365,135 @@ int ssd1306_set_page_addr(int file, uint8_t start, uint8_t end) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0x22)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, start)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, end)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0x22, start, end};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_page_addr(int file) {
-  return ssd1306_set_page_addr(file, 0, 7);
+int ssd1306_reset_page_addr(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_page_addr(cmds, 0, 7);
 }
 
-int ssd1306_set_page_start(int file, uint8_t page) {
+int ssd1306_set_page_start(ssd1306_cmds_t *cmds, uint8_t page) {
   /* NOTE: "set GDDRAM page start address", for page addressing mode only. */
 
   if (page > 0x07) {
     return -EINVAL;
   }
 
-  return i2c_write_cmd_1b(file, 0xb0 | (page & 0x07));
+  return ssd1306_cmds_put(cmds, 0xb0 | (page & 0x07));
 }
 
-int ssd1306_set_start_line(int file, uint8_t line) {
+int ssd1306_set_start_line(ssd1306_cmds_t *cmds, uint8_t line) {
   if (line > 0x3f) {
     return -EINVAL;
   }
 
-  return i2c_write_cmd_1b(file, 0x40 | (line & 0x3f));
+  return ssd1306_cmds_put(cmds, 0x40 | (line & 0x3f));
 }
 
-int ssd1306_reset_start_line(int file) {
-  return ssd1306_set_start_line(file, 0);
+int ssd1306_reset_start_line(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_start_line(cmds, 0);
 }
 
-int ssd1306_set_segment_remap(int file, bool reverse) {
+int ssd1306_set_segment_remap(ssd1306_cmds_t *cmds, bool reverse) {
   /* NOTE: normal = col 0 is seg 0, reverse = col 127 is seg 0. */
 
-  return i2c_write_cmd_1b(file, reverse ? 0xa1 : 0xa0);
+  return ssd1306_cmds_put(cmds, reverse ? 0xa1 : 0xa0);
 }
 
-int ssd1306_reset_segment_remap(int file) {
-  return ssd1306_set_segment_remap(file, false);
+int ssd1306_reset_segment_remap(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_segment_remap(cmds, false);
 }
 
-int ssd1306_set_mux_ratio(int file, int ratio) {
-  int res;
-
+int ssd1306_set_mux_ratio(ssd1306_cmds_t *cmds, int ratio) {
   /* NOTE: controlled by how many line (COM) your display has. */
 
   if (ratio > 0x40) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0xa8)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, (ratio - 1) & 0x3f)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xa8, (ratio - 1) & 0x3f};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_mux_ratio(int file) {
-  return ssd1306_set_mux_ratio(file, 64);
+int ssd1306_reset_mux_ratio(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_mux_ratio(cmds, 64);
 }
 
-int ssd1306_set_com_scan(int file, bool reverse) {
+int ssd1306_set_com_scan(ssd1306_cmds_t *cmds, bool reverse) {
   /* NOTE: normal = line 0 is com 0, reverse = line (mux_ratio - 1) is com 0. */
 
-  return i2c_write_cmd_1b(file, reverse ? 0xc8 : 0xc0);
+  return ssd1306_cmds_put(cmds, reverse ? 0xc8 : 0xc0);
 }
 
-int ssd1306_reset_com_scan(int file) {
-  return ssd1306_set_com_scan(file, false);
+int ssd1306_reset_com_scan(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_com_scan(cmds, false);
 }
 
-int ssd1306_set_display_offset(int file, uint8_t offset) {
-  int res;
-
+int ssd1306_set_display_offset(ssd1306_cmds_t *cmds, uint8_t offset) {
   /* NOTE: start display on line <offset>. */
 
   if (offset > 0x3f) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0xd3)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, offset)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xd3, offset};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_display_offset(int file) {
-  return ssd1306_set_display_offset(file, 0);
+int ssd1306_reset_display_offset(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_display_offset(cmds, 0);
 }
 
-int ssd1306_set_com_pin(int file, bool alternate, bool remap) {
-  int res;
-
+int ssd1306_set_com_pin(ssd1306_cmds_t *cmds, bool alternate, bool remap) {
   /* NOTE: highly hardware-specific. */
 
-  if ((res = i2c_write_cmd_1b(file, 0xda)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0x02 | (alternate ? 0x10 : 0x00) | (remap ? 0x20 : 0x00))) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xda, 0x02 | (alternate ? 0x10 : 0x00) | (remap ? 0x20 : 0x00)};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_com_pin(int file) {
-  return ssd1306_set_com_pin(file, true, false);
+int ssd1306_reset_com_pin(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_com_pin(cmds, true, false);
 }
 
-int ssd1306_set_clkdiv(int file, uint8_t ratio, uint8_t fosc) {
-  int res;
-
+int ssd1306_set_clkdiv(ssd1306_cmds_t *cmds, uint8_t ratio, uint8_t fosc) {
   if ((ratio > 0x10) || (0 == ratio) || (fosc > 0x0f)) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0xd5)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, (fosc << 4) | (ratio - 1))) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xd5, (fosc << 4) | (ratio - 1)};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_clkdiv(int file) {
-  return ssd1306_set_clkdiv(file, 1, 8);
+int ssd1306_reset_clkdiv(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_clkdiv(cmds, 1, 8);
 }
 
-int ssd1306_set_precharge(int file, uint8_t phase1, uint8_t phase2) {
-  int res;
-
+int ssd1306_set_precharge(ssd1306_cmds_t *cmds, uint8_t phase1, uint8_t phase2) {
   /* NOTE: phase1 and phase2 has unit of clock cycles. */
   if ((0 == phase1) || (0 == phase2) || (phase1 > 0x0f) || (phase1 > 0x0f)) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0xd9)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, (phase2 << 4) | phase1)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xd9, (phase2 << 4) | phase1};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_precharge(int file) {
-  return ssd1306_set_precharge(file, 2, 2);
+int ssd1306_reset_precharge(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_precharge(cmds, 2, 2);
 }
 
 #define SSD1306_VCOMH_LEVEL_650MV 0
 #define SSD1306_VCOMH_LEVEL_770MV 2
 #define SSD1306_VCOMH_LEVEL_830MV 3
 
-int ssd1306_set_vcomh_desel(int file, uint8_t level_code) {
-  int res;
-
+int ssd1306_set_vcomh_desel(ssd1306_cmds_t *cmds, uint8_t level_code) {
   /*
    * NOTE: although datasheet only gives voltages for 3 configurations, all
    * from 0~7 are possible.
@@ -661,31 +503,24 @@ int ssd1306_set_vcomh_desel(int file, uint8_t level_code) {
     return -EINVAL;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0xdb)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, (level_code & 0x07) << 4)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xdb, (level_code & 0x07) << 4};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_vcomh_desel(int file) {
-  return ssd1306_set_vcomh_desel(file, SSD1306_VCOMH_LEVEL_770MV);
+int ssd1306_reset_vcomh_desel(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_vcomh_desel(cmds, SSD1306_VCOMH_LEVEL_770MV);
 }
 
-int ssd1306_send_nop(int file) {
-  return i2c_write_cmd_1b(file, 0xe3);
+int ssd1306_send_nop(ssd1306_cmds_t *cmds) {
+  return ssd1306_cmds_put(cmds, 0xe3);
 }
 
 /*
  * NOTE: the following 3 are added in the new versions of the datasheet,
  * however, the charge pump enable is essential for most modules to operate.
  */
-int ssd1306_set_fade(int file, bool fade_out, bool fade_in, uint8_t fade_interval) {
-  int res;
-
+int ssd1306_set_fade(ssd1306_cmds_t *cmds, bool fade_out, bool fade_in, uint8_t fade_interval) {
   if (fade_interval > 128) {
     return -EINVAL;
   }
@@ -693,94 +528,77 @@ int ssd1306_set_fade(int file, bool fade_out, bool fade_in, uint8_t fade_interva
     fade_interval = 8;
   }
 
-  if ((res = i2c_write_cmd_1b(file, 0x23)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, (fade_out ? 0x20 : 0x00) | (fade_in ? 0x10 : 0x00) | ((fade_interval / 8 - 1) & 0x0f))) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0x23, (fade_out ? 0x20 : 0x00) | (fade_in ? 0x10 : 0x00) | ((fade_interval / 8 - 1) & 0x0f)};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_fade(int file) {
+int ssd1306_reset_fade(ssd1306_cmds_t *cmds) {
   /* NOTE: default does not include fade_interval. */
 
-  return ssd1306_set_fade(file, false, false, 8);
+  return ssd1306_set_fade(cmds, false, false, 8);
 }
 
-int ssd1306_set_zoom(int file, bool enable) {
-  int res;
-
+int ssd1306_set_zoom(ssd1306_cmds_t *cmds, bool enable) {
   /* NOTE: for panels in alternate COM configuration only. */
 
-  if ((res = i2c_write_cmd_1b(file, 0xd6)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, enable ? 0x01 : 0x00)) < 0 ) {
-    return res;
-  }
+  uint8_t seq[] = {0xd6, enable ? 0x01 : 0x00};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_zoom(int file) {
-  return ssd1306_set_zoom(file, false);
+int ssd1306_reset_zoom(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_zoom(cmds, false);
 }
 
-int ssd1306_set_charge_pump(int file, bool enable) {
-  int res;
-
-  if ((res = i2c_write_cmd_1b(file, 0x8d)) < 0 ) {
-    return res;
-  }
-  if ((res = i2c_write_cmd_1b(file, 0x10 | (enable ? 0x04 : 0x00))) < 0 ) {
-    return res;
-  }
+int ssd1306_set_charge_pump(ssd1306_cmds_t *cmds, bool enable) {
+  uint8_t seq[] = {0x8d, 0x10 | (enable ? 0x04 : 0x00)};
 
-  return 0;
+  return ssd1306_cmds_add(cmds, seq, sizeof(seq));
 }
 
-int ssd1306_reset_charge_pump(int file) {
-  return ssd1306_set_charge_pump(file, false);
+int ssd1306_reset_charge_pump(ssd1306_cmds_t *cmds) {
+  return ssd1306_set_charge_pump(cmds, false);
 }
 
 #define SSD1306_STATUS_DISP_OFF (1 << 6)
 /* NOTE: all other bits in the reg are reserved. */
-int ssd1306_read_status(int file, uint8_t *reg) {
-  return i2c_read_byte(file, reg);
+int ssd1306_read_status(i2c_bus_t *bus, uint8_t *reg) {
+  return i2c_read(bus, reg, 1);
 }
 
 /* NOTE: "No data read is provided in serial mode operation." */
 
-int ssd1306_soft_reset(int file) {
+int ssd1306_soft_reset(ssd1306_cmds_t *cmds) {
   int res, i;
 
+  /* NOTE: only queues the commands, caller should flush the stream. */
+
   /*
    * Longest command has 6 parameters.
    * Send 6 NOPs to finish any currently pending command.
    */
 
   for (i = 0; i < 6; i ++) {
-    if ((res = ssd1306_send_nop(file)) < 0 ) {
+    if ((res = ssd1306_send_nop(cmds)) < 0 ) {
       return res;
     }
   }
 
   /* Fundamentals. TODO: consider sequence. */
-  if ((res = ssd1306_reset_power(file)) < 0 ) {
+  if ((res = ssd1306_reset_power(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_charge_pump(file)) < 0 ) {
+  if ((res = ssd1306_reset_charge_pump(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_contrast(file)) < 0 ) {
+  if ((res = ssd1306_reset_contrast(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_display_test(file)) < 0 ) {
+  if ((res = ssd1306_reset_display_test(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_inverse(file)) < 0 ) {
+  if ((res = ssd1306_reset_inverse(cmds)) < 0 ) {
     return res;
   }
 
@@ -789,376 +607,2734 @@ int ssd1306_soft_reset(int file) {
    * NOTE: Scrolling parameters are not reset.
    *       Assuming scrolling is disabled after POR.
    */
-  if ((res = ssd1306_reset_vertical_scroll_area(file)) < 0 ) {
+  if ((res = ssd1306_reset_vertical_scroll_area(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_set_scroll(file, false)) < 0 ) {
+  if ((res = ssd1306_set_scroll(cmds, false)) < 0 ) {
     return res;
   }
 
   /* Addressing */
-  if ((res = ssd1306_reset_col_start(file)) < 0 ) {
+  if ((res = ssd1306_reset_col_start(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_mem_addr_mode(file)) < 0 ) {
+  if ((res = ssd1306_reset_mem_addr_mode(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_col_addr(file)) < 0 ) {
+  if ((res = ssd1306_reset_col_addr(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_page_addr(file)) < 0 ) {
+  if ((res = ssd1306_reset_page_addr(cmds)) < 0 ) {
     return res;
   }
 
   /* Hardware */
-  if ((res = ssd1306_reset_start_line(file)) < 0 ) {
+  if ((res = ssd1306_reset_start_line(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_segment_remap(file)) < 0 ) {
+  if ((res = ssd1306_reset_segment_remap(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_mux_ratio(file)) < 0 ) {
+  if ((res = ssd1306_reset_mux_ratio(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_com_scan(file)) < 0 ) {
+  if ((res = ssd1306_reset_com_scan(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_display_offset(file)) < 0 ) {
+  if ((res = ssd1306_reset_display_offset(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_com_pin(file)) < 0 ) {
+  if ((res = ssd1306_reset_com_pin(cmds)) < 0 ) {
     return res;
   }
 
   /* Clocking */
-  if ((res = ssd1306_reset_clkdiv(file)) < 0 ) {
+  if ((res = ssd1306_reset_clkdiv(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_precharge(file)) < 0 ) {
+  if ((res = ssd1306_reset_precharge(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_vcomh_desel(file)) < 0 ) {
+  if ((res = ssd1306_reset_vcomh_desel(cmds)) < 0 ) {
     return res;
   }
 
   /* VFX */
-  if ((res = ssd1306_reset_fade(file)) < 0 ) {
+  if ((res = ssd1306_reset_fade(cmds)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_reset_zoom(file)) < 0 ) {
+  if ((res = ssd1306_reset_zoom(cmds)) < 0 ) {
     return res;
   }
 
   return 0;
 }
 
-int ssd1306_init(int file, int col, int line) {
-  int res;
+/******************************************************************************
+ * Panel geometries.
+ * What differs between the common modules, besides the size: COM pin wiring
+ * and which GDDRAM columns are connected. ssd1306_open() picks the geometry
+ * once, nothing checks sizes again after that. Other sizes the controller can
+ * drive get one filled in from the size alone.
+ *****************************************************************************/
 
-  /* NOTE: use defualts whenever we can. <col> is not used. */
+typedef struct ssd1306_geom_s ssd1306_geom_t;
 
-  if ((line <= 0) || (col <= 0)) {
-    return -EINVAL;
+struct ssd1306_geom_s {
+  int width;
+  int height;
+  int pages;
+  int col0;                   /* First GDDRAM column wired to the panel */
+  bool com_alt;               /* Alternative COM pin configuration */
+};
+
+/* Widths are multiples of 8: compare 8 columns at once. */
+static inline uint64_t ssd1306_xor64(const uint8_t a[], const uint8_t b[]) {
+  uint64_t x, y;
+
+  memcpy(&x, a, sizeof(x));
+  memcpy(&y, b, sizeof(y));
+  return x ^ y;
+}
+
+/*
+ * First and last changed column of every page, -1 if none. Returns the number
+ * of changed pages.
+ */
+static int ssd1306_dirty(const ssd1306_geom_t *geom, const uint8_t old[], const uint8_t new[], int first[], int last[]) {
+  int p, c, n = 0;
+
+  for (p = 0; p < geom->pages; p ++, old += geom->width, new += geom->width) {
+    for (c = 0; (c < geom->width) && (0 == ssd1306_xor64(&old[c], &new[c])); c += 8);
+    if (c == geom->width) {
+      first[p] = last[p] = -1;
+      continue;
+    }
+    for (; old[c] == new[c]; c ++);
+    first[p] = c;
+    for (c = geom->width - 8; 0 == ssd1306_xor64(&old[c], &new[c]); c -= 8);
+    for (c += 7; old[c] == new[c]; c --);
+    last[p] = c;
+    n ++;
+  }
+  return n;
+}
+
+/* Column at a time, the reference for --bench. */
+static int ssd1306_dirty_ref(const ssd1306_geom_t *geom, const uint8_t old[], const uint8_t new[], int first[], int last[]) {
+  int p, c, n = 0;
+
+  for (p = 0; p < geom->pages; p ++, old += geom->width, new += geom->width) {
+    first[p] = last[p] = -1;
+    for (c = 0; c < geom->width; c ++) {
+      if (old[c] != new[c]) {
+        if (first[p] < 0) {
+          first[p] = c;
+          n ++;
+        }
+        last[p] = c;
+      }
+    }
   }
-  if ((line > 64) || (col > 128)) {
-    return -EINVAL;
+  return n;
+}
+
+static const ssd1306_geom_t ssd1306_geoms[] = {
+  {.width = 128, .height = 64, .pages = 8, .col0 = 0,  .com_alt = true},
+  {.width = 128, .height = 32, .pages = 4, .col0 = 0,  .com_alt = false},
+  {.width = 96,  .height = 16, .pages = 2, .col0 = 0,  .com_alt = false},
+  /* 64x48 modules are wired to the middle of the 128 columns */
+  {.width = 64,  .height = 48, .pages = 6, .col0 = 32, .com_alt = true},
+};
+
+/*
+ * Geometry of a width x height panel: a known module, or <any> filled in.
+ * NULL if the controller cannot drive that size.
+ */
+const ssd1306_geom_t *ssd1306_geom_pick(ssd1306_geom_t *any, int width, int height) {
+  size_t i;
+
+  for (i = 0; i < sizeof(ssd1306_geoms) / sizeof(ssd1306_geoms[0]); i ++) {
+    if ((ssd1306_geoms[i].width == width) && (ssd1306_geoms[i].height == height)) {
+      return &ssd1306_geoms[i];
+    }
   }
-  if (((line % 8) != 0) || ((col % 8) != 0)) {
+
+  if ((width <= 0) || (height <= 0) || (width > 128) || (height > 64)) {
+    return NULL;
+  }
+  if (((width % 8) != 0) || ((height % 8) != 0)) {
+    return NULL;
+  }
+  any->width   = width;
+  any->height  = height;
+  any->pages   = height / 8;
+  any->col0    = 0;
+  any->com_alt = (height > 32);
+  return any;
+}
+
+/* This is how your image displays on the screen. data starts with the data header. */
+int dump_bmp(const ssd1306_geom_t *geom, const uint8_t data[]) {
+  int x, y;
+
+  if ((NULL == geom) || (NULL == data)) {
+    fprintf(stdout, "Invalid argument while calling dump_bmp().\n");
     return -EINVAL;
   }
 
-  if ((res = ssd1306_soft_reset(file)) < 0 ) {
+  fprintf(stdout, "HDR = 0x%02x\n", data[0]);
+  for (y = 0; y < geom->height; y ++) {
+    for (x = 0; x < geom->width; x ++) {
+      fputc((data[(y / 8 * geom->width) + x + 1] & (1 << (y % 8))) ? '@' : ' ', stdout);
+    }
+    fputc('\n', stdout);
+  }
+
+  fputc('\n', stdout);
+  fflush(stdout);
+  return 0;
+}
+
+int ssd1306_init(i2c_bus_t *bus, const ssd1306_geom_t *geom) {
+  int res;
+  ssd1306_cmds_t cmds;
+
+  /* NOTE: use defualts whenever we can. */
+
+  /* Reset and setup go out as one command stream. */
+  ssd1306_cmds_init(&cmds, bus);
+
+  if ((res = ssd1306_soft_reset(&cmds)) < 0 ) {
     return res;
   }
 
   /* Should be already off, just ensuring. */
-  if ((res = ssd1306_set_power(file, false)) < 0 ) {
+  if ((res = ssd1306_set_power(&cmds, false)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_set_mux_ratio(file, line)) < 0 ) {
+  if ((res = ssd1306_set_mux_ratio(&cmds, geom->height)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_set_mem_addr_mode(file, SSD1306_MEMMODE_H)) < 0 ) {
+  if ((res = ssd1306_set_com_pin(&cmds, geom->com_alt, false)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_set_segment_remap(file, true)) < 0 ) {
+  if ((res = ssd1306_set_mem_addr_mode(&cmds, SSD1306_MEMMODE_H)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_set_com_scan(file, true)) < 0 ) {
+  if ((res = ssd1306_set_segment_remap(&cmds, true)) < 0 ) {
     return res;
   }
-
-  if ((res = ssd1306_set_charge_pump(file, true)) < 0 ) {
+  if ((res = ssd1306_set_com_scan(&cmds, true)) < 0 ) {
     return res;
   }
-  if ((res = ssd1306_set_power(file, true)) < 0 ) {
+
+  if ((res = ssd1306_set_charge_pump(&cmds, true)) < 0 ) {
+    return res;
+  }
+  if ((res = ssd1306_set_power(&cmds, true)) < 0 ) {
+    return res;
+  }
+
+  return ssd1306_cmds_flush(&cmds);
+}
+
+
+/******************************************************************************
+ * Display context.
+ * Holds the bus, the geometry, a framebuffer and the shadow of GDDRAM.
+ *
+ * The framebuffer uses the controller's own layout, so drawing goes straight
+ * into it and it is sent as is: page-major, one row of <width> bytes per page,
+ * each byte a 1x8 column of pixels with bit 0 at the top. Pixel (x, y) lives
+ * in fb[(y / 8) * width + x], bit y % 8.
+ *
+ * The shadow is what the panel currently shows. A new frame only sends the
+ * bytes that changed, through a col/page address window: either one window
+ * per dirty page or one bounding window over all of them, whichever costs
+ * fewer bytes on the wire; a full frame is sent when that is cheaper still.
+ *
+ * With the pipeline started, the diff of a frame is staged into one of two
+ * preallocated batches and handed to the async worker of libui2c, which
+ * transmits it while the caller renders and diffs the next frame into the
+ * other batch. A batch is only reused once the worker has finished it.
+ * Panels on one adapter may share its worker (see video walls below).
+ *****************************************************************************/
+
+#define SSD1306_PAGES_MAX (8)
+#define SSD1306_COLS_MAX  (128)
+#define SSD1306_GDDRAM    (SSD1306_PAGES_MAX * SSD1306_COLS_MAX)
+
+/* Approximate wire cost in bytes: START + address + STOP per transaction, command stream for a window. */
+#define SSD1306_COST_TXN  (2)
+#define SSD1306_COST_WIN  (SSD1306_COST_TXN + 1 + 6)
+
+/* Most windows in one frame: precomputed deltas may have several per page. */
+#define SSD1306_SPANS_MAX   (32)
+
+/* A window is a 7-byte command stream and a data header besides its pixels. */
+#define SSD1306_BATCH_REQS  (2 * SSD1306_SPANS_MAX)
+#define SSD1306_BATCH_BYTES (SSD1306_GDDRAM + SSD1306_SPANS_MAX * 8)
+
+typedef struct {
+  i2c_req_t req[SSD1306_BATCH_REQS];
+  int nreq;
+  int pending;                      /* Submitted, not yet reaped */
+  int error;                        /* First failure among them */
+  size_t used;
+  uint8_t data[SSD1306_BATCH_BYTES];
+} ssd1306_batch_t;
+
+typedef struct {
+  i2c_bus_t *bus;
+  const ssd1306_geom_t *geom;       /* Of the panel */
+  ssd1306_geom_t any;               /* Unless a known module fits */
+  int width;
+  int height;
+  bool valid;                       /* gddram matches the panel */
+  unsigned long updates;            /* Frames sent, tells whether gddram is still a given frame */
+  i2c_async_t *async;               /* Pipeline, NULL to write synchronously */
+  bool own;                         /* async is ours, not shared with other panels */
+  int addr;                         /* Selected at open, the worker selects it per request */
+  int error;                        /* First failure reported by the worker */
+  int cur;                          /* Batch being staged */
+  ssd1306_batch_t batch[2];
+  uint8_t *fb;                      /* Next frame, drawn into by the primitives */
+  uint8_t frame[SSD1306_GDDRAM + 1];  /* Data header + fb */
+  uint8_t gddram[SSD1306_GDDRAM];   /* Shadow of the panel */
+  uint8_t buf[SSD1306_GDDRAM + 1];  /* Outgoing data, buf[0] is the data header */
+} ssd1306_t;
+
+/* Pixel operations */
+#define SSD1306_OFF (0)
+#define SSD1306_ON  (1)
+#define SSD1306_XOR (2)
+
+int ssd1306_open(ssd1306_t *ssd, i2c_bus_t *bus, int width, int height) {
+  int res;
+
+  if ((NULL == ssd) || (NULL == bus)) {
+    return -EFAULT;
+  }
+  if (NULL == (ssd->geom = ssd1306_geom_pick(&ssd->any, width, height))) {
+    return -EINVAL;
+  }
+  if ((res = ssd1306_init(bus, ssd->geom)) < 0) {
+    return res;
+  }
+
+  ssd->bus    = bus;
+  ssd->addr   = bus->addr;
+  ssd->width  = width;
+  ssd->height = height;
+  ssd->valid  = false;
+  ssd->updates = 0;
+  ssd->async  = NULL;
+  ssd->error  = 0;
+  ssd->buf[0] = SSD1306_CONT_DATA_HDR;
+  ssd->frame[0] = SSD1306_CONT_DATA_HDR;
+  ssd->fb = &ssd->frame[1];
+  memset(ssd->fb, 0, SSD1306_GDDRAM);
+
+  return 0;
+}
+
+/* Forget what the panel shows, e.g. after a reset; next update sends everything. */
+void ssd1306_invalidate(ssd1306_t *ssd) {
+  ssd->valid = false;
+}
+
+/* Waits until the worker is done with the batch. */
+static int ssd1306_batch_reap(ssd1306_t *ssd, ssd1306_batch_t *batch) {
+  ssd1306_batch_t *done;
+  i2c_req_t *req;
+  int res;
+
+  while (batch->pending > 0) {
+    if ((res = i2c_async_wait(ssd->async, &req)) < 0) {
+      return res;
+    }
+    /* In submission order, possibly for another panel on a shared worker. */
+    done = req->priv;
+    done->pending --;
+    if ((req->res < 0) && (0 == done->error)) {
+      done->error = req->res;
+    }
+  }
+
+  if ((0 != batch->error) && (0 == ssd->error)) {
+    ssd->error = batch->error;
+  }
+  batch->error = 0;
+  batch->nreq = 0;
+  batch->used = 0;
+  return 0;
+}
+
+/* Pipelines through the worker of the panel's adapter, which may be shared. */
+int ssd1306_pipeline_attach(ssd1306_t *ssd, i2c_async_t *async) {
+  if (NULL != ssd->async) {
+    return -EBUSY;
+  }
+
+  ssd->async = async;
+  ssd->own   = false;
+  ssd->cur   = 0;
+  bzero(ssd->batch, sizeof(ssd->batch));
+  return 0;
+}
+
+int ssd1306_pipeline_start(ssd1306_t *ssd) {
+  i2c_async_t *async;
+  int res;
+
+  if (NULL != ssd->async) {
+    return 0;
+  }
+  if ((res = i2c_async_start(&async, ssd->bus, 2 * SSD1306_BATCH_REQS)) < 0) {
+    return res;
+  }
+
+  ssd1306_pipeline_attach(ssd, async);
+  ssd->own = true;
+  return 0;
+}
+
+/* Waits for everything in flight. Call before touching the bus directly. */
+int ssd1306_sync(ssd1306_t *ssd) {
+  int res, i;
+
+  if (NULL == ssd->async) {
+    return 0;
+  }
+
+  for (i = 0; i < 2; i ++) {
+    if ((res = ssd1306_batch_reap(ssd, &ssd->batch[ssd->cur ^ 1 ^ i])) < 0) {
+      return res;
+    }
+  }
+  if (0 != (res = ssd->error)) {
+    ssd->error = 0;
+    ssd->valid = false;
+  }
+  return res;
+}
+
+int ssd1306_pipeline_stop(ssd1306_t *ssd) {
+  int res;
+
+  if (NULL == ssd->async) {
+    return 0;
+  }
+
+  res = ssd1306_sync(ssd);
+  if (ssd->own) {
+    i2c_async_stop(ssd->async);
+  }
+  ssd->async = NULL;
+  return res;
+}
+
+/* Where the next <len> outgoing bytes are to be put. */
+static uint8_t *ssd1306_out(ssd1306_t *ssd, size_t len) {
+  ssd1306_batch_t *batch = &ssd->batch[ssd->cur];
+
+  if (NULL == ssd->async) {
+    return ssd->buf;
+  }
+  return (batch->used + len <= sizeof(batch->data)) ? &batch->data[batch->used] : NULL;
+}
+
+/* Writes <len> bytes from ssd1306_out(), or queues them when pipelined. */
+static int ssd1306_out_commit(ssd1306_t *ssd, uint8_t data[], size_t len) {
+  ssd1306_batch_t *batch = &ssd->batch[ssd->cur];
+  i2c_req_t *req;
+
+  if (NULL == ssd->async) {
+    return i2c_write_bulk(ssd->bus, data, len);
+  }
+  if (batch->nreq >= SSD1306_BATCH_REQS) {
+    return -ENOBUFS;
+  }
+
+  req = &batch->req[batch->nreq ++];
+  bzero(req, sizeof(*req));
+  req->op   = I2C_OP_WRITE_BULK;
+  req->addr = ssd->addr;
+  req->data = data;
+  req->len  = len;
+  req->priv = batch;
+  batch->used += len;
+
+  return 0;
+}
+
+/* Hands the staged batch to the worker and frees up the other one. */
+static int ssd1306_out_submit(ssd1306_t *ssd) {
+  ssd1306_batch_t *batch = &ssd->batch[ssd->cur];
+  int res, i;
+
+  if (NULL == ssd->async) {
+    return 0;
+  }
+
+  for (i = 0; i < batch->nreq; i ++) {
+    /* Sized so that it never fills up */
+    if ((res = i2c_async_submit(ssd->async, &batch->req[i])) < 0) {
+      return res;
+    }
+    batch->pending ++;
+  }
+
+  ssd->cur ^= 1;
+  if ((res = ssd1306_batch_reap(ssd, &ssd->batch[ssd->cur])) < 0) {
+    return res;
+  }
+  if (0 != (res = ssd->error)) {
+    ssd->error = 0;
+  }
+  return res;
+}
+
+/* Sends a command list in order with the data around it. */
+static int ssd1306_out_cmds(ssd1306_t *ssd, const ssd1306_cmds_t *cmds) {
+  uint8_t *out;
+
+  if (NULL == (out = ssd1306_out(ssd, cmds->len + 1))) {
+    return -ENOBUFS;
+  }
+  memcpy(out, cmds->buf, cmds->len + 1);
+  return ssd1306_out_commit(ssd, out, cmds->len + 1);
+}
+
+/* Sends the rectangle [c0, c1] x [p0, p1] of frame and records it in the shadow. */
+static int ssd1306_send_window(ssd1306_t *ssd, const uint8_t frame[], int c0, int c1, int p0, int p1) {
+  ssd1306_cmds_t cmds;
+  size_t n = 1, w = c1 - c0 + 1;
+  uint8_t *out;
+  int res, p;
+
+  ssd1306_cmds_init(&cmds, ssd->bus);
+  if (((res = ssd1306_set_col_addr(&cmds, ssd->geom->col0 + c0, ssd->geom->col0 + c1)) < 0) || ((res = ssd1306_set_page_addr(&cmds, p0, p1)) < 0)) {
+    return res;
+  }
+  if ((res = ssd1306_out_cmds(ssd, &cmds)) < 0) {
+    return res;
+  }
+
+  if ((NULL == ssd->async) && (0 == p0) && (0 == c0) && (ssd->width - 1 == c1)) {
+    /* Contiguous from the header on, no need to gather. */
+    res = i2c_write_data(ssd->bus, frame - 1, 1 + (p1 + 1) * w);
+  } else {
+    if (NULL == (out = ssd1306_out(ssd, 1 + (p1 - p0 + 1) * w))) {
+      return -ENOBUFS;
+    }
+    out[0] = SSD1306_CONT_DATA_HDR;
+    for (p = p0; p <= p1; p ++) {
+      memcpy(&out[n], &frame[p * ssd->width + c0], w);
+      n += w;
+    }
+    res = ssd1306_out_commit(ssd, out, n);
+  }
+  if (res < 0) {
+    return res;
+  }
+  for (p = p0; p <= p1; p ++) {
+    memcpy(&ssd->gddram[p * ssd->width + c0], &frame[p * ssd->width + c0], w);
+  }
+  return 0;
+}
+
+/*
+ * Stages the windows that turn the shadow into frame: written right away
+ * without the pipeline, batched for ssd1306_out_submit() with it. Returns 1
+ * if there was anything to send.
+ */
+static int ssd1306_stage(ssd1306_t *ssd, const uint8_t frame[]) {
+  int first[SSD1306_PAGES_MAX], last[SSD1306_PAGES_MAX];
+  int pages, p, p0 = -1, p1 = -1, c0 = INT_MAX, c1 = -1;
+  size_t cost_full, cost_rect, cost_pages = 0;
+  int res = 0;
+
+  pages = ssd->geom->pages;
+  cost_full = SSD1306_COST_WIN + SSD1306_COST_TXN + 1 + pages * ssd->width;
+  ssd->updates ++;
+  if (!ssd->valid) {
+    if ((res = ssd1306_send_window(ssd, frame, 0, ssd->width - 1, 0, pages - 1)) < 0) {
+      return res;
+    }
+    ssd->valid = true;
+    return 1;
+  }
+
+  /* Dirty span of every page */
+  if (0 == ssd1306_dirty(ssd->geom, ssd->gddram, frame, first, last)) {
+    return 0;
+  }
+  for (p = 0; p < pages; p ++) {
+    if (first[p] < 0) {
+      continue;
+    }
+    cost_pages += SSD1306_COST_WIN + SSD1306_COST_TXN + 1 + last[p] - first[p] + 1;
+    if (p0 < 0) {
+      p0 = p;
+    }
+    p1 = p;
+    c0 = (first[p] < c0) ? first[p] : c0;
+    c1 = (last[p]  > c1) ? last[p]  : c1;
+  }
+
+  cost_rect = SSD1306_COST_WIN + SSD1306_COST_TXN + 1 + (p1 - p0 + 1) * (c1 - c0 + 1);
+
+  if ((cost_full <= cost_rect) && (cost_full <= cost_pages)) {
+    res = ssd1306_send_window(ssd, frame, 0, ssd->width - 1, 0, pages - 1);
+  } else if (cost_rect <= cost_pages) {
+    res = ssd1306_send_window(ssd, frame, c0, c1, p0, p1);
+  } else {
+    for (p = p0; (p <= p1) && (res >= 0); p ++) {
+      if (first[p] >= 0) {
+        res = ssd1306_send_window(ssd, frame, first[p], last[p], p, p);
+      }
+    }
+  }
+
+  return (res < 0) ? res : 1;
+}
+
+/*
+ * frame holds width * height / 8 bytes in framebuffer layout and must be
+ * preceded by the data header (frame[-1] == SSD1306_CONT_DATA_HDR), so full
+ * frames go out without copying.
+ */
+int ssd1306_update(ssd1306_t *ssd, const uint8_t frame[]) {
+  int res;
+
+  if ((NULL == ssd) || (NULL == frame)) {
+    return -EFAULT;
+  }
+
+  if ((res = ssd1306_stage(ssd, frame)) > 0) {
+    /* Pipelined, this reports failures of an earlier frame. */
+    res = ssd1306_out_submit(ssd);
+  }
+  if (res < 0) {
+    /* Unknown how much made it to the panel */
+    ssd->valid = false;
+  }
+  return res;
+}
+
+/* Sends the framebuffer. */
+int ssd1306_display(ssd1306_t *ssd) {
+  return ssd1306_update(ssd, ssd->fb);
+}
+
+
+/*
+ * Precomputed deltas: the bytes that differ between two known frames, as
+ * single-page spans. Equal runs shorter than the cost of another window are
+ * kept inside a span. If that leaves more than <max> spans, the tolerated gap
+ * is doubled until it does not. Returns the number of spans, or
+ * SSD1306_DELTA_FULL when a full frame costs fewer bytes on the wire.
+ */
+
+#define SSD1306_DELTA_FULL (0xffff)
+#define SSD1306_COST_SPAN  (SSD1306_COST_WIN + SSD1306_COST_TXN + 1)
+
+typedef struct {
+  uint8_t page;
+  uint8_t col;
+  uint8_t len;
+} ssd1306_span_t;
+
+int ssd1306_delta(const uint8_t prev[], const uint8_t cur[], int width, int height, ssd1306_span_t spans[], int max) {
+  int gap, n, p, c, last, start;
+  size_t cost;
+
+  /* Terminates: once gap spans the width there is one span per page at most. */
+  for (gap = SSD1306_COST_SPAN; ; gap *= 2) {
+    n    = 0;
+    cost = 0;
+    for (p = 0; (p < height / 8) && (n <= max); p ++) {
+      const uint8_t *a = &prev[p * width], *b = &cur[p * width];
+
+      for (c = 0; c < width; c ++) {
+        if (a[c] == b[c]) {
+          continue;
+        }
+        /* Extend over equal runs shorter than <gap> */
+        for (start = last = c; (c < width) && (c - last <= gap); c ++) {
+          if (a[c] != b[c]) {
+            last = c;
+          }
+        }
+        c = last;
+        if (n < max) {
+          spans[n].page = p;
+          spans[n].col  = start;
+          spans[n].len  = last - start + 1;
+        }
+        n ++;
+        cost += SSD1306_COST_SPAN + last - start + 1;
+      }
+    }
+    if ((n <= max) || (gap > width)) {
+      break;
+    }
+  }
+
+  return ((n > max) || (cost >= SSD1306_COST_SPAN + (size_t)width * height / 8)) ? SSD1306_DELTA_FULL : n;
+}
+
+/*
+ * Sends <frame> when the panel is known to show the frame the spans were
+ * computed against. frame is in ssd1306_update() layout.
+ */
+int ssd1306_update_delta(ssd1306_t *ssd, const uint8_t frame[], const ssd1306_span_t spans[], int n) {
+  int res = 0, i;
+
+  if (SSD1306_DELTA_FULL == n) {
+    res = ssd1306_send_window(ssd, frame, 0, ssd->width - 1, 0, ssd->height / 8 - 1);
+  } else {
+    for (i = 0; (i < n) && (res >= 0); i ++) {
+      res = ssd1306_send_window(ssd, frame, spans[i].col, spans[i].col + spans[i].len - 1, spans[i].page, spans[i].page);
+    }
+  }
+  if (res >= 0) {
+    res = ssd1306_out_submit(ssd);
+  }
+
+  ssd->updates ++;
+  if (res < 0) {
+    ssd->valid = false;
+  }
+  return res;
+}
+
+
+/* Drawing. Everything is clipped to the screen. */
+
+static inline void ssd1306_apply(uint8_t *byte, uint8_t mask, int op) {
+  switch (op) {
+    case SSD1306_OFF: {
+      *byte &= ~mask;
+      break;
+    }
+    case SSD1306_ON: {
+      *byte |= mask;
+      break;
+    }
+    default: {
+      *byte ^= mask;
+      break;
+    }
+  }
+}
+
+void ssd1306_clear(ssd1306_t *ssd, int op) {
+  int i;
+
+  if (SSD1306_XOR == op) {
+    for (i = 0; i < ssd->width * ssd->height / 8; i ++) {
+      ssd->fb[i] ^= 0xff;
+    }
+  } else {
+    memset(ssd->fb, (SSD1306_ON == op) ? 0xff : 0x00, ssd->width * ssd->height / 8);
+  }
+}
+
+void ssd1306_pixel(ssd1306_t *ssd, int x, int y, int op) {
+  if ((x < 0) || (y < 0) || (x >= ssd->width) || (y >= ssd->height)) {
+    return;
+  }
+  ssd1306_apply(&ssd->fb[(y / 8) * ssd->width + x], 1 << (y % 8), op);
+}
+
+/* Works a page at a time: one mask covers all rows of the box within the page. */
+void ssd1306_fill(ssd1306_t *ssd, int x, int y, int w, int h, int op) {
+  int x1 = x + w, y1 = y + h, p, p0, p1, c;
+  uint8_t mask, *row;
+
+  x  = (x < 0) ? 0 : x;
+  y  = (y < 0) ? 0 : y;
+  x1 = (x1 > ssd->width)  ? ssd->width  : x1;
+  y1 = (y1 > ssd->height) ? ssd->height : y1;
+  if ((x >= x1) || (y >= y1)) {
+    return;
+  }
+
+  p0 = y / 8;
+  p1 = (y1 - 1) / 8;
+  for (p = p0; p <= p1; p ++) {
+    mask = 0xff;
+    if (p == p0) {
+      mask &= 0xff << (y % 8);
+    }
+    if (p == p1) {
+      mask &= 0xff >> (7 - (y1 - 1) % 8);
+    }
+
+    row = &ssd->fb[p * ssd->width];
+    for (c = x; c < x1; c ++) {
+      ssd1306_apply(&row[c], mask, op);
+    }
+  }
+}
+
+void ssd1306_hline(ssd1306_t *ssd, int x, int y, int w, int op) {
+  ssd1306_fill(ssd, x, y, w, 1, op);
+}
+
+void ssd1306_vline(ssd1306_t *ssd, int x, int y, int h, int op) {
+  ssd1306_fill(ssd, x, y, 1, h, op);
+}
+
+/* Outline only, corners are drawn once so XOR works. */
+void ssd1306_rect(ssd1306_t *ssd, int x, int y, int w, int h, int op) {
+  if ((w <= 0) || (h <= 0)) {
+    return;
+  }
+
+  ssd1306_hline(ssd, x, y, w, op);
+  if (h > 1) {
+    ssd1306_hline(ssd, x, y + h - 1, w, op);
+  }
+  if (h > 2) {
+    ssd1306_vline(ssd, x, y + 1, h - 2, op);
+    if (w > 1) {
+      ssd1306_vline(ssd, x + w - 1, y + 1, h - 2, op);
+    }
+  }
+}
+
+/*
+ * Copies a w x h image in framebuffer layout (page-major, (h + 7) / 8 pages of
+ * w bytes) to (x, y). Source pages are shifted by y % 8 and straddle two
+ * framebuffer pages at most; pixels outside the image are left untouched.
+ */
+void ssd1306_blit(ssd1306_t *ssd, int x, int y, const uint8_t src[], int w, int h) {
+  int pages = (h + 7) / 8, dp0, shift, sp, dp, c, x0, x1;
+  uint8_t mask, v;
+
+  if ((NULL == src) || (w <= 0) || (h <= 0)) {
+    return;
+  }
+
+  x0 = (x < 0) ? -x : 0;
+  x1 = (x + w > ssd->width) ? ssd->width - x : w;
+  if (x0 >= x1) {
+    return;
+  }
+
+  /* Floor division, y may be negative */
+  dp0   = (y >= 0) ? (y / 8) : -((7 - y) / 8);
+  shift = y - dp0 * 8;
+
+  for (sp = 0; sp < pages; sp ++) {
+    mask = ((sp == pages - 1) && ((h % 8) != 0)) ? (0xff >> (8 - h % 8)) : 0xff;
+
+    dp = dp0 + sp;
+    if ((dp >= 0) && (dp < ssd->height / 8)) {
+      uint8_t m = mask << shift, *row = &ssd->fb[dp * ssd->width];
+
+      for (c = x0; c < x1; c ++) {
+        v = src[sp * w + c] << shift;
+        row[x + c] = (row[x + c] & ~m) | (v & m);
+      }
+    }
+
+    dp ++;
+    if ((0 != shift) && (dp >= 0) && (dp < ssd->height / 8)) {
+      uint8_t m = mask >> (8 - shift), *row = &ssd->fb[dp * ssd->width];
+
+      for (c = x0; c < x1; c ++) {
+        v = src[sp * w + c] >> (8 - shift);
+        row[x + c] = (row[x + c] & ~m) | (v & m);
+      }
+    }
+  }
+}
+
+/*
+ * Text from a libfont atlas, one line per font height. Glyph cells are
+ * opaque; tops on a page boundary (y % 8 == 0) are plain copies.
+ */
+void ssd1306_text(ssd1306_t *ssd, int x, int y, const font_t *font, const char *s) {
+  for (; NULL != s; y += font->height) {
+    font_draw(font, ssd->fb, ssd->width, ssd->height, x, y, s);
+    if (NULL != (s = strchr(s, '\n'))) {
+      s ++;
+    }
+  }
+}
+
+#define GET_BIT(x, n) ((x) >> (n) & 0x01)
+
+/*
+ * PNG packs 8 horizontal pixels per byte, MSB leftmost. GDDRAM wants 8
+ * vertical pixels per byte, LSB on top. Converting one 8x8 block is a bit
+ * matrix transpose.
+ *
+ * The block is loaded as a 64-bit word with row r in byte r and transposed in
+ * three rounds of masked swaps (2x2, then 4x4, then 8x8 sub-blocks), see
+ * Hacker's Delight 7-3. Byte 7 - i of the result is column i.
+ */
+static inline uint64_t ssd1306_transpose8(uint64_t x) {
+  uint64_t t;
+
+  t = (x ^ (x >> 7))  & 0x00aa00aa00aa00aaULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+  x = x ^ t ^ (t << 28);
+
+  return x;
+}
+
+/* Packs 8 PNG rows of <bpr> bytes into one page of 8 * <bpr> bytes. */
+static void ssd1306_pack_page(png_bytep rows[8], size_t bpr, uint8_t page[]) {
+  size_t b;
+  uint64_t x;
+  int i;
+
+  for (b = 0; b < bpr; b ++) {
+    x = (uint64_t)rows[0][b]       | (uint64_t)rows[1][b] << 8
+      | (uint64_t)rows[2][b] << 16 | (uint64_t)rows[3][b] << 24
+      | (uint64_t)rows[4][b] << 32 | (uint64_t)rows[5][b] << 40
+      | (uint64_t)rows[6][b] << 48 | (uint64_t)rows[7][b] << 56;
+    x = ssd1306_transpose8(x);
+
+    for (i = 0; i < 8; i ++) {
+      page[b * 8 + i] = x >> (8 * (7 - i));
+    }
+  }
+}
+
+/* Bit at a time, the reference for --bench. */
+static void ssd1306_pack_page_ref(png_bytep rows[8], size_t bpr, uint8_t page[]) {
+  size_t x;
+
+  for (x = 0; x < bpr * 8; x ++) {
+    page[x] = (GET_BIT(rows[0][x / 8], 7 - (x % 8)) << 0) | (GET_BIT(rows[1][x / 8], 7 - (x % 8)) << 1)
+            | (GET_BIT(rows[2][x / 8], 7 - (x % 8)) << 2) | (GET_BIT(rows[3][x / 8], 7 - (x % 8)) << 3)
+            | (GET_BIT(rows[4][x / 8], 7 - (x % 8)) << 4) | (GET_BIT(rows[5][x / 8], 7 - (x % 8)) << 5)
+            | (GET_BIT(rows[6][x / 8], 7 - (x % 8)) << 6) | (GET_BIT(rows[7][x / 8], 7 - (x % 8)) << 7);
+  }
+}
+
+/******************************************************************************
+ * Streaming PNG decoder.
+ * Sprite sheets are <col> pixels wide and a multiple of <line> pixels high,
+ * one frame below the other. Rows are pulled from libpng 8 at a time into a
+ * fixed scratch and transposed straight into the caller's frame, so memory
+ * use does not depend on the length of the sheet.
+ *
+ * Black and white (1-bit gray) images are used as they are. Anything else,
+ * palette images of any depth included, is decoded to gray or RGBA rows,
+ * which are turned to luma and binarized on the way, by threshold, ordered
+ * (Bayer 8x8) dithering or Floyd-Steinberg error diffusion. Dithering
+ * restarts on every frame, so frames stay independent.
+ *****************************************************************************/
+
+#define SSD1306_DITHER_THRESHOLD (0)
+#define SSD1306_DITHER_BAYER     (1)
+#define SSD1306_DITHER_FS        (2)
+
+/* Conversion of images that are not black and white, --dither. */
+int ssd1306_png_dither = SSD1306_DITHER_FS;
+
+typedef struct {
+  FILE *fp;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int width;
+  int height;
+  int line;                   /* Frame height */
+  int y;                      /* Next row to decode */
+  int channels;               /* Of decoded rows: 0 (packed 1-bit), 1 (gray) or 4 (RGBA) */
+  int dither;
+  png_byte scratch[8][SSD1306_COLS_MAX / 8];
+  png_byte pixels[SSD1306_COLS_MAX * 4];
+  int16_t err[2][SSD1306_COLS_MAX + 2];  /* Floyd-Steinberg, in 1/16: this row and the next */
+} ssd1306_png_t;
+
+/*
+ * Conversion kernels, in GCC vector extensions: SSE2 or NEON where there is
+ * one, word operations elsewhere. Rows are a multiple of 8 pixels.
+ */
+typedef uint8_t  ssd1306_u8x16 __attribute__((vector_size(16)));
+typedef uint16_t ssd1306_u16x8 __attribute__((vector_size(16)));
+typedef uint32_t ssd1306_u32x4 __attribute__((vector_size(16)));
+typedef uint8_t  ssd1306_u8x4  __attribute__((vector_size(4)));
+
+static const uint8_t ssd1306_bayer8[8][8] = {
+  { 0, 32,  8, 40,  2, 34, 10, 42},
+  {48, 16, 56, 24, 50, 18, 58, 26},
+  {12, 44,  4, 36, 14, 46,  6, 38},
+  {60, 28, 52, 20, 62, 30, 54, 22},
+  { 3, 35, 11, 43,  1, 33,  9, 41},
+  {51, 19, 59, 27, 49, 17, 57, 25},
+  {15, 47,  7, 39, 13, 45,  5, 37},
+  {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+/*
+ * BT.601 luma of RGBA pixels, alpha is ignored. Products are 16-bit, which
+ * every SIMD has: R and B of a pixel share one 32-bit lane, G and A another.
+ */
+static void ssd1306_luma_rgba(const uint8_t rgba[], size_t n, uint8_t luma[]) {
+  const ssd1306_u16x8 krb = {77, 29, 77, 29, 77, 29, 77, 29}, kga = {150, 0, 150, 0, 150, 0, 150, 0};
+  ssd1306_u32x4 p, rb, ga, y;
+  ssd1306_u8x4 l;
+  size_t i;
+
+  for (i = 0; i < n; i += 4) {
+    memcpy(&p, &rgba[i * 4], sizeof(p));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    rb = (p >> 8) & 0x00ff00ff;
+    ga = p & 0x00ff00ff;
+#else
+    rb = p & 0x00ff00ff;
+    ga = (p >> 8) & 0x00ff00ff;
+#endif
+    /* R * 77 + G * 150 and B * 29 in the halves of each lane, neither overflows */
+    y = (ssd1306_u32x4)((ssd1306_u16x8)rb * krb + (ssd1306_u16x8)ga * kga);
+    y = ((y & 0xffff) + (y >> 16) + 128) >> 8;
+    l = __builtin_convertvector(y, ssd1306_u8x4);
+    memcpy(&luma[i], &l, sizeof(l));
+  }
+}
+
+/* MSB of every byte, byte 0 to bit 7: each lands on its own bit of the top byte. */
+static inline uint8_t ssd1306_gather_msb(uint64_t w) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return (((w & 0x8080808080808080ULL) >> 7) * 0x8040201008040201ULL) >> 56;
+}
+
+/* Packed bits of the pixels at or above their threshold. <thr> repeats every 16 pixels. */
+static void ssd1306_binarize(const uint8_t luma[], const uint8_t thr[16], size_t n, uint8_t out[]) {
+  ssd1306_u8x16 v = {0}, t, m;
+  uint64_t w[2];
+  size_t i;
+
+  memcpy(&t, thr, sizeof(t));
+  for (i = 0; i + 16 <= n; i += 16) {
+    memcpy(&v, &luma[i], 16);
+    m = (ssd1306_u8x16)(v >= t);
+    memcpy(w, &m, sizeof(w));
+    out[i / 8]     = ssd1306_gather_msb(w[0]);
+    out[i / 8 + 1] = ssd1306_gather_msb(w[1]);
+  }
+  if (i < n) {
+    /* 8 left */
+    memcpy(&v, &luma[i], 8);
+    m = (ssd1306_u8x16)(v >= t);
+    memcpy(w, &m, sizeof(w));
+    out[i / 8] = ssd1306_gather_msb(w[0]);
+  }
+}
+
+/* Pixel at a time, the reference for --bench. */
+static void ssd1306_binarize_rgba_ref(const uint8_t rgba[], const uint8_t thr[16], size_t n, uint8_t out[]) {
+  size_t x;
+  int y;
+
+  bzero(out, n / 8);
+  for (x = 0; x < n; x ++) {
+    y = (rgba[x * 4] * 77 + rgba[x * 4 + 1] * 150 + rgba[x * 4 + 2] * 29 + 128) >> 8;
+    if (y >= thr[x % 16]) {
+      out[x / 8] |= 0x80 >> (x % 8);
+    }
+  }
+}
+
+/* One row of Floyd-Steinberg. <cur> and <nxt> have one guard entry at each end. */
+static void ssd1306_dither_fs(const uint8_t luma[], int16_t cur[], int16_t nxt[], size_t n, uint8_t out[]) {
+  size_t x;
+  int v, e;
+
+  bzero(nxt, (n + 2) * sizeof(nxt[0]));
+  bzero(out, n / 8);
+  for (x = 0; x < n; x ++) {
+    v = luma[x] + cur[x + 1] / 16;
+    if (v >= 0x80) {
+      out[x / 8] |= 0x80 >> (x % 8);
+      e = v - 0xff;
+    } else {
+      e = v;
+    }
+    cur[x + 2] += e * 7;
+    nxt[x]     += e * 3;
+    nxt[x + 1] += e * 5;
+    nxt[x + 2] += e;
+  }
+}
+
+static void ssd1306_png_destroy(ssd1306_png_t *png) {
+  png_destroy_read_struct(&png->png_ptr, &png->info_ptr, NULL);
+  fclose(png->fp);
+  png->fp = NULL;
+}
+
+/* <luma>: rows are decoded for ssd1306_png_luma() even from 1-bit gray images. */
+static int ssd1306_png_start(ssd1306_png_t *png, const char *path, int col, int line, bool luma) {
+  png_byte type;
+  uint8_t header[8];
+
+  if ((NULL == png) || (NULL == path)) {
+    return -EINVAL;
+  }
+  if ((line <= 0) || (col <= 0)) {
+    return -EINVAL;
+  }
+  if ((line > 64) || (col > 128)) {
+    return -EINVAL;
+  }
+  if (((line % 8) != 0) || ((col % 8) != 0)) {
+    return -EINVAL;
+  }
+
+  bzero(png, sizeof(*png));
+  if (NULL == (png->fp = fopen(path, "rb"))) {
+    perror("fopen");
+    return -EIO;
+  }
+
+  if ((8 != fread(header, 1, 8, png->fp)) || (0 != png_sig_cmp(header, 0, 8))) {
+    fprintf(stderr, "ERROR: %s is not a PNG image!\n", path);
+    fclose(png->fp);
+    return -ENOENT;
+  }
+
+  if (NULL == (png->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL))) {
+    perror("png_create_read_struct");
+    fclose(png->fp);
+    return -ENOMEM;
+  }
+
+  if (NULL == (png->info_ptr = png_create_info_struct(png->png_ptr))) {
+    perror("png_create_info_struct");
+    ssd1306_png_destroy(png);
+    return -ENOMEM;
+  }
+
+  /*
+   * NOTE: libpng is efficient but quite dirty.
+   * If any error happens afterwards, program will return to this point with an
+   * non-zero return value.
+   */
+  if (0 != setjmp(png_jmpbuf(png->png_ptr))) {
+    fputs("ERROR: libpng, init\n", stderr);
+    ssd1306_png_destroy(png);
+    return -EIO;
+  }
+
+  png_init_io(png->png_ptr, png->fp);
+  png_set_sig_bytes(png->png_ptr, 8);
+
+  png_read_info(png->png_ptr, png->info_ptr);
+
+  png->width  = png_get_image_width(png->png_ptr, png->info_ptr);
+  png->height = png_get_image_height(png->png_ptr, png->info_ptr);
+  png->line   = line;
+
+  /* Interlaced images only complete on the last pass, which defeats streaming. */
+  if (PNG_INTERLACE_NONE != png_get_interlace_type(png->png_ptr, png->info_ptr)) {
+    fputs("ERROR: interlaced images are not supported!\n", stderr);
+    ssd1306_png_destroy(png);
+    return -ENOENT;
+  }
+  if ((png->width != col) || ((png->height % line) != 0)) {
+    fprintf(stderr, "ERROR: image size %d x %d mismatches the screen!\n", png->width, png->height);
+    ssd1306_png_destroy(png);
+    return -ENOENT;
+  }
+
+  png->dither = ssd1306_png_dither;
+  type = png_get_color_type(png->png_ptr, png->info_ptr);
+  /* Only 1-bit gray is pixels already, 1-bit palette images are indices. */
+  if (luma || (PNG_COLOR_TYPE_GRAY != type) || (1 != png_get_bit_depth(png->png_ptr, png->info_ptr))) {
+    if (PNG_COLOR_TYPE_PALETTE == type) {
+      png_set_palette_to_rgb(png->png_ptr);
+    }
+    png_set_expand_gray_1_2_4_to_8(png->png_ptr);
+    png_set_strip_16(png->png_ptr);
+    if (0 != (type & PNG_COLOR_MASK_COLOR)) {
+      /* One 32-bit word per pixel for the luma kernel */
+      png_set_filler(png->png_ptr, 0xff, PNG_FILLER_AFTER);
+      png->channels = 4;
+    } else {
+      png_set_strip_alpha(png->png_ptr);
+      png->channels = 1;
+    }
+  }
+
+  png_read_update_info(png->png_ptr, png->info_ptr);
+
+  /* Bytes should be packed (8 horizontal pixels per byte), or whole pixels. */
+  if (png_get_rowbytes(png->png_ptr, png->info_ptr) != (size_t)(png->channels ? col * png->channels : col / 8)) {
+    fputs("ERROR: unexpected PNG row size!\n", stderr);
+    ssd1306_png_destroy(png);
+    return -ENOENT;
+  }
+
+  return 0;
+}
+
+int ssd1306_png_open(ssd1306_png_t *png, const char *path, int col, int line) {
+  return ssd1306_png_start(png, path, col, line, false);
+}
+
+int ssd1306_png_frames(const ssd1306_png_t *png) {
+  return png->height / png->line;
+}
+
+/* Decodes the next row to luma. Leaves error handling to the caller's setjmp(). */
+static void ssd1306_png_luma(ssd1306_png_t *png, uint8_t luma[]) {
+  if (1 == png->channels) {
+    png_read_row(png->png_ptr, luma, NULL);
+  } else {
+    png_read_row(png->png_ptr, png->pixels, NULL);
+    ssd1306_luma_rgba(png->pixels, png->width, luma);
+  }
+}
+
+/* Decodes the next row, row <y> of its frame, to packed bits. */
+static void ssd1306_png_convert(ssd1306_png_t *png, int y, uint8_t out[]) {
+  uint8_t luma[SSD1306_COLS_MAX], thr[16];
+  int i;
+
+  ssd1306_png_luma(png, luma);
+  switch (png->dither) {
+    case SSD1306_DITHER_FS: {
+      if (0 == y) {
+        bzero(png->err[0], sizeof(png->err[0]));
+      }
+      ssd1306_dither_fs(luma, png->err[y & 1], png->err[(y & 1) ^ 1], png->width, out);
+      break;
+    }
+    case SSD1306_DITHER_BAYER: {
+      /* Centered in 0-255, black stays black and white stays white */
+      for (i = 0; i < 16; i ++) {
+        thr[i] = ssd1306_bayer8[y % 8][i % 8] * 4 + 2;
+      }
+      ssd1306_binarize(luma, thr, png->width, out);
+      break;
+    }
+    default: {
+      memset(thr, 0x80, sizeof(thr));
+      ssd1306_binarize(luma, thr, png->width, out);
+      break;
+    }
+  }
+}
+
+/* Decodes the next frame into <frame> (framebuffer layout). -ENODATA after the last one. */
+int ssd1306_png_read(ssd1306_png_t *png, uint8_t frame[]) {
+  png_bytep rows[8];
+  int page, r;
+
+  if (png->y >= png->height) {
+    return -ENODATA;
+  }
+
+  if (0 != setjmp(png_jmpbuf(png->png_ptr))) {
+    fputs("ERROR: libpng, reading\n", stderr);
+    return -EIO;
+  }
+
+  for (r = 0; r < 8; r ++) {
+    rows[r] = png->scratch[r];
+  }
+  for (page = 0; page < png->line / 8; page ++) {
+    for (r = 0; r < 8; r ++) {
+      if (0 == png->channels) {
+        png_read_row(png->png_ptr, rows[r], NULL);
+      } else {
+        ssd1306_png_convert(png, page * 8 + r, rows[r]);
+      }
+    }
+    ssd1306_pack_page(rows, png->width / 8, &frame[page * png->width]);
+  }
+  png->y += png->line;
+
+  return 0;
+}
+
+void ssd1306_png_close(ssd1306_png_t *png) {
+  if ((NULL != png) && (NULL != png->fp)) {
+    /* Rest of the image is not read, skip png_read_end(). */
+    ssd1306_png_destroy(png);
+  }
+}
+
+/******************************************************************************
+ * Sprite cache.
+ * A sprite sheet compiled into frames ready to be sent, so playback needs
+ * neither libpng nor a transpose, plus the delta from the previous frame of
+ * the loop so it needs no diff either. Layout:
+ *   ssd1306_cache_hdr_t
+ *   ssd1306_cache_idx_t idx[frames]
+ *   for every frame:
+ *     data header + width * height / 8 bytes
+ *     ssd1306_span_t[] against the previous frame (frame 0: the last one,
+ *                      stored after everything else)
+ * The file is mmap'd for playback and frames are handed to the write path in
+ * place. Fields are in host byte order, a cache is not meant to be portable.
+ *****************************************************************************/
+
+#define SSD1306_CACHE_MAGIC "UI2CSPR2"
+
+typedef struct {
+  char magic[8];
+  uint16_t width;
+  uint16_t height;
+  uint32_t frames;
+} ssd1306_cache_hdr_t;
+
+typedef struct {
+  uint32_t offset;            /* Frame, from the start of file */
+  uint32_t delta;             /* Spans, from the start of file */
+  uint16_t nspans;            /* Or SSD1306_DELTA_FULL */
+  uint16_t pad;
+} ssd1306_cache_idx_t;
+
+/* Appends the spans turning prev into cur, adds what they cost on the wire to <wire>. */
+static int ssd1306_cache_put_delta(FILE *fp, ssd1306_cache_idx_t *idx, const uint8_t prev[], const uint8_t cur[], int col, int line, size_t *wire) {
+  ssd1306_span_t spans[SSD1306_SPANS_MAX];
+  int n = ssd1306_delta(prev, cur, col, line, spans, SSD1306_SPANS_MAX), i;
+
+  idx->delta  = ftell(fp);
+  idx->nspans = n;
+  if (SSD1306_DELTA_FULL == n) {
+    *wire += SSD1306_COST_SPAN + col * line / 8;
+    return 0;
+  }
+  for (i = 0; i < n; i ++) {
+    *wire += SSD1306_COST_SPAN + spans[i].len;
+  }
+  if (0 == n) {
+    return 0;
+  }
+  return (1 == fwrite(spans, n * sizeof(spans[0]), 1, fp)) ? 0 : -EIO;
+}
+
+int ssd1306_cache_compile(const char *png_path, const char *path, int col, int line) {
+  ssd1306_cache_hdr_t hdr = {.magic = SSD1306_CACHE_MAGIC, .width = col, .height = line};
+  static uint8_t frames[3][SSD1306_GDDRAM + 1];  /* First, previous and current */
+  uint8_t *first = frames[0], *prev = frames[1], *cur = frames[2], *swap;
+  size_t flen = col * line / 8 + 1, full = 0, wire = 0;
+  ssd1306_cache_idx_t *idx = NULL;
+  char tmp[PATH_MAX];
+  ssd1306_png_t png;
+  uint32_t i;
+  FILE *fp;
+  int res;
+
+  if ((NULL == png_path) || (NULL == path)) {
+    return -EINVAL;
+  }
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+    return -ENAMETOOLONG;
+  }
+  if ((res = ssd1306_png_open(&png, png_path, col, line)) < 0) {
+    return res;
+  }
+  hdr.frames = ssd1306_png_frames(&png);
+  if (NULL == (idx = calloc(hdr.frames, sizeof(idx[0])))) {
+    ssd1306_png_close(&png);
+    return -ENOMEM;
+  }
+  if (NULL == (fp = fopen(tmp, "wb"))) {
+    res = -errno;
+    perror("fopen");
+    ssd1306_png_close(&png);
+    free(idx);
+    return res;
+  }
+
+  /* Index is filled in as frames go and written last. */
+  res = ((1 == fwrite(&hdr, sizeof(hdr), 1, fp)) && (0 == fseek(fp, hdr.frames * sizeof(idx[0]), SEEK_CUR))) ? 0 : -EIO;
+
+  first[0] = prev[0] = cur[0] = SSD1306_CONT_DATA_HDR;
+  for (i = 0; (i < hdr.frames) && (res >= 0); i ++) {
+    if ((res = ssd1306_png_read(&png, &cur[1])) < 0) {
+      break;
+    }
+    idx[i].offset = ftell(fp);
+    if (1 != fwrite(cur, flen, 1, fp)) {
+      res = -EIO;
+      break;
+    }
+    if (0 == i) {
+      memcpy(first, cur, flen);
+    } else {
+      res = ssd1306_cache_put_delta(fp, &idx[i], &prev[1], &cur[1], col, line, &wire);
+    }
+    swap = prev;
+    prev = cur;
+    cur  = swap;
+  }
+  /* Loop back: first frame against the last one */
+  if (res >= 0) {
+    res = ssd1306_cache_put_delta(fp, &idx[0], &prev[1], &first[1], col, line, &wire);
+  }
+  if (res >= 0) {
+    res = ((0 == fseek(fp, sizeof(hdr), SEEK_SET)) && (1 == fwrite(idx, hdr.frames * sizeof(idx[0]), 1, fp))) ? 0 : -EIO;
+  }
+  ssd1306_png_close(&png);
+
+  if ((0 != fclose(fp)) && (res >= 0)) {
+    res = -EIO;
+  }
+  /* Replace atomically, a player may have the old one open. */
+  if ((res >= 0) && (rename(tmp, path) < 0)) {
+    res = -errno;
+    perror("rename");
+  }
+  if (res < 0) {
+    unlink(tmp);
+    free(idx);
+    return res;
+  }
+
+  for (i = 0; i < hdr.frames; i ++) {
+    if (SSD1306_DELTA_FULL == idx[i].nspans) {
+      full ++;
+    }
+  }
+  fprintf(stdout, "Compiled %u frames of %d x %d into %s, %zu full frames, %zu bytes per frame on average.\n",
+          hdr.frames, col, line, path, full, (0 == hdr.frames) ? 0 : wire / hdr.frames);
+  free(idx);
+  return 0;
+}
+
+typedef struct {
+  const uint8_t *map;
+  size_t size;
+  const ssd1306_cache_hdr_t *hdr;
+  const ssd1306_cache_idx_t *idx;
+  uint32_t shown;             /* Last frame sent */
+  unsigned long shown_at;     /* ssd1306_t updates after sending it */
+} ssd1306_cache_t;
+
+/* 1 if the file is a sprite cache, 0 if not, negative on error. */
+int ssd1306_cache_probe(const char *path) {
+  char magic[8];
+  FILE *fp;
+  int res;
+
+  if (NULL == (fp = fopen(path, "rb"))) {
+    res = -errno;
+    perror("fopen");
+    return res;
+  }
+  /* Any version, open tells stale ones apart. */
+  res = ((1 == fread(magic, sizeof(magic), 1, fp)) && (0 == memcmp(magic, SSD1306_CACHE_MAGIC, sizeof(magic) - 1)));
+  fclose(fp);
+
+  return res;
+}
+
+static bool ssd1306_cache_check(const ssd1306_cache_t *cache, int col, int line) {
+  size_t flen = col * line / 8 + 1;
+  const ssd1306_cache_idx_t *idx;
+  const ssd1306_span_t *spans;
+  uint32_t i;
+  int j;
+
+  if ((0 != memcmp(cache->hdr->magic, SSD1306_CACHE_MAGIC, sizeof(cache->hdr->magic)))
+   || (cache->hdr->width != col) || (cache->hdr->height != line)
+   || (cache->hdr->frames > (cache->size - sizeof(ssd1306_cache_hdr_t)) / sizeof(ssd1306_cache_idx_t))) {
+    return false;
+  }
+
+  for (i = 0; i < cache->hdr->frames; i ++) {
+    idx = &cache->idx[i];
+    if ((idx->offset > cache->size) || (cache->size - idx->offset < flen)
+     || (SSD1306_CONT_DATA_HDR != cache->map[idx->offset])) {
+      return false;
+    }
+    if (SSD1306_DELTA_FULL == idx->nspans) {
+      continue;
+    }
+    if ((idx->nspans > SSD1306_SPANS_MAX) || (idx->delta > cache->size)
+     || (cache->size - idx->delta < idx->nspans * sizeof(ssd1306_span_t))) {
+      return false;
+    }
+    spans = (const ssd1306_span_t *)&cache->map[idx->delta];
+    for (j = 0; j < idx->nspans; j ++) {
+      if ((spans[j].page >= line / 8) || (0 == spans[j].len) || (spans[j].col + spans[j].len > col)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+int ssd1306_cache_open(ssd1306_cache_t *cache, const char *path, int col, int line) {
+  struct stat st;
+  void *map;
+  int fd, res;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    res = -errno;
+    perror("open");
+    return res;
+  }
+  if (fstat(fd, &st) < 0) {
+    res = -errno;
+    perror("fstat");
+    close(fd);
+    return res;
+  }
+  if ((size_t)st.st_size < sizeof(ssd1306_cache_hdr_t)) {
+    close(fd);
+    return -EINVAL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  res = -errno;
+  close(fd);
+  if (MAP_FAILED == map) {
+    perror("mmap");
+    return res;
+  }
+
+  cache->map      = map;
+  cache->size     = st.st_size;
+  cache->hdr      = map;
+  cache->idx      = (const ssd1306_cache_idx_t *)(cache->hdr + 1);
+  cache->shown    = 0;
+  cache->shown_at = 0;
+
+  /* Trust nothing: the file may be stale, truncated or for another panel. */
+  if (!ssd1306_cache_check(cache, col, line)) {
+    fprintf(stderr, "ERROR: %s is not a valid %d x %d sprite cache, recompile it!\n", path, col, line);
+    munmap((void *)cache->map, cache->size);
+    return -EINVAL;
+  }
+
+  madvise((void *)cache->map, cache->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+  return 0;
+}
+
+void ssd1306_cache_close(ssd1306_cache_t *cache) {
+  munmap((void *)cache->map, cache->size);
+}
+
+/* Frame i in framebuffer layout, preceded by its data header. */
+static inline const uint8_t *ssd1306_cache_frame(const ssd1306_cache_t *cache, uint32_t i) {
+  return &cache->map[cache->idx[i].offset + 1];
+}
+
+/*
+ * Sends frame i, from its precomputed delta if the panel still shows the frame
+ * before it, diffing against the shadow otherwise (first frame, dropped
+ * frames, something else drawn in between).
+ */
+static int ssd1306_cache_send(ssd1306_t *ssd, ssd1306_cache_t *cache, uint32_t i) {
+  const ssd1306_cache_idx_t *idx = &cache->idx[i];
+  uint32_t prev = (0 == i) ? (cache->hdr->frames - 1) : (i - 1);
+  int res;
+
+  if (ssd->valid && (0 != cache->shown_at) && (ssd->updates == cache->shown_at) && (cache->shown == prev)) {
+    res = ssd1306_update_delta(ssd, ssd1306_cache_frame(cache, i), (const ssd1306_span_t *)&cache->map[idx->delta], idx->nspans);
+  } else {
+    res = ssd1306_update(ssd, ssd1306_cache_frame(cache, i));
+  }
+
+  cache->shown    = i;
+  cache->shown_at = (res < 0) ? 0 : ssd->updates;
+  return res;
+}
+
+/******************************************************************************
+ * Frame scheduler.
+ * Every frame has an absolute deadline on CLOCK_MONOTONIC, one period after
+ * the previous one, and the player sleeps until it with clock_nanosleep().
+ * Deadlines do not drift with the time spent on the bus. When the bus falls
+ * behind, a frame whose slot has already passed is either dropped to keep the
+ * animation in time (SSD1306_SCHED_DROP) or shown late, with the clock
+ * re-anchored so that later frames are not rushed (SSD1306_SCHED_SLIP).
+ *
+ * Jitter is how late a frame starts against its deadline. A frame is late when
+ * it has not finished by the next deadline.
+ *****************************************************************************/
+
+#define SSD1306_SCHED_DROP    (0)
+#define SSD1306_SCHED_SLIP    (1)
+#define SSD1306_SCHED_SAMPLES (1024)  /* Most recent jitter samples kept */
+
+typedef struct {
+  int64_t period;             /* ns, 0 for as fast as the bus allows */
+  int policy;
+  int64_t start;
+  int64_t deadline;           /* Of the current frame */
+  unsigned long shown;
+  unsigned long dropped;
+  unsigned long late;
+  int64_t jitter[SSD1306_SCHED_SAMPLES];
+} ssd1306_sched_t;
+
+static int64_t ssd1306_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void ssd1306_sched_init(ssd1306_sched_t *sched, int fps, int policy) {
+  bzero(sched, sizeof(*sched));
+  sched->period   = (fps > 0) ? (1000000000 / fps) : 0;
+  sched->policy   = policy;
+  sched->start    = ssd1306_now();
+  sched->deadline = sched->start;
+}
+
+/* Waits for the current frame's deadline, false if the frame is to be dropped. */
+bool ssd1306_sched_wait(ssd1306_sched_t *sched) {
+  struct timespec ts;
+  int64_t now = ssd1306_now();
+
+  if (0 == sched->period) {
+    return true;
+  }
+
+  if (now >= sched->deadline + sched->period) {
+    if (SSD1306_SCHED_DROP == sched->policy) {
+      sched->dropped ++;
+      sched->deadline += sched->period;
+      return false;
+    }
+    sched->deadline = now;
+  }
+
+  ts.tv_sec  = sched->deadline / 1000000000;
+  ts.tv_nsec = sched->deadline % 1000000000;
+  while ((EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) && (!stop));
+
+  now = ssd1306_now();
+  sched->jitter[sched->shown % SSD1306_SCHED_SAMPLES] = (now > sched->deadline) ? (now - sched->deadline) : 0;
+  return true;
+}
+
+/* After the frame is sent, when it is to stay up for <periods> periods. */
+void ssd1306_sched_hold(ssd1306_sched_t *sched, int periods) {
+  sched->shown ++;
+  sched->deadline += periods * sched->period;
+  if ((0 != sched->period) && (ssd1306_now() > sched->deadline)) {
+    sched->late ++;
+  }
+}
+
+/* After the frame is sent. */
+void ssd1306_sched_done(ssd1306_sched_t *sched) {
+  ssd1306_sched_hold(sched, 1);
+}
+
+static int ssd1306_cmp_int64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+void ssd1306_sched_print(ssd1306_sched_t *sched, FILE *fp) {
+  size_t n = (sched->shown < SSD1306_SCHED_SAMPLES) ? sched->shown : SSD1306_SCHED_SAMPLES;
+  double secs = (ssd1306_now() - sched->start) / 1e9;
+
+  fprintf(fp, "Frames: %lu shown, %lu dropped, %lu late, %.1f fps", sched->shown, sched->dropped, sched->late, sched->shown / secs);
+  if (sched->period > 0) {
+    fprintf(fp, " (target %.1f)", 1e9 / sched->period);
+  }
+  fputc('\n', fp);
+
+  if ((sched->period > 0) && (n > 0)) {
+    qsort(sched->jitter, n, sizeof(sched->jitter[0]), ssd1306_cmp_int64);
+    fprintf(fp, "Jitter: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us (last %zu frames)\n",
+            sched->jitter[n * 50 / 100] / 1e3, sched->jitter[n * 90 / 100] / 1e3, sched->jitter[n * 99 / 100] / 1e3,
+            sched->jitter[n - 1] / 1e3, n);
+  }
+}
+
+int ssd1306_cls(ssd1306_t *ssd) {
+  /* GDDRAM may hold anything after power-up, always clear all of it. */
+  ssd1306_clear(ssd, SSD1306_OFF);
+  ssd1306_invalidate(ssd);
+  return ssd1306_display(ssd);
+}
+
+int ssd1306_send_png(ssd1306_t *ssd, char *path) {
+  ssd1306_png_t png;
+  int res;
+
+  if ((res = ssd1306_png_open(&png, path, ssd->width, ssd->height)) < 0) {
+    return res;
+  }
+  if (ssd1306_png_frames(&png) > 1) {
+    fprintf(stdout, "NOTE: image has %d frames, image is probably sprites, showing the first one.\n", ssd1306_png_frames(&png));
+  }
+
+  res = ssd1306_png_read(&png, ssd->fb);
+  ssd1306_png_close(&png);
+  if (res < 0) {
+    return res;
+  }
+
+  return ssd1306_display(ssd);
+}
+
+/* Each pass of the sprite, decoded while playing. For internal use. */
+int ssd1306_send_png_sprite_pass(ssd1306_t *ssd, char *path, ssd1306_sched_t *sched) {
+  ssd1306_png_t png;
+  int res;
+
+  if ((res = ssd1306_png_open(&png, path, ssd->width, ssd->height)) < 0) {
+    return res;
+  }
+
+  /* Dropped frames are still decoded, the decoder only goes forward. */
+  while ((!stop) && (0 == (res = ssd1306_png_read(&png, ssd->fb)))) {
+    if (!ssd1306_sched_wait(sched)) {
+      continue;
+    }
+    if ((res = ssd1306_display(ssd)) < 0) {
+      break;
+    }
+    ssd1306_sched_done(sched);
+  }
+
+  ssd1306_png_close(&png);
+  return (-ENODATA == res) ? 0 : res;
+}
+
+/* Each pass of a compiled sprite, frames are sent straight from the mapping. */
+int ssd1306_send_cache_pass(ssd1306_t *ssd, ssd1306_cache_t *cache, ssd1306_sched_t *sched) {
+  uint32_t i;
+  int res;
+
+  for (i = 0; (i < cache->hdr->frames) && (!stop); i ++) {
+    if (!ssd1306_sched_wait(sched)) {
+      continue;
+    }
+    if ((res = ssd1306_cache_send(ssd, cache, i)) < 0) {
+      return res;
+    }
+    ssd1306_sched_done(sched);
+  }
+
+  return 0;
+}
+
+/*
+ * Plays a PNG sprite sheet or a sprite cache compiled from one at <fps>
+ * frames per second, or as fast as the bus allows with fps == 0.
+ * NOTE:
+ * loop == 0: loop forever until killed by signal.
+ * loop == 1: no loop, single pass.
+ */
+int ssd1306_send_png_sprite(ssd1306_t *ssd, char *path, int fps, int policy, int loop) {
+  int res = 0, cached;
+  struct sigaction sia;
+  ssd1306_cache_t cache;
+  ssd1306_sched_t sched;
+
+  if ((fps < 0) || (fps > 1000000) || (loop < 0) || (NULL == path)) {
+    return -EINVAL;
+  }
+
+  if ((cached = ssd1306_cache_probe(path)) < 0) {
+    return cached;
+  }
+  if (cached && ((res = ssd1306_cache_open(&cache, path, ssd->width, ssd->height)) < 0)) {
+    return res;
+  }
+
+  /* Setup SIGINT handler. NOTE: there is no need to unregister it manually. */
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = sigint_handler;
+  stop = false;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction");
+    if (cached) {
+      ssd1306_cache_close(&cache);
+    }
+    return res;
+  }
+
+  /* Passes follow each other on the same clock. */
+  ssd1306_sched_init(&sched, fps, policy);
+  if (loop == 0) {
+    while ((!stop) && (res >= 0)) {
+      res = cached ? ssd1306_send_cache_pass(ssd, &cache, &sched) : ssd1306_send_png_sprite_pass(ssd, path, &sched);
+    }
+  } else {
+    for (; (loop > 0) && (!stop) && (res >= 0); loop --) {
+      res = cached ? ssd1306_send_cache_pass(ssd, &cache, &sched) : ssd1306_send_png_sprite_pass(ssd, path, &sched);
+    }
+  }
+  if (cached) {
+    ssd1306_cache_close(&cache);
+  }
+  ssd1306_sched_print(&sched, stdout);
+  if (res < 0) {
+    return res;
+  }
+
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = SIG_DFL;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction unregister");
+    return res;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * Grayscale.
+ * The panel is 1-bit, so gray is made in time: images are quantized to <bits>
+ * (2-4) bits per pixel and split into bit-planes, which are cycled faster than
+ * the eye follows. Plane b weighs 2^b, either by staying up for 2^b slots, or,
+ * with contrast modulation, by one slot at a contrast proportional to 2^b,
+ * which shortens the cycle to <bits> slots.
+ *
+ * Planes are made at load time, in frame layout behind their data header,
+ * along with the spans from every plane to the next one, so a slot only costs
+ * its transfer. Slots are as short as the slowest transition, measured on the
+ * first cycle, unless a rate is given.
+ *****************************************************************************/
+
+#define SSD1306_GRAY_BITS_MAX (4)
+
+typedef struct {
+  int bits;
+  bool contrast;                              /* Weigh planes by contrast, not time */
+  int hold[SSD1306_GRAY_BITS_MAX];            /* Slots */
+  uint8_t level[SSD1306_GRAY_BITS_MAX];       /* Contrast */
+  uint8_t plane[SSD1306_GRAY_BITS_MAX][SSD1306_GDDRAM + 1];            /* Data header + frame */
+  ssd1306_span_t spans[SSD1306_GRAY_BITS_MAX][SSD1306_SPANS_MAX - 1];  /* From the previous plane */
+  int nspans[SSD1306_GRAY_BITS_MAX];
+} ssd1306_gray_t;
+
+/* Loads the first <line> rows of the image at <path>, any PNG format. */
+int ssd1306_gray_load(ssd1306_gray_t *gray, const char *path, int col, int line, int bits, bool contrast) {
+  uint8_t rows[SSD1306_GRAY_BITS_MAX][8][SSD1306_COLS_MAX / 8];
+  png_byte pixels[SSD1306_COLS_MAX];
+  png_bytep packed[8];
+  ssd1306_png_t png;
+  int page, r, x, b, v, res;
+
+  if ((bits < 2) || (bits > SSD1306_GRAY_BITS_MAX)) {
+    return -EINVAL;
+  }
+  if ((res = ssd1306_png_start(&png, path, col, line, true)) < 0) {
+    return res;
+  }
+  if (ssd1306_png_frames(&png) > 1) {
+    fprintf(stderr, "WARNING: %s is taller than the screen, showing the top.\n", path);
+  }
+
+  if (0 != setjmp(png_jmpbuf(png.png_ptr))) {
+    fputs("ERROR: libpng, reading\n", stderr);
+    ssd1306_png_destroy(&png);
+    return -EIO;
+  }
+
+  for (page = 0; page < line / 8; page ++) {
+    bzero(rows, sizeof(rows));
+    for (r = 0; r < 8; r ++) {
+      ssd1306_png_luma(&png, pixels);
+      for (x = 0; x < col; x ++) {
+        /* Rounded to the nearest of 2^bits levels */
+        v = (pixels[x] * ((1 << bits) - 1) + 127) / 255;
+        for (b = 0; b < bits; b ++) {
+          rows[b][r][x / 8] |= GET_BIT(v, b) << (7 - (x % 8));
+        }
+      }
+    }
+    for (b = 0; b < bits; b ++) {
+      for (r = 0; r < 8; r ++) {
+        packed[r] = rows[b][r];
+      }
+      ssd1306_pack_page(packed, col / 8, &gray->plane[b][1 + page * col]);
+    }
+  }
+  ssd1306_png_close(&png);
+
+  gray->bits     = bits;
+  gray->contrast = contrast;
+  for (b = 0; b < bits; b ++) {
+    gray->plane[b][0] = SSD1306_CONT_DATA_HDR;
+    gray->hold[b]     = contrast ? 1 : (1 << b);
+    /* Top plane at full contrast. Brightness is only roughly linear in it. */
+    gray->level[b]    = (0xff << b) >> (bits - 1);
+    /* A span short of a batch, the contrast goes along */
+    gray->nspans[b]   = ssd1306_delta(&gray->plane[(b + bits - 1) % bits][1], &gray->plane[b][1], col, line,
+                                      gray->spans[b], SSD1306_SPANS_MAX - 1);
+  }
+
+  return 0;
+}
+
+/* Puts plane <b> up, following plane b - 1 unless the shadow is unknown. */
+static int ssd1306_gray_show(ssd1306_t *ssd, const ssd1306_gray_t *gray, int b) {
+  ssd1306_cmds_t cmds;
+  int res = 0, i;
+
+  if (!ssd->valid) {
+    res = ssd1306_stage(ssd, &gray->plane[b][1]);
+  } else if (SSD1306_DELTA_FULL == gray->nspans[b]) {
+    ssd->updates ++;
+    res = ssd1306_send_window(ssd, &gray->plane[b][1], 0, ssd->width - 1, 0, ssd->height / 8 - 1);
+  } else {
+    ssd->updates ++;
+    for (i = 0; (i < gray->nspans[b]) && (res >= 0); i ++) {
+      res = ssd1306_send_window(ssd, &gray->plane[b][1], gray->spans[b][i].col, gray->spans[b][i].col + gray->spans[b][i].len - 1,
+                                gray->spans[b][i].page, gray->spans[b][i].page);
+    }
+  }
+
+  if ((res >= 0) && gray->contrast) {
+    /* Right behind the data, in the same batch */
+    ssd1306_cmds_init(&cmds, ssd->bus);
+    if ((res = ssd1306_set_contrast(&cmds, gray->level[b])) >= 0) {
+      res = ssd1306_out_cmds(ssd, &cmds);
+    }
+  }
+  if (res >= 0) {
+    res = ssd1306_out_submit(ssd);
+  }
+
+  if (res < 0) {
+    ssd->valid = false;
+  }
+  return res;
+}
+
+/*
+ * Puts plane 0 up over whatever is shown, then runs a cycle to time the
+ * transitions. Returns the slowest one in ns, with plane 0 up again.
+ */
+static int64_t ssd1306_gray_measure(ssd1306_t *ssd, const ssd1306_gray_t *gray) {
+  int64_t t, slowest = 0;
+  int b, res;
+
+  if (((res = ssd1306_update(ssd, &gray->plane[0][1])) < 0) || ((res = ssd1306_sync(ssd)) < 0)) {
+    return res;
+  }
+  for (b = 1; b <= gray->bits; b ++) {
+    t = ssd1306_now();
+    if (((res = ssd1306_gray_show(ssd, gray, b % gray->bits)) < 0) || ((res = ssd1306_sync(ssd)) < 0)) {
+      return res;
+    }
+    t = ssd1306_now() - t;
+    slowest = (t > slowest) ? t : slowest;
+  }
+  return slowest;
+}
+
+/*
+ * Shows a gray image until SIGINT, with <fps> slots per second, or slots as
+ * short as the bus allows with fps == 0. Slots slip rather than drop: a
+ * missing plane would show as a wrong gray, a late one only as flicker.
+ */
+int ssd1306_send_gray(ssd1306_t *ssd, const char *path, int bits, bool contrast, int fps) {
+  static ssd1306_gray_t gray;
+  ssd1306_sched_t sched;
+  struct sigaction sia;
+  ssd1306_cmds_t cmds;
+  int64_t slowest;
+  int res, b, slots = 0;
+
+  if ((fps < 0) || (fps > 1000000) || (NULL == path)) {
+    return -EINVAL;
+  }
+  if ((res = ssd1306_gray_load(&gray, path, ssd->width, ssd->height, bits, contrast)) < 0) {
+    return res;
+  }
+
+  /* Setup SIGINT handler. NOTE: there is no need to unregister it manually. */
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = sigint_handler;
+  stop = false;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction");
+    return res;
+  }
+
+  if ((slowest = ssd1306_gray_measure(ssd, &gray)) < 0) {
+    return slowest;
+  }
+  ssd1306_sched_init(&sched, fps, SSD1306_SCHED_SLIP);
+  if (0 == fps) {
+    /* Some headroom for the bus's moods */
+    sched.period = slowest + slowest / 4;
+  }
+  for (b = 0; b < bits; b ++) {
+    slots += gray.hold[b];
+  }
+  fprintf(stdout, "Gray: %d levels, slot %.2f ms (slowest transition %.2f ms), cycle %.1f Hz\n",
+          1 << bits, sched.period / 1e6, slowest / 1e6, 1e9 / (sched.period * slots));
+
+  for (b = 1; (!stop) && (res >= 0); b = (b + 1) % bits) {
+    ssd1306_sched_wait(&sched);
+    res = ssd1306_gray_show(ssd, &gray, b);
+    ssd1306_sched_hold(&sched, gray.hold[b]);
+  }
+  ssd1306_sched_print(&sched, stdout);
+
+  if (contrast) {
+    ssd1306_cmds_init(&cmds, ssd->bus);
+    ssd1306_reset_contrast(&cmds);
+    if ((ssd1306_out_cmds(ssd, &cmds) < 0) || (ssd1306_out_submit(ssd) < 0) || (ssd1306_sync(ssd) < 0)) {
+      fputs("WARNING: contrast not restored.\n", stderr);
+    }
+  }
+  if (res < 0) {
+    return res;
+  }
+
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = SIG_DFL;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction unregister");
+    return res;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * Streamed frames.
+ * Frames come raw from a pipe, a FIFO or a file, as fast as some producer
+ * (ffmpeg -f image2pipe -c:v pbm, a renderer) makes them:
+ *   pbm:   binary PBM (P4) images back to back, row-major, 1 is black
+ *   pages: width * height / 8 bytes of GDDRAM each, no header
+ * A reader thread decodes them into a triple buffer and the player always
+ * takes the newest complete frame. Frames replaced before they were taken
+ * are dropped, so a producer that outruns the bus costs neither latency nor
+ * memory, and a slower one is shown as it comes.
+ *****************************************************************************/
+
+#define SSD1306_STREAM_PBM   (0)
+#define SSD1306_STREAM_PAGES (1)
+
+typedef struct {
+  FILE *fp;
+  int format;
+  int width;
+  int height;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint8_t buf[3][SSD1306_GDDRAM + 1];  /* Data header + frame */
+  int fill;                   /* Being read into, reader only */
+  int ready;                  /* Newest complete frame */
+  int taken;                  /* Being sent, player only */
+  bool fresh;                 /* <ready> is not taken yet */
+  bool eof;
+  int error;
+  unsigned long frames;
+  unsigned long dropped;
+} ssd1306_stream_t;
+
+/* Next number of a PBM header, after whitespace and comments. Eats one whitespace after it. */
+static int ssd1306_pbm_int(FILE *fp) {
+  int c, v = 0, digits = 0;
+
+  while (EOF != (c = getc(fp))) {
+    if ('#' == c) {
+      while ((EOF != (c = getc(fp))) && ('\n' != c));
+    } else if (!isspace(c)) {
+      break;
+    }
+  }
+  for (; isdigit(c) && (v <= 0xffff); c = getc(fp)) {
+    v = v * 10 + (c - '0');
+    digits ++;
+  }
+
+  return ((digits > 0) && (v <= 0xffff) && isspace(c)) ? v : -EINVAL;
+}
+
+/* Reads the next frame into <frame> (framebuffer layout). -ENODATA at the end of the stream. */
+static int ssd1306_stream_read(ssd1306_stream_t *st, uint8_t frame[]) {
+  png_byte scratch[8][SSD1306_COLS_MAX / 8];
+  png_bytep rows[8];
+  size_t bpr = st->width / 8, size = st->width * st->height / 8, n, i;
+  int page, r, c, w, h;
+
+  if (SSD1306_STREAM_PAGES == st->format) {
+    if (size != (n = fread(frame, 1, size, st->fp))) {
+      if (ferror(st->fp)) {
+        return -EIO;
+      }
+      if (0 != n) {
+        fputs("WARNING: stream ends in the middle of a frame.\n", stderr);
+      }
+      return -ENODATA;
+    }
+    return 0;
+  }
+
+  /* Whitespace between images is allowed */
+  while (isspace(c = getc(st->fp)));
+  if (EOF == c) {
+    return ferror(st->fp) ? -EIO : -ENODATA;
+  }
+  if (('P' != c) || ('4' != getc(st->fp))) {
+    fputs("ERROR: stream is not binary PBM (P4)!\n", stderr);
+    return -EINVAL;
+  }
+  if (((w = ssd1306_pbm_int(st->fp)) < 0) || ((h = ssd1306_pbm_int(st->fp)) < 0)) {
+    fputs("ERROR: bad PBM header!\n", stderr);
+    return -EINVAL;
+  }
+  if ((w != st->width) || (h != st->height)) {
+    fprintf(stderr, "ERROR: stream frame size %d x %d mismatches the screen!\n", w, h);
+    return -EINVAL;
+  }
+
+  for (r = 0; r < 8; r ++) {
+    rows[r] = scratch[r];
+  }
+  for (page = 0; page < st->height / 8; page ++) {
+    for (r = 0; r < 8; r ++) {
+      if (bpr != fread(scratch[r], 1, bpr, st->fp)) {
+        if (ferror(st->fp)) {
+          return -EIO;
+        }
+        fputs("WARNING: stream ends in the middle of a frame.\n", stderr);
+        return -ENODATA;
+      }
+      /* Black is off */
+      for (i = 0; i < bpr; i ++) {
+        scratch[r][i] ^= 0xff;
+      }
+    }
+    ssd1306_pack_page(rows, bpr, &frame[page * st->width]);
+  }
+
+  return 0;
+}
+
+static void *ssd1306_stream_reader(void *arg) {
+  ssd1306_stream_t *st = arg;
+  int res, t;
+
+  do {
+    res = ssd1306_stream_read(st, &st->buf[st->fill][1]);
+
+    pthread_mutex_lock(&st->lock);
+    if (res < 0) {
+      st->eof   = true;
+      st->error = (-ENODATA == res) ? 0 : res;
+    } else {
+      if (st->fresh) {
+        st->dropped ++;
+      }
+      t         = st->ready;
+      st->ready = st->fill;
+      st->fill  = t;
+      st->fresh = true;
+      st->frames ++;
+    }
+    pthread_cond_signal(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+  } while (res >= 0);
+
+  return NULL;
+}
+
+/* <path> is a file or FIFO, or "-" for stdin. */
+int ssd1306_stream_start(ssd1306_stream_t *st, const char *path, int format, int width, int height) {
+  int res, i;
+
+  if ((NULL == st) || (NULL == path)) {
+    return -EINVAL;
+  }
+  if ((SSD1306_STREAM_PBM != format) && (SSD1306_STREAM_PAGES != format)) {
+    return -EINVAL;
+  }
+  if ((width <= 0) || (width > SSD1306_COLS_MAX) || (0 != width % 8) || (height <= 0) || (height > SSD1306_PAGES_MAX * 8) || (0 != height % 8)) {
+    return -EINVAL;
+  }
+
+  bzero(st, sizeof(*st));
+  st->format = format;
+  st->width  = width;
+  st->height = height;
+  st->fill   = 0;
+  st->ready  = 1;
+  st->taken  = 2;
+  for (i = 0; i < 3; i ++) {
+    st->buf[i][0] = SSD1306_CONT_DATA_HDR;
+  }
+
+  /* Opening a FIFO waits for a writer. */
+  if (0 == strcmp(path, "-")) {
+    st->fp = stdin;
+  } else if (NULL == (st->fp = fopen(path, "rb"))) {
+    /* SIGINT before any writer showed up */
+    if ((EINTR == errno) && stop) {
+      return -EINTR;
+    }
+    perror("fopen");
+    return -EIO;
+  }
+
+  pthread_mutex_init(&st->lock, NULL);
+  pthread_cond_init(&st->cond, NULL);
+  if (0 != (res = pthread_create(&st->thread, NULL, ssd1306_stream_reader, st))) {
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->lock);
+    if (stdin != st->fp) {
+      fclose(st->fp);
+    }
+    return -res;
+  }
+
+  return 0;
+}
+
+/* Newest frame, waiting for one to come. NULL at the end of the stream or on SIGINT. */
+const uint8_t *ssd1306_stream_take(ssd1306_stream_t *st) {
+  const uint8_t *frame = NULL;
+  struct timespec ts;
+  int t;
+
+  pthread_mutex_lock(&st->lock);
+  while ((!st->fresh) && (!st->eof) && (!stop)) {
+    /* Signals do not end the wait, look at <stop> now and then. */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec  ++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&st->cond, &st->lock, &ts);
+  }
+  if (st->fresh && (!stop)) {
+    t         = st->taken;
+    st->taken = st->ready;
+    st->ready = t;
+    st->fresh = false;
+    frame     = &st->buf[st->taken][1];
+  }
+  pthread_mutex_unlock(&st->lock);
+
+  return frame;
+}
+
+/* Returns the error that ended the stream, if any. */
+int ssd1306_stream_stop(ssd1306_stream_t *st) {
+  /* The reader may be blocked in read() for good. */
+  pthread_cancel(st->thread);
+  pthread_join(st->thread, NULL);
+  pthread_cond_destroy(&st->cond);
+  pthread_mutex_destroy(&st->lock);
+  if (stdin != st->fp) {
+    fclose(st->fp);
+  }
+  return st->error;
+}
+
+/*
+ * Shows the frames streamed from <path> ("-" for stdin) as fast as the bus
+ * takes them, until the stream ends or SIGINT.
+ */
+int ssd1306_send_stream(ssd1306_t *ssd, const char *path, int format) {
+  static ssd1306_stream_t st;
+  const uint8_t *frame;
+  struct sigaction sia;
+  unsigned long shown = 0;
+  int64_t start;
+  int res, err;
+
+  /* Setup SIGINT handler. NOTE: there is no need to unregister it manually. */
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = sigint_handler;
+  stop = false;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction");
+    return res;
+  }
+
+  if ((res = ssd1306_stream_start(&st, path, format, ssd->width, ssd->height)) < 0) {
+    /* Stopped while waiting for a writer is a normal stop */
+    return ((-EINTR == res) && stop) ? 0 : res;
+  }
+  start = ssd1306_now();
+  while ((res >= 0) && (NULL != (frame = ssd1306_stream_take(&st)))) {
+    if ((res = ssd1306_update(ssd, frame)) >= 0) {
+      shown ++;
+    }
+  }
+  if (res >= 0) {
+    res = ssd1306_sync(ssd);
+  }
+  if (((err = ssd1306_stream_stop(&st)) < 0) && (res >= 0)) {
+    res = err;
+  }
+
+  fprintf(stdout, "Stream: %lu frames in, %lu shown, %lu dropped, %.1f fps\n",
+          st.frames, shown, st.dropped, shown / ((ssd1306_now() - start) / 1e9));
+  if (res < 0) {
     return res;
   }
-
-  return 0;
+
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = SIG_DFL;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction unregister");
+    return res;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * Video walls.
+ * Several panels, on any mix of adapters and addresses, driven as one. Each
+ * adapter gets one libui2c worker, shared by the panels wired to it, so
+ * adapters transmit in parallel while the panels on one adapter take turns a
+ * frame at a time.
+ *
+ * Frames are committed together: all panels are diffed and staged first,
+ * then the wall waits until the previous frame is out on every adapter, then
+ * the new one is released everywhere at once. No panel ever runs a frame
+ * ahead of another; they flip within one frame's transmit time of each other.
+ *****************************************************************************/
+
+#define SSD1306_WALL_MAX (16)
+
+typedef struct {
+  int n;
+  ssd1306_t *ssd[SSD1306_WALL_MAX];
+  int nbus;
+  i2c_bus_t *bus[SSD1306_WALL_MAX];
+  i2c_async_t *async[SSD1306_WALL_MAX];
+} ssd1306_wall_t;
+
+/* Panels must be open and not pipelined on their own. */
+int ssd1306_wall_start(ssd1306_wall_t *wall, ssd1306_t *ssd[], int n) {
+  int count[SSD1306_WALL_MAX] = {0};
+  int res, i, j;
+
+  if ((NULL == wall) || (NULL == ssd)) {
+    return -EFAULT;
+  }
+  if ((n <= 0) || (n > SSD1306_WALL_MAX)) {
+    return -EINVAL;
+  }
+
+  wall->n    = n;
+  wall->nbus = 0;
+  for (i = 0; i < n; i ++) {
+    if (NULL != ssd[i]->async) {
+      return -EBUSY;
+    }
+    for (j = 0; (j < wall->nbus) && (wall->bus[j] != ssd[i]->bus); j ++);
+    if (j == wall->nbus) {
+      wall->bus[wall->nbus ++] = ssd[i]->bus;
+    }
+    wall->ssd[i] = ssd[i];
+    count[j] ++;
+  }
+
+  /* Deep enough for both batches of every panel on the adapter */
+  for (j = 0; j < wall->nbus; j ++) {
+    if ((res = i2c_async_start(&wall->async[j], wall->bus[j], count[j] * 2 * SSD1306_BATCH_REQS)) < 0) {
+      while (j-- > 0) {
+        i2c_async_stop(wall->async[j]);
+      }
+      return res;
+    }
+  }
+  for (i = 0; i < n; i ++) {
+    for (j = 0; wall->bus[j] != ssd[i]->bus; j ++);
+    ssd1306_pipeline_attach(ssd[i], wall->async[j]);
+  }
+
+  return 0;
+}
+
+/*
+ * Sends frames[i] to panel i, in ssd1306_update() layout. A failing panel
+ * does not hold up the others; the first error is returned.
+ */
+int ssd1306_wall_update(ssd1306_wall_t *wall, const uint8_t *frames[]) {
+  int res, err = 0, i;
+  ssd1306_t *ssd;
+
+  /* Diff everything while the previous frame is still on the wires */
+  for (i = 0; i < wall->n; i ++) {
+    if ((res = ssd1306_stage(wall->ssd[i], frames[i])) < 0) {
+      wall->ssd[i]->valid = false;
+      err = (0 == err) ? res : err;
+    }
+  }
+
+  /* Barrier: the previous frame is out everywhere */
+  for (i = 0; i < wall->n; i ++) {
+    ssd = wall->ssd[i];
+    if ((res = ssd1306_batch_reap(ssd, &ssd->batch[ssd->cur ^ 1])) < 0) {
+      return res;
+    }
+  }
+
+  /* Release, adapters start in parallel */
+  for (i = 0; i < wall->n; i ++) {
+    if ((res = ssd1306_out_submit(wall->ssd[i])) < 0) {
+      wall->ssd[i]->valid = false;
+      err = (0 == err) ? res : err;
+    }
+  }
+
+  return err;
+}
+
+/* Sends the framebuffer of every panel. */
+int ssd1306_wall_display(ssd1306_wall_t *wall) {
+  const uint8_t *frames[SSD1306_WALL_MAX];
+  int i;
+
+  for (i = 0; i < wall->n; i ++) {
+    frames[i] = wall->ssd[i]->fb;
+  }
+  return ssd1306_wall_update(wall, frames);
+}
+
+int ssd1306_wall_stop(ssd1306_wall_t *wall) {
+  int res, err = 0, i;
+
+  for (i = 0; i < wall->n; i ++) {
+    if ((res = ssd1306_pipeline_stop(wall->ssd[i])) < 0) {
+      err = (0 == err) ? res : err;
+    }
+  }
+  for (i = 0; i < wall->nbus; i ++) {
+    i2c_async_stop(wall->async[i]);
+  }
+  wall->n    = 0;
+  wall->nbus = 0;
+  return err;
 }
 
-int ssd1306_cls(int file, int col, int line) {
-  int res;
-  uint8_t *buf = NULL;
-  const size_t len = line * col / 8 + 1;
+/* Every panel shows the same frame. */
+static int ssd1306_wall_send_frame(ssd1306_wall_t *wall, const uint8_t frame[], ssd1306_sched_t *sched) {
+  const uint8_t *frames[SSD1306_WALL_MAX];
+  int i, res;
 
-  if ((line <= 0) || (col <= 0)) {
-    return -EINVAL;
-  }
-  if ((line > 64) || (col > 128)) {
-    return -EINVAL;
+  if (!ssd1306_sched_wait(sched)) {
+    return 0;
   }
-  if (((line % 8) != 0) || ((col % 8) != 0)) {
-    return -EINVAL;
+  for (i = 0; i < wall->n; i ++) {
+    frames[i] = frame;
   }
-
-  buf = (uint8_t *)malloc(len);
-  if (NULL == buf) {
-    perror("malloc");
-    return -ENOMEM;
+  if ((res = ssd1306_wall_update(wall, frames)) < 0) {
+    return res;
   }
-
-  bzero(buf, len);
-  buf[0] = SSD1306_CONT_DATA_HDR;
-  res = i2c_write_data(file, buf, len);
-
-  free(buf);
-  return res;
+  ssd1306_sched_done(sched);
+  return 0;
 }
 
-#define GET_BIT(x, n) ((x) >> (n) & 0x01)
-/*
- * NOTE: will allocate the buffer for all data + SSD1306_CONT_DATA_HDR.
- * Remember to free.
- * For internal use.
- */
-int read_png(char *path, int col, int line, uint8_t *buf[], size_t *len) {
-  uint8_t header[8];
-  int res;
-  int width, height, x, y;
-  png_byte depth;
-  png_structp png_ptr;
-  png_infop info_ptr;
-  png_bytep *row_pointers;
-  FILE *fp = NULL;
+/* Plays a sprite sheet or cache on the whole wall in lockstep until SIGINT. */
+int ssd1306_wall_send_sprite(ssd1306_wall_t *wall, char *path, int fps, int policy) {
+  static uint8_t frame[SSD1306_GDDRAM + 1];
+  ssd1306_t *ssd = wall->ssd[0];
+  int res = 0, cached;
+  struct sigaction sia;
+  ssd1306_cache_t cache;
+  ssd1306_sched_t sched;
+  ssd1306_png_t png;
+  uint32_t i;
 
-  if ((NULL == path) || (NULL == buf) || (NULL == len)) {
+  if ((fps < 0) || (fps > 1000000) || (NULL == path)) {
     return -EINVAL;
   }
-  if ((line <= 0) || (col <= 0)) {
-    return -EINVAL;
+  for (i = 1; i < (uint32_t)wall->n; i ++) {
+    if ((wall->ssd[i]->width != ssd->width) || (wall->ssd[i]->height != ssd->height)) {
+      return -EINVAL;
+    }
   }
-  if ((line > 64) || (col > 128)) {
-    return -EINVAL;
+  if ((cached = ssd1306_cache_probe(path)) < 0) {
+    return cached;
   }
-  if (((line % 8) != 0) || ((col % 8) != 0)) {
-    return -EINVAL;
+  if (cached && ((res = ssd1306_cache_open(&cache, path, ssd->width, ssd->height)) < 0)) {
+    return res;
   }
 
-  if (NULL == (fp = fopen(path, "rb"))) {
-    perror("fopen");
-    return -EIO;
+  bzero(&sia, sizeof(sia));
+  sia.sa_handler = sigint_handler;
+  stop = false;
+  if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
+    perror("sigaction");
+    if (cached) {
+      ssd1306_cache_close(&cache);
+    }
+    return res;
   }
 
-  fread(header, 1, 8, fp);
-  if (0 != png_sig_cmp(header, 0, 8)) {
-    perror("png_sig_cmp");
-    fclose(fp);
-    return -ENOENT;
-  }
+  frame[0] = SSD1306_CONT_DATA_HDR;
+  ssd1306_sched_init(&sched, fps, policy);
+  while ((!stop) && (res >= 0)) {
+    if (cached) {
+      for (i = 0; (i < cache.hdr->frames) && (!stop) && (res >= 0); i ++) {
+        res = ssd1306_wall_send_frame(wall, ssd1306_cache_frame(&cache, i), &sched);
+      }
+      continue;
+    }
 
-  if (NULL == (png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL))) {
-    perror("png_create_read_struct");
-    fclose(fp);
-    return -ENOMEM;
+    if ((res = ssd1306_png_open(&png, path, ssd->width, ssd->height)) < 0) {
+      break;
+    }
+    while ((!stop) && (res >= 0) && (0 == (res = ssd1306_png_read(&png, &frame[1])))) {
+      res = ssd1306_wall_send_frame(wall, &frame[1], &sched);
+    }
+    ssd1306_png_close(&png);
+    res = (-ENODATA == res) ? 0 : res;
+  }
+  if (cached) {
+    ssd1306_cache_close(&cache);
   }
+  ssd1306_sched_print(&sched, stdout);
+  return res;
+}
 
-  if (NULL == (info_ptr = png_create_info_struct(png_ptr))) {
-    perror("png_create_info_struct");
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
-    return -ENOMEM;
+/******************************************************************************
+ * Ticker.
+ * A marquee over pages [p0, p1], moved by the controller's horizontal scroll
+ * engine. The host only supplies the column that wraps around at the right
+ * edge: a few command bytes plus one data byte per page per step, instead of
+ * a frame.
+ *
+ * GDDRAM must not be written while scrolling is active, and the host cannot
+ * see the engine. Each step therefore arms the engine, waits 1.5 scroll
+ * intervals, then stops it, writes the new column and re-arms. This assumes
+ * the engine moves the content exactly once in that window, i.e. its first
+ * step comes one interval after 2Fh, and that 2Eh leaves GDDRAM intact. The
+ * datasheet promises neither (it asks for RAM to be rewritten after 2Eh), and
+ * only the simulator, which models the same assumption, checks it. So every
+ * time the strip wraps all the ticker pages are rewritten, which bounds any
+ * drift to one pass of the strip; a step that comes too late to know how far
+ * the content moved does the same.
+ *****************************************************************************/
+
+#define SSD1306_FOSC_HZ (370000)    /* Typical, reset clock divide ratio */
+#define SSD1306_FRAME_K (54)        /* DCLKs per row, reset precharge: 2 + 2 + 50 */
+
+typedef struct {
+  ssd1306_t *ssd;
+  const uint8_t *src;         /* Page-major strip, src_w columns by p1 - p0 + 1 pages */
+  int src_w;
+  int p0;
+  int p1;
+  int interval;               /* Display frames per scroll step */
+  int64_t step_ns;
+  int64_t armed;              /* When scrolling was last enabled */
+  long pos;                   /* Source column at the left edge */
+  unsigned long steps;
+  unsigned long repaints;     /* After a late step */
+  unsigned long resyncs;      /* On wrap */
+} ssd1306_ticker_t;
+
+/* Display frame period with reset clock settings. */
+static int64_t ssd1306_frame_ns(const ssd1306_t *ssd) {
+  return (int64_t)SSD1306_FRAME_K * ssd->height * 1000000000 / SSD1306_FOSC_HZ;
+}
+
+/* Scroll interval (display frames) closest to <speed> columns per second. */
+int ssd1306_ticker_interval(const ssd1306_t *ssd, int speed) {
+  static const int intervals[] = {2, 3, 4, 5, 25, 64, 128, 256};
+  int64_t want, best = INT64_MAX, d;
+  int i, res = intervals[0];
+
+  if (speed <= 0) {
+    return -EINVAL;
   }
 
-  /*
-   * NOTE: libpng is efficient but quite dirty.
-   * If any error happens afterwards, program will return to this point with an
-   * non-zero return value.
-   */
-  if (0 != (res = setjmp(png_jmpbuf(png_ptr)))) {
-    perror("libpng, init");
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
-    return res;
+  /* A step takes 1.5 intervals */
+  want = 1000000000LL / speed;
+  for (i = 0; i < (int)(sizeof(intervals) / sizeof(intervals[0])); i ++) {
+    d = llabs(intervals[i] * ssd1306_frame_ns(ssd) * 3 / 2 - want);
+    if (d < best) {
+      best = d;
+      res  = intervals[i];
+    }
   }
 
-  png_init_io(png_ptr, fp);
-  png_set_sig_bytes(png_ptr, 8);
+  return res;
+}
 
-  png_read_info(png_ptr, info_ptr);
+/* Source column <x> of the strip, page p. */
+static inline uint8_t ssd1306_ticker_src(const ssd1306_ticker_t *t, long x, int p) {
+  return t->src[(p - t->p0) * t->src_w + (x % t->src_w)];
+}
 
-  width  = png_get_image_width(png_ptr, info_ptr);
-  height = png_get_image_height(png_ptr, info_ptr);
-  depth  = png_get_bit_depth(png_ptr, info_ptr);
-  /* Just enable interlace handling, we do not need to know which format. */
-  png_set_interlace_handling(png_ptr);
+static int ssd1306_ticker_arm(ssd1306_ticker_t *t) {
+  ssd1306_cmds_t cmds;
+  int res;
 
-  if (1 != depth) {
-    fputs("ERROR: only black and white images are allowed!\n", stderr);
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
-    return -ENOENT;
-  }
-  /* NOTE: need capabilities to read sprite. */
-  if ((width != col) || ((height % line) != 0)) {
-    fprintf(stderr, "ERROR: image size %d x %d mismatches the screen!\n", width, height);
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
-    return -ENOENT;
+  ssd1306_cmds_init(&cmds, t->ssd->bus);
+  if ((res = ssd1306_set_scroll(&cmds, true)) < 0) {
+    return res;
   }
+  t->armed = ssd1306_now();
+  return ssd1306_cmds_flush(&cmds);
+}
 
-  png_read_update_info(png_ptr, info_ptr);
+/* Writes the ticker pages from the strip as they are at <pos>, scrolling stopped. */
+static int ssd1306_ticker_paint(ssd1306_ticker_t *t) {
+  ssd1306_t *ssd = t->ssd;
+  ssd1306_cmds_t cmds;
+  size_t n = 1;
+  int res, p, c;
 
-  if (0 != (res = setjmp(png_jmpbuf(png_ptr)))) {
-    perror("libpng, reading");
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
+  ssd1306_cmds_init(&cmds, ssd->bus);
+  if (((res = ssd1306_set_col_addr(&cmds, ssd->geom->col0, ssd->geom->col0 + ssd->width - 1)) < 0) || ((res = ssd1306_set_page_addr(&cmds, t->p0, t->p1)) < 0)) {
     return res;
   }
-
-  /* Bytes should be packed (8 horizontal pixels per byte). */
-  size_t bpr = png_get_rowbytes(png_ptr, info_ptr);
-  fprintf(stdout, "Allocating %zu x %u bytes of memory for image...\n", bpr, height);
-  row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * height);
-  if (NULL == row_pointers) {
-    perror("malloc");
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
-    return -ENOMEM;
-  }
-  for (y = 0; y < height; y ++) {
-    row_pointers[y] = (png_byte*)malloc(bpr);
-    if (NULL == row_pointers[y]) {
-      perror("malloc");
-      png_destroy_info_struct(png_ptr, &info_ptr);
-      png_destroy_read_struct(&png_ptr, NULL, NULL);
-      fclose(fp);
-      return -ENOMEM;
-    }
+  if ((res = ssd1306_cmds_flush(&cmds)) < 0) {
+    return res;
   }
 
-  png_read_image(png_ptr, row_pointers);
-  /*
-   * Add header, flatten and copy into buffer.
-   * Need to re-arrange into 1x8 blocks. PNG packs pixels horizontally,
-   * but our display (always) does so vertically (128 line in 64 COM).
-   * For sprites, the sending function should handle following frames by
-   * backtracking after every frame and adding the header.
-   */
-  *len = height * bpr + height / line; /* Every screen needs a header. */
-  fprintf(stdout, "Allocating %zu bytes of memory for buffer...\n", *len);
-  *buf = malloc(*len);
-  if (NULL == *buf) {
-    perror("malloc");
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(fp);
-    return -ENOMEM;
-  }
-  size_t ptr = 0;
-  for (y = 0; y < height / 8; y ++) {
-    if (y % (line / 8) == 0) {
-      /* First line (page) of a frame, time to insert header. */
-      (*buf)[ptr] = SSD1306_CONT_DATA_HDR;
-      ptr ++;
+  ssd->buf[0] = SSD1306_CONT_DATA_HDR;
+  for (p = t->p0; p <= t->p1; p ++) {
+    for (c = 0; c < ssd->width; c ++) {
+      ssd->buf[n ++] = ssd1306_ticker_src(t, t->pos + c, p);
     }
-    for (x = 0; x < width; x ++ ) {
-      (*buf)[ptr] = (GET_BIT(row_pointers[y * 8 + 0][x / 8], 7 - (x % 8)) << 0) | (GET_BIT(row_pointers[y * 8 + 1][x / 8], 7 - (x % 8)) << 1)
-                  | (GET_BIT(row_pointers[y * 8 + 2][x / 8], 7 - (x % 8)) << 2) | (GET_BIT(row_pointers[y * 8 + 3][x / 8], 7 - (x % 8)) << 3)
-                  | (GET_BIT(row_pointers[y * 8 + 4][x / 8], 7 - (x % 8)) << 4) | (GET_BIT(row_pointers[y * 8 + 5][x / 8], 7 - (x % 8)) << 5)
-                  | (GET_BIT(row_pointers[y * 8 + 6][x / 8], 7 - (x % 8)) << 6) | (GET_BIT(row_pointers[y * 8 + 7][x / 8], 7 - (x % 8)) << 7);
-      ptr ++;
-    }
-  }
-  /* TODO: check underrun / overrun if necessary. */
-
-  png_destroy_info_struct(png_ptr, &info_ptr);
-  png_destroy_read_struct(&png_ptr, NULL, NULL);
-  for (y = 0; y < height; y++) {
-    free(row_pointers[y]);
   }
-  free(row_pointers);
-  fclose(fp);
-
-  return 0;
+  return i2c_write_data(ssd->bus, ssd->buf, n);
 }
 
-int ssd1306_send_png(int file, int col, int line, char *path) {
+int ssd1306_ticker_start(ssd1306_ticker_t *t, ssd1306_t *ssd, const uint8_t src[], int src_w, int p0, int p1, int interval) {
+  ssd1306_cmds_t cmds;
   int res;
-  size_t len;
-  uint8_t *buf = NULL;
 
-  if (NULL == path) {
+  if ((NULL == t) || (NULL == ssd) || (NULL == src)) {
+    return -EFAULT;
+  }
+  if ((src_w <= 0) || (p0 < 0) || (p1 < p0) || (p1 >= ssd->height / 8)) {
     return -EINVAL;
   }
 
-  if ((res = read_png(path, col, line, &buf, &len)) != 0) {
+  bzero(t, sizeof(*t));
+  t->ssd      = ssd;
+  t->src      = src;
+  t->src_w    = src_w;
+  t->p0       = p0;
+  t->p1       = p1;
+  t->interval = interval;
+  t->step_ns  = interval * ssd1306_frame_ns(ssd);
+
+  /* The ticker talks to the bus directly and GDDRAM will move under the shadow. */
+  if ((res = ssd1306_sync(ssd)) < 0) {
+    return res;
+  }
+  ssd1306_invalidate(ssd);
+
+  ssd1306_cmds_init(&cmds, ssd->bus);
+  if (((res = ssd1306_set_scroll(&cmds, false)) < 0) || ((res = ssd1306_setup_horiz_scroll(&cmds, true, p0, p1, interval)) < 0)) {
     return res;
   }
-  if (len != line * col / 8 + 1) {
-    fprintf(stdout, "NOTE: expect %zu bytes of PNG data, got %zu bytes, image is probably sprites.\n", (size_t)(line * col / 8 + 1), len);
+  if (((res = ssd1306_cmds_flush(&cmds)) < 0) || ((res = ssd1306_ticker_paint(t)) < 0)) {
+    return res;
   }
 
-  res = i2c_write_data(file, buf, len);
+  return ssd1306_ticker_arm(t);
+}
+
+/* Waits for the engine to move the content by one column and supplies the next one. */
+int ssd1306_ticker_step(ssd1306_ticker_t *t) {
+  ssd1306_t *ssd = t->ssd;
+  int64_t at = t->armed + t->step_ns * 3 / 2;
+  ssd1306_cmds_t cmds;
+  struct timespec ts;
+  uint8_t data[1 + SSD1306_PAGES_MAX];
+  size_t n = 1;
+  int res, p;
+
+  ts.tv_sec  = at / 1000000000;
+  ts.tv_nsec = at % 1000000000;
+  while ((EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) && (!stop));
 
-  if (buf != NULL) {
-    free(buf);
+  ssd1306_cmds_init(&cmds, ssd->bus);
+  if ((res = ssd1306_set_scroll(&cmds, false)) < 0) {
+    return res;
+  }
+  if ((res = ssd1306_cmds_flush(&cmds)) < 0) {
+    return res;
   }
-  return res;
-}
 
-/* Each pass of the sprite, for internal use. */
-int ssd1306_send_png_sprite_pass(int file, uint8_t buf[], size_t len, size_t flen) {
-  int res;
+  /* Cut short by SIGINT: the engine may or may not have moved, put it back. */
+  if (ssd1306_now() < at) {
+    t->repaints ++;
+    return ssd1306_ticker_paint(t);
+  }
+  t->pos ++;
+  t->steps ++;
 
-  if (((len % flen) != 0) || (NULL == buf)) {
-    return -EINVAL;
+  /* Stopped more than 2 intervals after arming: one or two steps, rewrite it all. */
+  if (ssd1306_now() - t->armed >= t->step_ns * 2) {
+    t->repaints ++;
+    if ((res = ssd1306_ticker_paint(t)) < 0) {
+      return res;
+    }
+    return ssd1306_ticker_arm(t);
   }
 
-  while ((len > 0) && (!stop)) {
-    if ((res = i2c_write_data(file, buf, flen)) < 0) {
+  /* Strip wrapped: rewrite it all in case the engine and the host disagree. */
+  if (0 == t->pos % t->src_w) {
+    t->resyncs ++;
+    if ((res = ssd1306_ticker_paint(t)) < 0) {
       return res;
     }
-    buf += flen;
-    len -= flen;
+    return ssd1306_ticker_arm(t);
   }
 
-  return 0;
+  ssd1306_cmds_init(&cmds, ssd->bus);
+  if (((res = ssd1306_set_col_addr(&cmds, ssd->geom->col0 + ssd->width - 1, ssd->geom->col0 + ssd->width - 1)) < 0) || ((res = ssd1306_set_page_addr(&cmds, t->p0, t->p1)) < 0)) {
+    return res;
+  }
+  if ((res = ssd1306_cmds_flush(&cmds)) < 0) {
+    return res;
+  }
+  data[0] = SSD1306_CONT_DATA_HDR;
+  for (p = t->p0; p <= t->p1; p ++) {
+    data[n ++] = ssd1306_ticker_src(t, t->pos + ssd->width - 1, p);
+  }
+  if ((res = i2c_write_data(ssd->bus, data, n)) < 0) {
+    return res;
+  }
+
+  return ssd1306_ticker_arm(t);
 }
 
-/*
- * NOTE:
- * loop == 0: loop forever until killed by signal.
- * loop == 1: no loop, single pass.
- */
-int ssd1306_send_png_sprite(int file, int col, int line, char *path, int delay_ms, int loop) {
+int ssd1306_ticker_stop(ssd1306_ticker_t *t) {
+  ssd1306_cmds_t cmds;
   int res;
-  size_t len;
-  struct sigaction sia;
-  uint8_t *buf = NULL;
 
-  if ((delay_ms < 0) || (delay_ms >= INT_MAX / 1000) || (loop < 0) || (NULL == path)) {
-    return -EINVAL;
+  ssd1306_cmds_init(&cmds, t->ssd->bus);
+  if ((res = ssd1306_set_scroll(&cmds, false)) < 0) {
+    return res;
   }
+  /* Content is where the last step left it, the shadow knows nothing of it. */
+  ssd1306_invalidate(t->ssd);
+  return ssd1306_cmds_flush(&cmds);
+}
 
-  if ((res = read_png(path, col, line, &buf, &len)) != 0) {
-    return res;
+/* Runs the ticker until SIGINT. */
+int ssd1306_send_ticker(ssd1306_t *ssd, const uint8_t src[], int src_w, int p0, int p1, int speed) {
+  ssd1306_ticker_t t;
+  struct sigaction sia;
+  int64_t start;
+  int res, interval;
+
+  if ((interval = ssd1306_ticker_interval(ssd, speed)) < 0) {
+    return interval;
   }
 
   /* Setup SIGINT handler. NOTE: there is no need to unregister it manually. */
@@ -1167,48 +3343,163 @@ int ssd1306_send_png_sprite(int file, int col, int line, char *path, int delay_m
   stop = false;
   if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
     perror("sigaction");
-    if (buf != NULL) {
-      free(buf);
-    }
     return res;
   }
 
-  size_t flen = col * line / 8 + 1; /* Size of each frame. */
-  if (loop == 0) {
+  start = ssd1306_now();
+  if ((res = ssd1306_ticker_start(&t, ssd, src, src_w, p0, p1, interval)) < 0) {
+    return res;
+  }
+  while ((!stop) && (res >= 0)) {
+    res = ssd1306_ticker_step(&t);
+  }
+  if (res >= 0) {
+    res = ssd1306_ticker_stop(&t);
+  }
 
-    while (!stop) {
-      if ((res = ssd1306_send_png_sprite_pass(file, buf, len, flen)) < 0) {
-        if (buf != NULL) {
-          free(buf);
-        }
-        return res;
-      }
-      usleep(delay_ms * 1000);
-    }
-  } else {
-    for (; loop > 0; loop --) {
-      if ((res = ssd1306_send_png_sprite_pass(file, buf, len, flen)) < 0) {
-        if (buf != NULL) {
-          free(buf);
-        }
-        return res;
-      }
-      usleep(delay_ms * 1000);
-    }
+  fprintf(stdout, "Ticker: %lu steps, %lu repaints, %lu resyncs, %.1f columns/s (interval %d frames)\n",
+          t.steps, t.repaints, t.resyncs, t.steps / ((ssd1306_now() - start) / 1e9), interval);
+  if (res < 0) {
+    return res;
   }
 
   bzero(&sia, sizeof(sia));
   sia.sa_handler = SIG_DFL;
   if ((res = sigaction(SIGINT, &sia, NULL)) < 0) {
     perror("sigaction unregister");
-    if (buf != NULL) {
-      free(buf);
-    }
     return res;
   }
-  if (buf != NULL) {
-    free(buf);
+  return 0;
+}
+
+/*
+ * Micro-benchmarks of the PNG to page conversion, which packs a synthetic
+ * sprite sheet with both kernels, of the frame diff, byte at a time against
+ * word-wise, and of the conversion kernels. All check that the variants agree.
+ */
+#define BENCH_WIDTH  (128)
+#define BENCH_HEIGHT (64 * 64)
+#define BENCH_ROUNDS (20)
+
+static double bench_pack(void (*pack)(png_bytep [8], size_t, uint8_t []), png_bytep rows[], size_t bpr, uint8_t out[]) {
+  struct timespec t0, t1;
+  int r, y;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (r = 0; r < BENCH_ROUNDS; r ++) {
+    for (y = 0; y < BENCH_HEIGHT / 8; y ++) {
+      pack(&rows[y * 8], bpr, &out[y * BENCH_WIDTH]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / BENCH_ROUNDS;
+}
+
+/* Both conversion kernels, as ssd1306_png_convert() chains them. */
+static void bench_binarize_rgba(const uint8_t rgba[], const uint8_t thr[16], size_t n, uint8_t out[]) {
+  uint8_t luma[SSD1306_COLS_MAX];
+
+  ssd1306_luma_rgba(rgba, n, luma);
+  ssd1306_binarize(luma, thr, n, out);
+}
+
+static double bench_convert(void (*convert)(const uint8_t [], const uint8_t [16], size_t, uint8_t []), const uint8_t rgba[], uint8_t out[]) {
+  struct timespec t0, t1;
+  uint8_t thr[16];
+  int r, y, i;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (r = 0; r < BENCH_ROUNDS; r ++) {
+    for (y = 0; y < BENCH_HEIGHT; y ++) {
+      for (i = 0; i < 16; i ++) {
+        thr[i] = ssd1306_bayer8[y % 8][i % 8] * 4 + 2;
+      }
+      convert(&rgba[y * BENCH_WIDTH * 4], thr, BENCH_WIDTH, &out[y * BENCH_WIDTH / 8]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / BENCH_ROUNDS;
+}
+
+/* Per frame, first/last of the last one are left in <first> and <last>. */
+static double bench_dirty(int (*dirty)(const ssd1306_geom_t *, const uint8_t [], const uint8_t [], int [], int []),
+                          const ssd1306_geom_t *geom, const uint8_t old[], const uint8_t new[], int first[], int last[]) {
+  struct timespec t0, t1;
+  int r, f, frames = BENCH_HEIGHT / geom->height;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (r = 0; r < BENCH_ROUNDS; r ++) {
+    for (f = 0; f < frames; f ++) {
+      dirty(geom, &old[f * SSD1306_GDDRAM], &new[f * SSD1306_GDDRAM], first, last);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / BENCH_ROUNDS / frames;
+}
+
+int ssd1306_bench(void) {
+  static uint8_t pixels[BENCH_HEIGHT][BENCH_WIDTH / 8], ref[BENCH_HEIGHT * BENCH_WIDTH / 8], out[BENCH_HEIGHT * BENCH_WIDTH / 8];
+  static png_bytep rows[BENCH_HEIGHT];
+  static uint8_t rgba[BENCH_HEIGHT * BENCH_WIDTH * 4];
+  int first[2][SSD1306_PAGES_MAX], last[2][SSD1306_PAGES_MAX];
+  const ssd1306_geom_t *geom;
+  ssd1306_geom_t any;
+  double ns_ref, ns;
+  size_t i;
+  int x, y;
+
+  srand(1);
+  for (y = 0; y < BENCH_HEIGHT; y ++) {
+    for (x = 0; x < BENCH_WIDTH / 8; x ++) {
+      pixels[y][x] = rand();
+    }
+    rows[y] = pixels[y];
+  }
+
+  ns_ref = bench_pack(ssd1306_pack_page_ref, rows, BENCH_WIDTH / 8, ref);
+  ns     = bench_pack(ssd1306_pack_page,     rows, BENCH_WIDTH / 8, out);
+  if (0 != memcmp(ref, out, sizeof(out))) {
+    fputs("ERROR: transpose kernel disagrees with the reference!\n", stderr);
+    return -EIO;
+  }
+
+  fprintf(stdout, "Packing %d x %d pixels (%d frames):\n", BENCH_WIDTH, BENCH_HEIGHT, BENCH_HEIGHT / 64);
+  fprintf(stdout, "  bit loop   %10.1f us  %8.1f MB/s\n", ns_ref / 1000, sizeof(out) / ns_ref * 1000);
+  fprintf(stdout, "  transpose  %10.1f us  %8.1f MB/s  (%.1fx)\n", ns / 1000, sizeof(out) / ns * 1000, ns_ref / ns);
+
+  /* Typical animation step: a few columns change on every other page */
+  for (i = 0; i < sizeof(out); i += SSD1306_COLS_MAX * 2) {
+    out[i + 40 + rand() % 48] ^= 0x10;
+    out[i + 40 + rand() % 48] ^= 0x01;
+  }
+  geom = ssd1306_geom_pick(&any, 128, 64);
+  ns_ref = bench_dirty(ssd1306_dirty_ref, geom, ref, out, first[0], last[0]);
+  ns     = bench_dirty(ssd1306_dirty,     geom, ref, out, first[1], last[1]);
+  if ((0 != memcmp(first[0], first[1], sizeof(first[0]))) || (0 != memcmp(last[0], last[1], sizeof(last[0])))) {
+    fputs("ERROR: word-wise diff disagrees with the reference!\n", stderr);
+    return -EIO;
+  }
+
+  fprintf(stdout, "Diffing %d x %d frames:\n", geom->width, geom->height);
+  fprintf(stdout, "  byte loop  %10.1f ns\n", ns_ref);
+  fprintf(stdout, "  word-wise  %10.1f ns  (%.1fx)\n", ns, ns_ref / ns);
+
+  for (i = 0; i < sizeof(rgba); i ++) {
+    rgba[i] = rand();
+  }
+  ns_ref = bench_convert(ssd1306_binarize_rgba_ref, rgba, ref);
+  ns     = bench_convert(bench_binarize_rgba,       rgba, out);
+  if (0 != memcmp(ref, out, sizeof(out))) {
+    fputs("ERROR: conversion kernels disagree with the reference!\n", stderr);
+    return -EIO;
   }
+
+  fprintf(stdout, "Converting %d x %d RGBA pixels (luma, Bayer):\n", BENCH_WIDTH, BENCH_HEIGHT);
+  fprintf(stdout, "  pixel loop %10.1f us  %8.1f MB/s\n", ns_ref / 1000, sizeof(rgba) / ns_ref * 1000);
+  fprintf(stdout, "  vector     %10.1f us  %8.1f MB/s  (%.1fx)\n", ns / 1000, sizeof(rgba) / ns * 1000, ns_ref / ns);
   return 0;
 }
 
@@ -1217,31 +3508,290 @@ int ssd1306_send_png_sprite(int file, int col, int line, char *path, int delay_m
 (send frame)
 (load png)
 (CLI)
-(font & text?)
 */
 
+#define OPT_STATS (0x100)
+#define OPT_BENCH (0x101)
+#define OPT_COMPILE (0x102)
+#define OPT_FPS     (0x103)
+#define OPT_NO_DROP (0x104)
+#define OPT_NO_PIPE (0x105)
+#define OPT_TICKER  (0x106)
+#define OPT_TEXT    (0x107)
+#define OPT_WALL    (0x108)
+#define OPT_GRAY    (0x109)
+#define OPT_GRAY_CONTRAST (0x10a)
+#define OPT_DITHER  (0x10b)
+#define OPT_STREAM  (0x10c)
+
+static const struct option long_opts[] = {
+  {"stats",   no_argument,       NULL, OPT_STATS},
+  {"bench",   no_argument,       NULL, OPT_BENCH},
+  {"compile", required_argument, NULL, OPT_COMPILE},
+  {"fps",     required_argument, NULL, OPT_FPS},
+  {"no-drop", no_argument,       NULL, OPT_NO_DROP},
+  {"no-pipeline", no_argument,   NULL, OPT_NO_PIPE},
+  {"ticker",  required_argument, NULL, OPT_TICKER},
+  {"text",    required_argument, NULL, OPT_TEXT},
+  {"wall",    required_argument, NULL, OPT_WALL},
+  {"gray",    required_argument, NULL, OPT_GRAY},
+  {"gray-contrast", no_argument, NULL, OPT_GRAY_CONTRAST},
+  {"dither",  required_argument, NULL, OPT_DITHER},
+  {"stream",  required_argument, NULL, OPT_STREAM},
+  {NULL,      0,                 NULL, 0},
+};
+
+int read_int(const char *s) {
+  /* convert a base 8 / 10 / 16 number in string into integer */
+  int i = -EIO;
+
+  if (NULL == s) {
+    return -EFAULT;
+  }
+
+  if ('0' == s[0]) {
+    if (('x' == s[1]) || ('X' == s[1])) {
+      /* Hex */
+      if (sscanf(&s[2], "%x", &i) != 1) {
+        return -EINVAL;
+      }
+    } else {
+      /* Oct */
+      if (sscanf(s, "%o", &i) != 1) {
+        return -EINVAL;
+      }
+    }
+  } else {
+    /* Dec */
+    if (sscanf(s, "%d", &i) != 1) {
+      return -EINVAL;
+    }
+  }
+
+  return i;
+}
+
+/*
+ * --wall <bus>:<addr>[,<bus>:<addr>...], e.g. 1:0x3c,1:0x3d,2:0x3c: plays the
+ * sprite on all listed 128x64 panels in lockstep.
+ */
+static int wall_main(const char *spec, char *sprite, int fps, int policy) {
+  static i2c_bus_t buses[SSD1306_WALL_MAX];
+  static ssd1306_t panels[SSD1306_WALL_MAX];
+  ssd1306_t *ssd[SSD1306_WALL_MAX];
+  int nr[SSD1306_WALL_MAX], nbus = 0, n = 0, res = 0, b, addr, i, j;
+  ssd1306_wall_t wall;
+  const char *p = spec;
+  char *end;
+
+  while (('\0' != *p) && (res >= 0)) {
+    b    = strtol(p, &end, 0);
+    addr = (':' == *end) ? strtol(end + 1, &end, 0) : -1;
+    if ((end == p) || (b < 0) || (addr < 0x03) || (addr > 0x77) || (('\0' != *end) && (',' != *end)) || (n == SSD1306_WALL_MAX)) {
+      fprintf(stderr, "ERROR: bad panel list \"%s\".\n", spec);
+      res = -EINVAL;
+      break;
+    }
+    p = ('\0' == *end) ? end : (end + 1);
+
+    for (j = 0; (j < nbus) && (nr[j] != b); j ++);
+    if (j == nbus) {
+      buses[j] = (i2c_bus_t)I2C_BUS_INIT;
+      if ((res = i2c_open(&buses[j], b)) < 0) {
+        break;
+      }
+      nr[nbus ++] = b;
+    }
+    /* Initialized one by one, synchronously */
+    if (((res = i2c_select(&buses[j], addr)) < 0) || ((res = ssd1306_open(&panels[n], &buses[j], 128, 64)) < 0)) {
+      fprintf(stderr, "ERROR: no panel at i2c-%d 0x%02x.\n", b, addr);
+      break;
+    }
+    ssd[n] = &panels[n];
+    n ++;
+  }
+
+  if ((res >= 0) && (0 == n)) {
+    res = -EINVAL;
+  }
+  if ((res >= 0) && ((res = ssd1306_wall_start(&wall, ssd, n)) >= 0)) {
+    for (i = 0; i < n; i ++) {
+      ssd1306_clear(ssd[i], SSD1306_OFF);
+    }
+    if ((res = ssd1306_wall_display(&wall)) >= 0) {
+      res = ssd1306_wall_send_sprite(&wall, sprite, fps, policy);
+    }
+    ssd1306_wall_stop(&wall);
+  }
+
+  for (j = 0; j < nbus; j ++) {
+    i2c_close(&buses[j]);
+  }
+  return res;
+}
+
 int main (int argc, char *argv[]) {
-  int file, res;
+  i2c_bus_t bus = I2C_BUS_INIT;
+  static ssd1306_t ssd;
+  char *sprite = "ui2c_ssd1306_test_sprite.png", *compile = NULL, *text = NULL, *wall = NULL;
+  int fps = 0, policy = SSD1306_SCHED_DROP, ticker = 0, gray = 0, stream = -1;
+  bool pipeline = true, gray_contrast = false;
+  int res, c;
+
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+    switch (c) {
+      case OPT_STATS: {
+        i2c_stats_enable(stderr);
+        break;
+      }
+      case OPT_BENCH: {
+        return ssd1306_bench();
+      }
+      case OPT_COMPILE: {
+        compile = optarg;
+        break;
+      }
+      case OPT_FPS: {
+        if (((fps = read_int(optarg)) < 0) || (fps > 1000000)) {
+          fprintf(stderr, "ERROR: invalid frame rate `%s'.\n", optarg);
+          return -EINVAL;
+        }
+        break;
+      }
+      case OPT_NO_DROP: {
+        policy = SSD1306_SCHED_SLIP;
+        break;
+      }
+      case OPT_NO_PIPE: {
+        pipeline = false;
+        break;
+      }
+      case OPT_TICKER: {
+        if ((ticker = read_int(optarg)) <= 0) {
+          fprintf(stderr, "ERROR: invalid ticker speed `%s'.\n", optarg);
+          return -EINVAL;
+        }
+        break;
+      }
+      case OPT_TEXT: {
+        text = optarg;
+        break;
+      }
+      case OPT_WALL: {
+        wall = optarg;
+        break;
+      }
+      case OPT_GRAY: {
+        if (((gray = read_int(optarg)) < 2) || (gray > SSD1306_GRAY_BITS_MAX)) {
+          fprintf(stderr, "ERROR: invalid gray bit count `%s', expect 2 to %d.\n", optarg, SSD1306_GRAY_BITS_MAX);
+          return -EINVAL;
+        }
+        break;
+      }
+      case OPT_GRAY_CONTRAST: {
+        gray_contrast = true;
+        break;
+      }
+      case OPT_DITHER: {
+        if (0 == strcmp(optarg, "threshold")) {
+          ssd1306_png_dither = SSD1306_DITHER_THRESHOLD;
+        } else if (0 == strcmp(optarg, "bayer")) {
+          ssd1306_png_dither = SSD1306_DITHER_BAYER;
+        } else if (0 == strcmp(optarg, "fs")) {
+          ssd1306_png_dither = SSD1306_DITHER_FS;
+        } else {
+          fprintf(stderr, "ERROR: unknown dither `%s', expect threshold, bayer or fs.\n", optarg);
+          return -EINVAL;
+        }
+        break;
+      }
+      case OPT_STREAM: {
+        if (0 == strcmp(optarg, "pbm")) {
+          stream = SSD1306_STREAM_PBM;
+        } else if (0 == strcmp(optarg, "pages")) {
+          stream = SSD1306_STREAM_PAGES;
+        } else {
+          fprintf(stderr, "ERROR: unknown stream format `%s', expect pbm or pages.\n", optarg);
+          return -EINVAL;
+        }
+        break;
+      }
+
+      default: {
+        fprintf(stderr, "Usage: %s [--stats] [--bench] [--compile <cache>] [--fps <n> [--no-drop]] [--no-pipeline] [--ticker <columns/s>] [--text <string>] [--wall <bus>:<addr>,...] [--gray <bits> [--gray-contrast]] [--dither threshold|bayer|fs] [--stream pbm|pages] [<sprite PNG or cache, gray image, or stream>]\n", argv[0]);
+        return -EINVAL;
+      }
+    }
+  }
+  if (optind < argc) {
+    sprite = argv[optind];
+  } else if (gray > 0) {
+    sprite = "ui2c_ssd1306_test_gray.png";
+  } else if (stream >= 0) {
+    sprite = "-";
+  }
 
-  if ((file = i2c_open(1)) < 0) {
-    return file;
+  /* Sprite caches are made offline, no bus needed. */
+  if (NULL != compile) {
+    return ssd1306_cache_compile(sprite, compile, 128, 64);
+  }
+  if (NULL != wall) {
+    return wall_main(wall, sprite, fps, policy);
+  }
+
+  if ((res = i2c_open(&bus, 1)) < 0) {
+    return res;
   }
 
-  if ((res = i2c_select(file, SSD1306_DEVAD_A)) < 0) {
+  if ((res = i2c_select(&bus, SSD1306_DEVAD_A)) < 0) {
+    i2c_close(&bus);
     return res;
   }
 
   // TEST ONLY
-  ssd1306_init(file, 128, 64);
-  ssd1306_cls(file, 128, 64); // SSD1306 may have a SRAM-based GDDRAM, some parts of the graphic are perserved after power cycle.
-  ssd1306_send_png(file, 128, 64, "ui2c_ssd1306_test_static.png");
-  sleep(1);
-  ssd1306_send_png_sprite(file, 128, 64, "ui2c_ssd1306_test_sprite.png", 0, 0);
+  if ((res = ssd1306_open(&ssd, &bus, 128, 64)) < 0) {
+    i2c_close(&bus);
+    return res;
+  }
+  /* Transmit on a worker thread while the next frame is prepared. */
+  if (pipeline && ((res = ssd1306_pipeline_start(&ssd)) < 0)) {
+    fprintf(stderr, "WARNING: no pipeline (%s), sending synchronously.\n", strerror(-res));
+    res = 0;
+  }
+  ssd1306_cls(&ssd); // SSD1306 may have a SRAM-based GDDRAM, some parts of the graphic are perserved after power cycle.
+  if ((NULL == text) && (stream < 0)) {
+    /* Splash, status text and streams go up right away */
+    ssd1306_send_png(&ssd, "ui2c_ssd1306_test_static.png");
+    sleep(1);
+  }
+  if (NULL != text) {
+    /* Status text instead of the animation, '\n' starts a line */
+    ssd1306_clear(&ssd, SSD1306_OFF);
+    ssd1306_text(&ssd, 0, 0, &font_5x8, text);
+    res = ssd1306_display(&ssd);
+  } else if (stream >= 0) {
+    /* Newest frame first, the rest is dropped */
+    res = ssd1306_send_stream(&ssd, sprite, stream);
+  } else if (gray > 0) {
+    /* Bit-planes, <fps> is the slot rate */
+    res = ssd1306_send_gray(&ssd, sprite, gray, gray_contrast, fps);
+  } else if (ticker > 0) {
+    /* Marquee of the static image, the framebuffer still holds it. */
+    static uint8_t strip[SSD1306_GDDRAM];
+
+    memcpy(strip, ssd.fb, sizeof(strip));
+    res = ssd1306_send_ticker(&ssd, strip, ssd.width, 0, ssd.height / 8 - 1, ticker);
+  } else {
+    res = ssd1306_send_png_sprite(&ssd, sprite, fps, policy, 0);
+  }
 //  
 //  sleep(1);
 //  
 //  sleep(1);
   // Do not have to send new frames, it will animate itself.
 
-  return 0;
+  ssd1306_pipeline_stop(&ssd);
+  i2c_close(&bus);
+  return res;
 }
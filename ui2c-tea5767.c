@@ -1,5 +1,5 @@
-#include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
@@ -8,7 +8,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 
-#include <linux/i2c-dev.h>
+#include "libui2c.h"
 
 
 /* TEA5767 Definations */
@@ -18,99 +18,11 @@
 
 /* Helper functions */
 
-int i2c_open(int bus) {
-  const int fn_len = 20;
-  char fn[fn_len];
-  int res, file;
-
-  if (bus < 0) {
-    return -EINVAL;
-  }
-
-  /* Open i2c-dev file */
-  snprintf(fn, fn_len, "/dev/i2c-%d", bus);
-  if ((file = open(fn, O_RDWR)) < 0) {
-    perror("open() failed (make sure i2c_dev is loaded and you have the permission)");
-    return file;
-  }
-
-  /* Query functions */
-  unsigned long funcs;
-  if ((res = ioctl(file, I2C_FUNCS, &funcs)) < 0) {
-    perror("ioctl() I2C_FUNCS failed");
-    return res;
-  }
-  fprintf(stdout, "Device: %s (", fn);
-  if (funcs & I2C_FUNC_I2C) {
-    fputs("I2C_FUNC_I2C ", stdout);
-  }
-  if (funcs & I2C_FUNC_SMBUS_BYTE) {
-    fputs("I2C_FUNC_SMBUS_BYTE ", stdout);
-  }
-  fputs("\b)\n", stdout);
-  fflush(stdout);
-
-  return file;
-}
-
-int i2c_select(int file, int addr) {
-  /* addr in [0x00, 0x7f] */
-  int res;
-
-  if ((res = ioctl(file, I2C_SLAVE, addr)) < 0) {
-    perror("ioctl() I2C_SLAVE failed");
-  }
-
-  return res;
-}
-
-int i2c_read_word(int file, uint8_t reg_addr, uint16_t *data) {
-  if (NULL == data) {
-    return -EFAULT;
-  }
-
-  int res;
-  uint8_t tmp[2];
-  if ((res = write(file, &reg_addr, 1)) < 0) {
-    perror("write() register address failed");
-    return res;
-  }
-
-  if ((res = read(file, tmp, 2)) < 0) {
-    perror("read() data failed");
-    return res;
-  }
-
-  *data = (tmp[0] << 8) + tmp[1];
-  return 0;
-}
-
-int i2c_write_byte(int file, uint8_t reg_addr, uint16_t data) {
-  /* must concatenate address and data,                         *
-   * otherwise transfer will be terminated before data is sent. */
-  int res;
-  uint8_t buf[3] = {reg_addr, (data >> 8), (data & 0xff)};
-
-  if ((res = write(file, buf, 3)) < 0) {
-    perror("write() register address / data failed");
-    return res;
-  }
-
-  return 0;
-}
-
-int i2c_write_freq(int file, uint16_t freq_reg) {
-  /* must concatenate address and data,                         *
-   * otherwise transfer will be terminated before data is sent. */
-  int res;
+int tea5767_write_freq(i2c_bus_t *bus, uint16_t freq_reg) {
+  /* The device has no register address, all 5 bytes go in one write. */
   uint8_t buf[5] = {(freq_reg >> 8), (freq_reg & 0xff), 0xb0, 0x10, 0x00};
 
-  if ((res = write(file, buf, 5)) < 0) {
-    perror("write() register address / data failed");
-    return res;
-  }
-
-  return 0;
+  return i2c_write(bus, buf, 5);
 }
 
 /* TEA5767-specific functions */
@@ -128,6 +40,7 @@ uint16_t tea5767_mhz_to_regs(float mhz) {
 
 /******************************************************************************
  * Option list (operations will be carried out in argument list order):
+ * --stats - print I2C transfer statistics
  *****************************************************************************/
 
 void print_help(const char *self) {
@@ -150,6 +63,7 @@ void print_help(const char *self) {
               NOTE: you can use `i2cdetect -l' to list I2C buses present in the\n\
                     system.\n\
     -f <flt>: set frequency in MHz.\n\
+    --stats : print I2C transfer statistics to stderr when a bus is closed.\n\
   \n\
   Example:\n\
     Tune TEA5767 on i2c-1 to 104.1MHz:\n\
@@ -197,8 +111,15 @@ int read_int(const char *s) {
   return i;
 }
 
+#define OPT_STATS (0x100)
+
+static const struct option long_opts[] = {
+  {"stats", no_argument, NULL, OPT_STATS},
+  {NULL,    0,           NULL, 0},
+};
+
 int main(int argc, char *argv[]) {
-  int file = -1;
+  i2c_bus_t bus = I2C_BUS_INIT;
   int res;
 
   if (argc < 2) {
@@ -209,10 +130,10 @@ int main(int argc, char *argv[]) {
   int c;
   int ad = TEA5767_DEVAD_DEF;
   opterr = 0;
-  while ((c = getopt(argc, argv, "a:b:f:")) != -1) {
+  while ((c = getopt_long(argc, argv, "a:b:f:", long_opts, NULL)) != -1) {
     switch (c) {
       case 'a': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to address selection.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -229,8 +150,8 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -239,11 +160,8 @@ int main(int argc, char *argv[]) {
       }
 
       case 'b': {
-        if (file >= 0) {
-          /* We are switching to a new file, close the old one first */
-          close(file);
-          file = -1; /* So we do not double-close */
-        }
+        /* We are switching to a new bus, close the old one first */
+        i2c_close(&bus);
 
         int bn;
         if ((bn = read_int(optarg)) < 0) {
@@ -252,12 +170,12 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((file = i2c_open(bn)) < 0) {
-          return file;
+        if ((res = i2c_open(&bus, bn)) < 0) {
+          return res;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -266,7 +184,7 @@ int main(int argc, char *argv[]) {
       }
 
       case 'f': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -279,14 +197,19 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((res = i2c_write_freq(file, tea5767_mhz_to_regs(mhz))) < 0) {
-          close(file);
+        if ((res = tea5767_write_freq(&bus, tea5767_mhz_to_regs(mhz))) < 0) {
+          i2c_close(&bus);
           return res;
         }
         fprintf(stdout, "Frequency set to: %3.1f MHz\n", mhz);
         break;
       }
 
+      case OPT_STATS: {
+        i2c_stats_enable(stderr);
+        break;
+      }
+
       case '?': {
         handle_bad_opts();
         print_help(argv[0]);
@@ -300,8 +223,6 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (file >= 0) {
-    close(file);
-  }
+  i2c_close(&bus);
   return 0;
 }
@@ -1,5 +1,5 @@
-#include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
@@ -8,7 +8,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 
-#include <linux/i2c-dev.h>
+#include "libui2c.h"
 
 
 /* TMP007 Definations */
@@ -46,89 +46,6 @@
 #define TMP007_REG_DEVID  (0x1f)
 #define TMP007_REG_MEMIO  (0x2a)
 
-/* Helper functions */
-
-int i2c_open(int bus) {
-  const int fn_len = 20;
-  char fn[fn_len];
-  int res, file;
-
-  if (bus < 0) {
-    return -EINVAL;
-  }
-
-  /* Open i2c-dev file */
-  snprintf(fn, fn_len, "/dev/i2c-%d", bus);
-  if ((file = open(fn, O_RDWR)) < 0) {
-    perror("open() failed (make sure i2c_dev is loaded and you have the permission)");
-    return file;
-  }
-
-  /* Query functions */
-  unsigned long funcs;
-  if ((res = ioctl(file, I2C_FUNCS, &funcs)) < 0) {
-    perror("ioctl() I2C_FUNCS failed");
-    return res;
-  }
-  fprintf(stdout, "Device: %s (", fn);
-  if (funcs & I2C_FUNC_I2C) {
-    fputs("I2C_FUNC_I2C ", stdout);
-  }
-  if (funcs & I2C_FUNC_SMBUS_BYTE) {
-    fputs("I2C_FUNC_SMBUS_BYTE ", stdout);
-  }
-  fputs("\b)\n", stdout);
-  fflush(stdout);
-
-  return file;
-}
-
-int i2c_select(int file, int addr) {
-  /* addr in [0x00, 0x7f] */
-  int res;
-
-  if ((res = ioctl(file, I2C_SLAVE, addr)) < 0) {
-    perror("ioctl() I2C_SLAVE failed");
-  }
-
-  return res;
-}
-
-int i2c_read_word(int file, uint8_t reg_addr, uint16_t *data) {
-  if (NULL == data) {
-    return -EFAULT;
-  }
-
-  int res;
-  uint8_t tmp[2];
-  if ((res = write(file, &reg_addr, 1)) < 0) {
-    perror("write() register address failed");
-    return res;
-  }
-
-  if ((res = read(file, tmp, 2)) < 0) {
-    perror("read() data failed");
-    return res;
-  }
-
-  *data = (tmp[0] << 8) + tmp[1];
-  return 0;
-}
-
-int i2c_write_byte(int file, uint8_t reg_addr, uint16_t data) {
-  /* must concatenate address and data,                         *
-   * otherwise transfer will be terminated before data is sent. */
-  int res;
-  uint8_t buf[3] = {reg_addr, (data >> 8), (data & 0xff)};
-
-  if ((res = write(file, buf, 3)) < 0) {
-    perror("write() register address / data failed");
-    return res;
-  }
-
-  return 0;
-}
-
 /* TMP007-specific functions */
 
 double tmp007_reg_to_mv(int16_t reg) {
@@ -139,7 +56,7 @@ double tmp007_reg_to_temp(int16_t reg) {
   return (reg >> 2) * 0.03125f;
 }
 
-int tmp007_print_all(int file) {
+int tmp007_print_all(i2c_bus_t *bus) {
   int res;
   int16_t volt;
   int16_t tdie;
@@ -154,30 +71,30 @@ int tmp007_print_all(int file) {
   uint16_t devid;
   // TODO: mem status
 
-  if ((res = i2c_read_word(file, TMP007_REG_VOLT, (uint16_t *)&volt)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_VOLT, (uint16_t *)&volt)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, TMP007_REG_TDIE, (uint16_t *)&tdie)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_TDIE, (uint16_t *)&tdie)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, TMP007_REG_TOBJ, (uint16_t *)&tobj)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_TOBJ, (uint16_t *)&tobj)) < 0) {
     return res;
   }
 
-  if ((res = i2c_read_word(file, TMP007_REG_TDIE_H, (uint16_t *)&tdieh)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_TDIE_H, (uint16_t *)&tdieh)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, TMP007_REG_TDIE_L, (uint16_t *)&tdiel)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_TDIE_L, (uint16_t *)&tdiel)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, TMP007_REG_TOBJ_H, (uint16_t *)&tobjh)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_TOBJ_H, (uint16_t *)&tobjh)) < 0) {
     return res;
   }
-  if ((res = i2c_read_word(file, TMP007_REG_TOBJ_L, (uint16_t *)&tobjl)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_TOBJ_L, (uint16_t *)&tobjl)) < 0) {
     return res;
   }
 
-  if ((res = i2c_read_word(file, TMP007_REG_DEVID, &devid)) < 0) {
+  if ((res = i2c_read_word_be(bus, TMP007_REG_DEVID, &devid)) < 0) {
     return res;
   }
 
@@ -200,6 +117,7 @@ int tmp007_print_all(int file) {
  * o       - object temperature
  * TODO: F/C switch
  * TODO: L - Oversample + wait local become stable
+ * --stats - print I2C transfer statistics
  *****************************************************************************/
 
 void print_help(const char *self) {
@@ -224,6 +142,7 @@ void print_help(const char *self) {
                     system.\n\
     -l      : print local (die) temperature.\n\
     -o      : print remote (object) temperature.\n\
+    --stats : print I2C transfer statistics to stderr when a bus is closed.\n\
   \n\
   Example:\n\
     Print object temperature measured by TMP007 on i2c-1:\n\
@@ -271,8 +190,15 @@ int read_int(const char *s) {
   return i;
 }
 
+#define OPT_STATS (0x100)
+
+static const struct option long_opts[] = {
+  {"stats", no_argument, NULL, OPT_STATS},
+  {NULL,    0,           NULL, 0},
+};
+
 int main(int argc, char *argv[]) {
-  int file = -1;
+  i2c_bus_t bus = I2C_BUS_INIT;
   int res;
 
   if (argc < 2) {
@@ -283,10 +209,10 @@ int main(int argc, char *argv[]) {
   int c;
   int ad = TMP007_DEVAD_DEF;
   opterr = 0;
-  while ((c = getopt(argc, argv, "a:Ab:lo")) != -1) {
+  while ((c = getopt_long(argc, argv, "a:Ab:lo", long_opts, NULL)) != -1) {
     switch (c) {
       case 'a': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to address selection.\n\n");
           print_help(argv[0]);
           return -EINVAL;
@@ -303,8 +229,8 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -313,25 +239,22 @@ int main(int argc, char *argv[]) {
       }
 
       case 'A': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
-        if ((res = tmp007_print_all(file)) < 0) {
-          close(file);
+        if ((res = tmp007_print_all(&bus)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         break;
       }
 
       case 'b': {
-        if (file >= 0) {
-          /* We are switching to a new file, close the old one first */
-          close(file);
-          file = -1; /* So we do not double-close */
-        }
+        /* We are switching to a new bus, close the old one first */
+        i2c_close(&bus);
 
         int bn;
         if ((bn = read_int(optarg)) < 0) {
@@ -340,12 +263,12 @@ int main(int argc, char *argv[]) {
           return -EINVAL;
         }
 
-        if ((file = i2c_open(bn)) < 0) {
-          return file;
+        if ((res = i2c_open(&bus, bn)) < 0) {
+          return res;
         }
 
-        if ((res = i2c_select(file, ad)) < 0) {
-          close(file);
+        if ((res = i2c_select(&bus, ad)) < 0) {
+          i2c_close(&bus);
           return res;
         }
 
@@ -354,15 +277,15 @@ int main(int argc, char *argv[]) {
       }
 
       case 'l': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
         int16_t tdie;
-        if ((res = i2c_read_word(file, TMP007_REG_TDIE, (uint16_t *)&tdie)) < 0) {
-          close(file);
+        if ((res = i2c_read_word_be(&bus, TMP007_REG_TDIE, (uint16_t *)&tdie)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         fprintf(stdout, "Local Temperature: %.2f C\n", tmp007_reg_to_temp(tdie));
@@ -370,21 +293,26 @@ int main(int argc, char *argv[]) {
       }
 
       case 'o': {
-        if (file < 0) {
+        if (!i2c_is_open(&bus)) {
           fprintf(stderr, "ERROR: bus number not set prior to operation.\n\n");
           print_help(argv[0]);
           return -EINVAL;
         }
 
         int16_t tobj;
-        if ((res = i2c_read_word(file, TMP007_REG_TOBJ, (uint16_t *)&tobj)) < 0) {
-          close(file);
+        if ((res = i2c_read_word_be(&bus, TMP007_REG_TOBJ, (uint16_t *)&tobj)) < 0) {
+          i2c_close(&bus);
           return res;
         }
         fprintf(stdout, "Remote Temperature: %.2f C\n", tmp007_reg_to_temp(tobj));
         break;
       }
 
+      case OPT_STATS: {
+        i2c_stats_enable(stderr);
+        break;
+      }
+
       case '?': {
         handle_bad_opts();
         print_help(argv[0]);
@@ -398,8 +326,6 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (file >= 0) {
-    close(file);
-  }
+  i2c_close(&bus);
   return 0;
 }
@@ -0,0 +1,757 @@
+#include <unistd.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "libui2c.h"
+#include "ui2cd.h"
+
+/******************************************************************************
+ * ui2cd: per-bus arbitration daemon.
+ *
+ * Owns the adapters given with -b and serves clients (any ui2c tool started
+ * with UI2C_DAEMON set) over a Unix socket. Requests that arrive together are
+ * queued and executed in arrival order, except that register reads of the
+ * same device are coalesced:
+ *   - reads starting at the same register are served from one transaction
+ *     (safe for any device, the shorter ones get a prefix);
+ *   - for devices declared with -i (byte registers with address
+ *     auto-increment, e.g. DS1307), overlapping or nearly adjacent ranges are
+ *     merged into one burst.
+ * A read never moves across an earlier queued write to the same device.
+ *
+ * Register reads are cached for -t milliseconds; any write to a device drops
+ * its entries.
+ *****************************************************************************/
+
+#define UI2CD_BUSES_MAX   (8)
+#define UI2CD_CLIENTS_MAX (32)
+#define UI2CD_CACHE_SIZE  (64)
+#define UI2CD_MERGE_MAX   (32)  /* Longest coalesced or cached register read */
+#define UI2CD_MERGE_GAP   (4)   /* Unrequested bytes worth reading to save a transaction */
+#define UI2CD_TTL_DEF     (20)
+#define UI2CD_WINDOW_DEF  (0)
+
+
+typedef struct {
+  int fd;
+  int nr;                       /* Bus opened by this client, or -1 */
+  bool pending;
+  unsigned long seq;            /* Arrival order of the pending request */
+  ui2cd_req_t req;
+  ui2cd_rsp_t rsp;
+  uint8_t data[UI2CD_DATA_MAX]; /* Request payload, then response payload */
+} client_t;
+
+typedef struct {
+  bool valid;
+  int nr;
+  uint8_t addr;
+  uint8_t reg;
+  uint8_t len;
+  struct timespec at;
+  uint8_t data[UI2CD_MERGE_MAX];
+} cache_t;
+
+typedef struct {
+  unsigned long requests;
+  unsigned long cache_hits;
+  unsigned long coalesced;      /* Reads served by another client's transaction */
+  unsigned long transactions;
+} ui2cd_stats_t;
+
+volatile bool stop;
+
+static i2c_bus_t buses[UI2CD_BUSES_MAX];
+static size_t nbuses = 0;
+static client_t clients[UI2CD_CLIENTS_MAX];
+static size_t nclients = 0;
+static cache_t cache[UI2CD_CACHE_SIZE];
+static bool autoinc[0x80];
+static long ttl_ms = UI2CD_TTL_DEF;
+static unsigned long seq = 0;
+static ui2cd_stats_t stats;
+
+
+void stop_handler(int signum) {
+  stop = true;
+}
+
+static long ms_since(const struct timespec *t0) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - t0->tv_sec) * 1000 + (now.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+static i2c_bus_t *find_bus(int nr) {
+  size_t i;
+
+  for (i = 0; i < nbuses; i ++) {
+    if (buses[i].nr == nr) {
+      return &buses[i];
+    }
+  }
+
+  return NULL;
+}
+
+
+/* Cache */
+
+static bool cache_covers(const cache_t *e, int nr, uint8_t addr, uint8_t reg, size_t len) {
+  if ((!e->valid) || (e->nr != nr) || (e->addr != addr)) {
+    return false;
+  }
+  if (autoinc[addr]) {
+    return (reg >= e->reg) && (reg + len <= e->reg + e->len);
+  }
+  return (reg == e->reg) && (len <= e->len);
+}
+
+static bool cache_lookup(int nr, uint8_t addr, uint8_t reg, uint8_t data[], size_t len) {
+  size_t i;
+
+  if ((ttl_ms <= 0) || (len > UI2CD_MERGE_MAX)) {
+    return false;
+  }
+
+  for (i = 0; i < UI2CD_CACHE_SIZE; i ++) {
+    cache_t *e = &cache[i];
+
+    if (cache_covers(e, nr, addr, reg, len)) {
+      if (ms_since(&e->at) >= ttl_ms) {
+        e->valid = false;
+        continue;
+      }
+      memcpy(data, &e->data[reg - e->reg], len);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void cache_insert(int nr, uint8_t addr, uint8_t reg, const uint8_t data[], size_t len) {
+  cache_t *e = &cache[0];
+  size_t i;
+
+  if ((ttl_ms <= 0) || (len > UI2CD_MERGE_MAX)) {
+    return;
+  }
+
+  /* Free slot, otherwise the oldest one */
+  for (i = 0; i < UI2CD_CACHE_SIZE; i ++) {
+    if (!cache[i].valid) {
+      e = &cache[i];
+      break;
+    }
+    if ((cache[i].at.tv_sec < e->at.tv_sec) || ((cache[i].at.tv_sec == e->at.tv_sec) && (cache[i].at.tv_nsec < e->at.tv_nsec))) {
+      e = &cache[i];
+    }
+  }
+
+  e->valid = true;
+  e->nr    = nr;
+  e->addr  = addr;
+  e->reg   = reg;
+  e->len   = len;
+  memcpy(e->data, data, len);
+  clock_gettime(CLOCK_MONOTONIC, &e->at);
+}
+
+static void cache_drop(int nr, uint8_t addr) {
+  size_t i;
+
+  for (i = 0; i < UI2CD_CACHE_SIZE; i ++) {
+    if ((cache[i].nr == nr) && (cache[i].addr == addr)) {
+      cache[i].valid = false;
+    }
+  }
+}
+
+
+/* Clients */
+
+static void client_drop(size_t i) {
+  close(clients[i].fd);
+  clients[i] = clients[-- nclients];
+}
+
+static void client_respond(client_t *c) {
+  struct iovec iov[2] = {
+    {.iov_base = &c->rsp, .iov_len = sizeof(c->rsp)},
+    {.iov_base = c->data, .iov_len = c->rsp.len},
+  };
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (c->rsp.len > 0) ? 2 : 1};
+
+  if (c->rsp.res < 0) {
+    c->rsp.len = 0;
+    msg.msg_iovlen = 1;
+  }
+  if (sendmsg(c->fd, &msg, MSG_NOSIGNAL) < 0) {
+    /* Client went away, reaped on its next poll() */
+    perror("sendmsg() to client failed");
+  }
+  c->pending = false;
+}
+
+static void client_recv(client_t *c) {
+  uint8_t buf[sizeof(ui2cd_req_t) + UI2CD_DATA_MAX];
+  ssize_t n;
+
+  memset(&c->rsp, 0, sizeof(c->rsp));
+  if ((n = recv(c->fd, buf, sizeof(buf), 0)) <= 0) {
+    c->fd = -c->fd - 1; /* Mark for removal */
+    return;
+  }
+
+  stats.requests ++;
+  c->pending = true;
+  c->seq     = seq ++;
+
+  if (n < (ssize_t)sizeof(c->req)) {
+    c->rsp.res = -EPROTO;
+    client_respond(c);
+    return;
+  }
+  memcpy(&c->req, buf, sizeof(c->req));
+  n -= sizeof(c->req);
+
+  switch (c->req.op) {
+    case UI2CD_OP_WRITE:
+    case UI2CD_OP_WRITE_BULK:
+    case UI2CD_OP_WRITE_REG: {
+      if ((n != c->req.len) || (0 == n)) {
+        c->rsp.res = -EPROTO;
+        client_respond(c);
+        return;
+      }
+      memcpy(c->data, &buf[sizeof(c->req)], n);
+      break;
+    }
+    case UI2CD_OP_READ:
+    case UI2CD_OP_READ_REG: {
+      if ((0 != n) || (0 == c->req.len) || (c->req.len > UI2CD_DATA_MAX)) {
+        c->rsp.res = -EPROTO;
+        client_respond(c);
+        return;
+      }
+      break;
+    }
+    case UI2CD_OP_OPEN: {
+      break;
+    }
+    default: {
+      c->rsp.res = -EOPNOTSUPP;
+      client_respond(c);
+      return;
+    }
+  }
+
+  if ((UI2CD_OP_OPEN != c->req.op) && (NULL == find_bus(c->nr))) {
+    c->rsp.res = -EBADF;
+    client_respond(c);
+  }
+}
+
+/* Waits up to timeout_ms for new clients and requests. */
+static void gather(int listen_fd, int timeout_ms) {
+  struct pollfd fds[UI2CD_CLIENTS_MAX + 1];
+  size_t i;
+  int fd;
+
+  fds[0].fd     = listen_fd;
+  fds[0].events = POLLIN;
+  for (i = 0; i < nclients; i ++) {
+    /* One outstanding request per client, leave the rest in the socket. */
+    fds[i + 1].fd     = clients[i].pending ? -1 : clients[i].fd;
+    fds[i + 1].events = POLLIN;
+  }
+
+  if (poll(fds, nclients + 1, timeout_ms) <= 0) {
+    return;
+  }
+
+  for (i = 0; i < nclients; i ++) {
+    if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      client_recv(&clients[i]);
+    }
+  }
+  for (i = nclients; i > 0; i --) {
+    if (clients[i - 1].fd < 0) {
+      clients[i - 1].fd = -clients[i - 1].fd - 1;
+      client_drop(i - 1);
+    }
+  }
+
+  if (fds[0].revents & POLLIN) {
+    if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+      perror("accept() failed");
+    } else if (nclients >= UI2CD_CLIENTS_MAX) {
+      fprintf(stderr, "WARN: too many clients, rejecting.\n");
+      close(fd);
+    } else {
+      memset(&clients[nclients], 0, sizeof(clients[nclients]));
+      clients[nclients].fd = fd;
+      clients[nclients].nr = -1;
+      nclients ++;
+    }
+  }
+}
+
+
+/* Execution */
+
+static bool is_write(const client_t *c) {
+  return (UI2CD_OP_WRITE == c->req.op) || (UI2CD_OP_WRITE_BULK == c->req.op) || (UI2CD_OP_WRITE_REG == c->req.op);
+}
+
+static void exec_read_reg(client_t *c) {
+  client_t *members[UI2CD_CLIENTS_MAX];
+  size_t nmembers = 0, i;
+  unsigned long barrier = ~0ul;
+  unsigned lo = c->req.reg, hi = c->req.reg + c->req.len;
+  uint8_t buf[UI2CD_DATA_MAX];
+  i2c_bus_t *bus = find_bus(c->nr);
+  int res;
+
+  if (cache_lookup(c->nr, c->req.addr, c->req.reg, c->data, c->req.len)) {
+    stats.cache_hits ++;
+    c->rsp.len = c->req.len;
+    client_respond(c);
+    return;
+  }
+
+  /* Reads queued after a write to the same device must see that write. */
+  for (i = 0; i < nclients; i ++) {
+    client_t *d = &clients[i];
+
+    if (d->pending && (d->seq > c->seq) && (d->seq < barrier) && (d->nr == c->nr) && (d->req.addr == c->req.addr) && is_write(d)) {
+      barrier = d->seq;
+    }
+  }
+
+  members[nmembers ++] = c;
+  for (i = 0; i < nclients; i ++) {
+    client_t *d = &clients[i];
+    unsigned dlo = d->req.reg, dhi = d->req.reg + d->req.len;
+    unsigned nlo = (dlo < lo) ? dlo : lo, nhi = (dhi > hi) ? dhi : hi;
+
+    if ((d == c) || !d->pending || (d->seq < c->seq) || (d->seq > barrier) ||
+        (UI2CD_OP_READ_REG != d->req.op) || (d->nr != c->nr) || (d->req.addr != c->req.addr)) {
+      continue;
+    }
+
+    /* Same start register: the longer read covers the shorter one on any device. */
+    if (dlo != lo) {
+      if (!autoinc[c->req.addr] || (nhi - nlo > UI2CD_MERGE_MAX) || (nhi > 0x100)) {
+        continue;
+      }
+      if ((dlo > hi + UI2CD_MERGE_GAP) || (lo > dhi + UI2CD_MERGE_GAP)) {
+        continue;
+      }
+    }
+
+    lo = nlo;
+    hi = nhi;
+    members[nmembers ++] = d;
+  }
+
+  if (((res = i2c_select(bus, c->req.addr)) >= 0) && ((res = i2c_read_reg(bus, lo, buf, hi - lo)) >= 0)) {
+    cache_insert(c->nr, c->req.addr, lo, buf, hi - lo);
+  }
+  stats.transactions ++;
+  stats.coalesced += nmembers - 1;
+
+  for (i = 0; i < nmembers; i ++) {
+    client_t *m = members[i];
+
+    m->rsp.res = res;
+    if (res >= 0) {
+      m->rsp.len = m->req.len;
+      memcpy(m->data, &buf[m->req.reg - lo], m->req.len);
+    }
+    client_respond(m);
+  }
+}
+
+static void exec(client_t *c) {
+  i2c_bus_t *bus = find_bus(c->nr);
+  int res;
+
+  switch (c->req.op) {
+    case UI2CD_OP_OPEN: {
+      if (NULL == (bus = find_bus(c->req.arg))) {
+        c->rsp.res = -ENODEV;
+      } else {
+        c->nr = c->req.arg;
+        c->rsp.arg = bus->funcs;
+      }
+      client_respond(c);
+      return;
+    }
+    case UI2CD_OP_READ_REG: {
+      exec_read_reg(c);
+      return;
+    }
+    default: {
+      break;
+    }
+  }
+
+  if (is_write(c)) {
+    cache_drop(c->nr, c->req.addr);
+  }
+
+  if ((res = i2c_select(bus, c->req.addr)) >= 0) {
+    switch (c->req.op) {
+      case UI2CD_OP_READ: {
+        if ((res = i2c_read(bus, c->data, c->req.len)) >= 0) {
+          c->rsp.len = c->req.len;
+        }
+        break;
+      }
+      case UI2CD_OP_WRITE: {
+        res = i2c_write(bus, c->data, c->req.len);
+        break;
+      }
+      case UI2CD_OP_WRITE_BULK: {
+        res = i2c_write_bulk(bus, c->data, c->req.len);
+        break;
+      }
+      case UI2CD_OP_WRITE_REG: {
+        res = i2c_write_reg(bus, c->req.reg, c->data, c->req.len);
+        break;
+      }
+    }
+  }
+  stats.transactions ++;
+
+  c->rsp.res = res;
+  client_respond(c);
+}
+
+/* Executes everything queued, oldest first. */
+static void process(void) {
+  client_t *c;
+  size_t i;
+
+  for (;;) {
+    c = NULL;
+    for (i = 0; i < nclients; i ++) {
+      if (clients[i].pending && ((NULL == c) || (clients[i].seq < c->seq))) {
+        c = &clients[i];
+      }
+    }
+    if (NULL == c) {
+      return;
+    }
+    exec(c);
+  }
+}
+
+
+/* Socket */
+
+static int listen_on(const char *path) {
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+  struct stat st;
+  bool retry;
+  int fd, res;
+
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    fprintf(stderr, "ERROR: socket path `%s' too long.\n", path);
+    return -ENAMETOOLONG;
+  }
+  strcpy(sa.sun_path, path);
+
+  /* Bind, or remove a stale socket and bind once more. */
+  for (retry = true; ; retry = false) {
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+      res = -errno;
+      perror("socket() failed");
+      return res;
+    }
+    if (0 == bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+      break;
+    }
+    res = -errno;
+    if ((-EADDRINUSE != res) || !retry) {
+      fprintf(stderr, "bind() failed: %s\n", strerror(-res));
+      close(fd);
+      return res;
+    }
+
+    /* Stale socket, or another daemon? */
+    if (0 == connect(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+      fprintf(stderr, "ERROR: another ui2cd is serving %s.\n", path);
+      close(fd);
+      return -EADDRINUSE;
+    }
+    close(fd);
+
+    /* Never remove anything but a socket */
+    if ((lstat(path, &st) < 0) || !S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "ERROR: %s exists and is not a socket.\n", path);
+      return -EADDRINUSE;
+    }
+    if (unlink(path) < 0) {
+      res = -errno;
+      perror("unlink() failed");
+      return res;
+    }
+  }
+
+  if (listen(fd, UI2CD_CLIENTS_MAX) < 0) {
+    res = -errno;
+    perror("listen() failed");
+    close(fd);
+    unlink(path);
+    return res;
+  }
+
+  return fd;
+}
+
+
+/******************************************************************************
+ * Option list:
+ * b <int> - serve bus (repeatable)
+ * i <int> - device with auto-increment byte registers (repeatable)
+ * s <str> - socket path
+ * t <int> - cache TTL in ms
+ * w <int> - queueing window in us
+ * --stats - print statistics on exit
+ *****************************************************************************/
+
+void print_help(const char *self) {
+  fprintf(stderr, "\
+  I2C bus arbitration daemon for ui2c utilities\n\
+  \n\
+  Usage:\n\
+    %s -b <bus number> [-b <bus number> ...] [options]\n\
+  \n\
+  Clients are ui2c utilities started with UI2C_DAEMON=<socket> (an empty value\n\
+  selects the default socket).\n\
+  \n\
+  Options:\n\
+    -b <int>: serve this bus, can be repeated.\n\
+    -i <int>: declare a device with byte registers and address auto-increment\n\
+              (e.g. 0x68 for DS1307), so reads of nearby registers from\n\
+              different clients can be merged. Can be repeated.\n\
+    -s <str>: socket path (default: %s). Keep it in a directory other\n\
+              users cannot write to.\n\
+    -t <int>: register read cache lifetime in ms, 0 to disable (default: %d).\n\
+    -w <int>: after a request arrives, wait this many us for more to coalesce\n\
+              (default: %d).\n\
+    --stats : print arbitration and I2C transfer statistics on exit.\n\
+  \n\
+  Example:\n\
+    Share i2c-1 between a display and two pollers:\n\
+      %s -b 1 -i 0x68 &\n\
+      UI2C_DAEMON= ui2c-tmp007 -b 1 -o\n\
+  \n", self, UI2CD_SOCK_DEF, UI2CD_TTL_DEF, UI2CD_WINDOW_DEF, self);
+}
+
+void handle_bad_opts(void) {
+  if ((optopt == 'b') || (optopt == 'i') || (optopt == 's') || (optopt == 't') || (optopt == 'w')) {
+    fprintf(stderr, "ERROR: option -%c requires an argument.\n\n", optopt);
+  } else if (isprint(optopt)) {
+    fprintf(stderr, "ERROR: unknown option `-%c'.\n\n", optopt);
+  } else {
+    fprintf(stderr, "ERROR: unknown option character `\\x%x'.\n\n", optopt);
+  }
+}
+
+int read_int(const char *s) {
+  /* convert a base 8 / 10 / 16 number in string into integer */
+  int i = -EIO;
+
+  if (NULL == s) {
+    return -EFAULT;
+  }
+
+  if ('0' == s[0]) {
+    if (('x' == s[1]) || ('X' == s[1])) {
+      /* Hex */
+      if (sscanf(&s[2], "%x", &i) != 1) {
+        return -EINVAL;
+      }
+    } else {
+      /* Oct */
+      if (sscanf(s, "%o", &i) != 1) {
+        return -EINVAL;
+      }
+    }
+  } else {
+    /* Dec */
+    if (sscanf(s, "%d", &i) != 1) {
+      return -EINVAL;
+    }
+  }
+
+  return i;
+}
+
+#define OPT_STATS (0x100)
+
+static const struct option long_opts[] = {
+  {"stats", no_argument, NULL, OPT_STATS},
+  {NULL,    0,           NULL, 0},
+};
+
+int main(int argc, char *argv[]) {
+  const char *path = UI2CD_SOCK_DEF;
+  long window_us = UI2CD_WINDOW_DEF;
+  bool print_stats = false;
+  struct sigaction sia;
+  int c, v, res = 0, listen_fd;
+  size_t i;
+
+  if (argc < 2) {
+    print_help(argv[0]);
+    return 0;
+  }
+
+  /* We are the one talking to the hardware. */
+  unsetenv("UI2C_DAEMON");
+
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, "b:i:s:t:w:", long_opts, NULL)) != -1) {
+    switch (c) {
+      case 'b': {
+        if ((v = read_int(optarg)) < 0) {
+          fprintf(stderr, "ERROR: invalid bus number `%s'.\n\n", optarg);
+          print_help(argv[0]);
+          res = -EINVAL;
+          goto out;
+        }
+        if (NULL != find_bus(v)) {
+          break;
+        }
+        if (nbuses >= UI2CD_BUSES_MAX) {
+          fprintf(stderr, "ERROR: too many buses.\n\n");
+          res = -EINVAL;
+          goto out;
+        }
+
+        buses[nbuses] = (i2c_bus_t)I2C_BUS_INIT;
+        if ((res = i2c_open(&buses[nbuses], v)) < 0) {
+          goto out;
+        }
+        nbuses ++;
+        break;
+      }
+
+      case 'i': {
+        if (((v = read_int(optarg)) < 0x03) || (v > 0x7f)) {
+          fprintf(stderr, "ERROR: invalid slave address `%s'.\n\n", optarg);
+          res = -EINVAL;
+          goto out;
+        }
+        autoinc[v] = true;
+        break;
+      }
+
+      case 's': {
+        path = optarg;
+        break;
+      }
+
+      case 't': {
+        if ((v = read_int(optarg)) < 0) {
+          fprintf(stderr, "ERROR: invalid cache lifetime `%s'.\n\n", optarg);
+          res = -EINVAL;
+          goto out;
+        }
+        ttl_ms = v;
+        break;
+      }
+
+      case 'w': {
+        if ((v = read_int(optarg)) < 0) {
+          fprintf(stderr, "ERROR: invalid queueing window `%s'.\n\n", optarg);
+          res = -EINVAL;
+          goto out;
+        }
+        window_us = v;
+        break;
+      }
+
+      case OPT_STATS: {
+        print_stats = true;
+        i2c_stats_enable(stderr);
+        break;
+      }
+
+      case '?': {
+        handle_bad_opts();
+        print_help(argv[0]);
+        res = -EINVAL;
+        goto out;
+      }
+
+      default: {
+        fprintf(stderr, "BUG: switch fall-through on `%c'!\n", c);
+        abort();
+      }
+    }
+  }
+
+  if (0 == nbuses) {
+    fprintf(stderr, "ERROR: no bus to serve.\n\n");
+    print_help(argv[0]);
+    return -EINVAL;
+  }
+
+  stop = false;
+  memset(&sia, 0, sizeof(sia));
+  sia.sa_handler = stop_handler;
+  sigaction(SIGINT, &sia, NULL);
+  sigaction(SIGTERM, &sia, NULL);
+
+  if ((listen_fd = listen_on(path)) < 0) {
+    res = listen_fd;
+    goto out;
+  }
+  fprintf(stdout, "Listening on %s\n", path);
+  fflush(stdout);
+
+  while (!stop) {
+    gather(listen_fd, -1);
+    if (window_us > 0) {
+      gather(listen_fd, (window_us + 999) / 1000);
+    }
+    process();
+  }
+
+  for (i = nclients; i > 0; i --) {
+    client_drop(i - 1);
+  }
+  close(listen_fd);
+  unlink(path);
+
+  if (print_stats) {
+    fprintf(stderr, "ui2cd: %lu requests, %lu cache hits, %lu coalesced, %lu bus operations\n",
+            stats.requests, stats.cache_hits, stats.coalesced, stats.transactions);
+  }
+
+out:
+  for (i = 0; i < nbuses; i ++) {
+    i2c_close(&buses[i]);
+  }
+  return res;
+}
@@ -0,0 +1,47 @@
+#ifndef __UI2CD_H__
+#define __UI2CD_H__
+
+#include <stdint.h>
+
+/******************************************************************************
+ * ui2cd wire protocol.
+ *
+ * ui2cd owns the adapter fds and serializes access for all clients. Clients
+ * talk to it over a SOCK_SEQPACKET Unix socket, one request and one response
+ * per packet, one outstanding request per client. Each packet is a header
+ * followed by up to UI2CD_DATA_MAX bytes of payload.
+ *
+ * Requests are made at register level rather than as raw messages, so the
+ * daemon can coalesce reads from different clients and serve repeated reads
+ * from its cache.
+ *****************************************************************************/
+
+/* In a root-owned directory, so no other user can claim the path first */
+#define UI2CD_SOCK_DEF "/run/ui2cd.sock"
+#define UI2CD_DATA_MAX (4096)
+
+enum {
+  UI2CD_OP_OPEN = 1,          /* arg = bus number, response arg = I2C_FUNCS */
+  UI2CD_OP_READ,
+  UI2CD_OP_WRITE,
+  UI2CD_OP_WRITE_BULK,
+  UI2CD_OP_READ_REG,
+  UI2CD_OP_WRITE_REG,
+};
+
+typedef struct {
+  uint8_t op;
+  uint8_t addr;
+  uint8_t reg;
+  uint8_t pad;
+  int32_t arg;
+  uint32_t len;               /* Reads: bytes wanted, writes: bytes following */
+} ui2cd_req_t;
+
+typedef struct {
+  int32_t res;                /* 0 or negative errno */
+  int32_t arg;
+  uint32_t len;               /* Bytes following */
+} ui2cd_rsp_t;
+
+#endif /* __UI2CD_H__ */